@@ -1,6 +1,12 @@
-[org 0x7C00]
+; The BIOS loads this sector to 0x7C00, but it copies itself down to 0x0600 first thing
+; so the kernel can be loaded over 0x7C00
+[org 0x0600]
 
-kernel_offset equ 0x1000
+image_offset equ 0x20000	; kernel.bin is loaded here, it unpacks the kernel to 0x1000 (see unlz4.asm)
+image_segment equ 0x2000
+
+; TSC timestamps of the boot milestones, 8 bytes each, the kernel reports them (see boottime.c)
+boot_stamps equ 0x0500		; entry, kernel.bin loaded, protected mode (unlz4.asm adds unpacked)
 
 jmp short _start
 nop
@@ -29,9 +35,28 @@ volumeLabel				db "BOOT FLOPPY"
 systemID				db "FAT16   "
 
 _start:
-	mov bp, 0x8000		; Setup stack and frame pointers
+	; Nothing before the jump may use a label, this code still runs at 0x7C00
+	xor ax, ax
+	mov ds, ax
+	mov es, ax
+	mov ss, ax
+	rdtsc
+	mov [boot_stamps], eax
+	mov [boot_stamps + 4], edx
+	mov si, 0x7C00
+	mov di, 0x0600
+	mov cx, 256			; 256 words = 512 bytes
+	cld
+	rep movsw
+	jmp 0x0000:relocated
+
+relocated:
+	mov bp, 0x1000		; Setup stack and frame pointers (the stack grows down towards the end of this bootloader)
 	mov sp, bp
 	call load_kernel	; Load the kernel
+	rdtsc
+	mov [boot_stamps + 8], eax
+	mov [boot_stamps + 12], edx
 	call switch			; Switch to protected mode
 	jmp $
 
@@ -40,9 +65,55 @@ _start:
 %include "./asm/switch.asm"
 
 [bits 16]
+; kernel.bin is looked up in the root directory, its size and first cluster say what to load
+; (the Makefile builds the FATs and the root directory from the size of kernel.bin, its clusters are contiguous)
 load_kernel:
-	mov bx, kernel_offset 
-	mov dh, 48			; Load 18 (the maximum) amount of sectors in the first head and cylinder
+	; Read the first sector of the root directory to where kernel.bin goes
+	mov ax, image_segment
+	mov es, ax
+	xor bx, bx
+	mov al, [fatCount]
+	cbw
+	mul word [sectorsPerFat]
+	add ax, [reservedSectors]
+	push ax				; ax = lba of the root directory
+	mov cx, 1
+	call disk_load
+
+	; Find the entry of kernel.bin
+	mov di, -32
+find_kernel:
+	add di, 32
+	cmp di, 512
+	je error
+	push di
+	mov si, kernel_name
+	mov cx, 11
+	repe cmpsb
+	pop di
+	jne find_kernel
+
+	; cx = sectors to load ((fileSize + 511) / 512)
+	mov ax, [es:di + 28]
+	mov dx, [es:di + 30]
+	add ax, 511
+	adc dx, 0
+	mov cx, 512
+	div cx
+	mov cx, ax
+
+	; ax = lba of the first cluster (the data area starts right after the root directory)
+	mov ax, [es:di + 26]
+	sub ax, 2
+	mov dl, [sectorsPerCluster]
+	xor dh, dh
+	mul dx
+	pop dx
+	add ax, dx
+	mov dx, [rootDirectoryEntries]
+	shr dx, 4			; 16 entries per sector
+	add ax, dx
+
 	call disk_load		; Load the disk so we can properly start the kernel
 
 	; Put your code here to disable the blinking cursor
@@ -53,9 +124,14 @@ load_kernel:
 	
 	ret
 
+kernel_name db "kernel  bin"
+
 [bits 32]
 pmode:
-	call kernel_offset
+	rdtsc
+	mov [boot_stamps + 16], eax
+	mov [boot_stamps + 20], edx
+	call image_offset
 	jmp $
 
 times 510 - ($ - $$) db 0
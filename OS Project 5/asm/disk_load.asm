@@ -1,24 +1,67 @@
+; Reads cx sectors starting at lba ax to es:bx
+; Every int 0x13 call stays inside one track, so the BIOS never has to carry on onto the next head or cylinder,
+; and inside one 64 KB page, which the BIOS's DMA can't cross. Whole tracks are read in one call each.
 disk_load:
-	pusha 
-	push dx			; number of sectors (input parameter)
+	pusha
+	push es
+	mov si, ax			; si = next lba
+	mov di, cx			; di = sectors left
+
+next_read:
+	; bp = sectors up to the next 64 KB boundary
+	mov ax, es
+	shl ax, 4
+	add ax, bx
+	neg ax
+	shr ax, 9
+	jnz boundary
+	mov al, 128			; right on a boundary, a whole 64 KB fits
+boundary:
+	mov bp, ax
+	cmp bp, di
+	jbe sectors_left
+	mov bp, di
+sectors_left:
 
-	mov ah, 0x02 	; read function 
-	mov al, dh 		; number of sectors
-	mov dl, 0x00 	; drive number
-	mov dh, 0x01 	; head number
-	mov ch, 0x00 	; cylinder number  
-	mov cl, 0x10 	; sector number 
+	; lba -> cylinder, head, sector, and no further than the end of the track
+	mov ax, si
+	xor dx, dx
+	div word [sectorsPerTrack]	; ax = track, dx = sector - 1
+	mov cx, [sectorsPerTrack]
+	sub cx, dx
+	cmp bp, cx
+	jbe track_left
+	mov bp, cx
+track_left:
+	mov cl, dl
+	inc cl 			; sector number
+	xor dx, dx
+	div word [headCount]
+	mov ch, al 		; cylinder number
+	mov dh, dl 		; head number
+	mov dl, [driveNumber]
 
-	; read data to [es:bx] 
+	; read data to [es:bx]
+	mov ax, bp
+	mov ah, 0x02 	; read function, al = number of sectors
 	int 0x13
 	jc error 		; carry bit is set -> error
 
-	pop dx 
-	cmp al, dh 		; read correct number of sectors
-	jne error 
+	cmp ax, bp 		; read correct number of sectors (ah is 0 on success)
+	jne error
 
-	popa 
-	ret 
+	add si, bp
+	sub di, bp
+	shl bp, 5 		; sectors -> paragraphs, move es past what was read
+	mov ax, es
+	add ax, bp
+	mov es, ax
+	test di, di
+	jnz next_read
+
+	pop es
+	popa
+	ret
 
 error:
 	mov bx, error_msg
@@ -43,6 +43,7 @@ global _syscall
 
 [extern kpanic]
 [extern _syscall_isr]
+[extern _fault_handler]
 
 _isr0:
 	cli
@@ -224,9 +225,9 @@ isr_common_stub:
 	mov gs, ax
 	mov eax, esp                   ; Push us the stack
 	push eax
-	;mov eax, _syscall_isr		   ; execute the system call
-                                   ; prints exception message and halts system.
-	;call eax	                   ; A special call, preserves the 'eip' register
+	mov eax, _fault_handler		   ; handles page faults for mapped files,
+                                   ; otherwise prints exception message and halts system.
+	call eax	                   ; A special call, preserves the 'eip' register
 	pop eax
 	pop gs
 	pop fs
@@ -1,4 +1,68 @@
 [bits 32]
 [extern main]
+[extern __bss_start]
+[extern _end]
+[global multiboot_entry]
+[global multibootMagic]
+[global multibootInfo]
+
+; kernel.bin is started at its first byte (see unlz4.asm), the same code linked as kernel.elf is started by
+; a Multiboot loader (QEMU's -kernel, GRUB) at multiboot_entry
+jmp start
+
+; https://www.gnu.org/software/grub/manual/multiboot/multiboot.html#Header-layout
+MULTIBOOT_MAGIC equ 0x1BADB002
+MULTIBOOT_FLAGS equ 0x00000003		; modules page aligned, memory information wanted
+
+align 4
+multiboot_header:
+	dd MULTIBOOT_MAGIC
+	dd MULTIBOOT_FLAGS
+	dd -(MULTIBOOT_MAGIC + MULTIBOOT_FLAGS)
+
+; The loader leaves the CPU in protected mode with paging off, but the GDT, the stack and SSE
+; are for the kernel to set up, the same way switch.asm does after the bootloader
+multiboot_entry:
+	mov [multibootMagic], eax
+	mov [multibootInfo], ebx
+
+	lgdt [gdt_descriptor]
+	jmp CODE_SEG:multiboot_segments
+multiboot_segments:
+	mov ax, DATA_SEG
+	mov ds, ax
+	mov ss, ax
+	mov es, ax
+	mov fs, ax
+	mov gs, ax
+
+	mov ebp, 0x80000
+	mov esp, ebp
+
+	; Enable SSE instructions
+	mov eax, cr0
+	and ax, 0xFFFB		;clear coprocessor emulation CR0.EM
+	or ax, 0x2			;set coprocessor monitoring  CR0.MP
+	mov cr0, eax
+	mov eax, cr4
+	or ax, 3 << 9		;set CR4.OSFXSR and CR4.OSXMMEXCPT at the same time
+	mov cr4, eax
+
+start:
+; The .bss section is not part of kernel.bin, so nothing has cleared it yet
+mov edi, __bss_start
+mov ecx, _end
+sub ecx, edi
+xor eax, eax
+cld
+rep stosb
+
 call main   ; Enter our kernel's main function
-jmp $
\ No newline at end of file
+jmp $
+
+%include "./asm/gdt.asm"
+
+[section .data]
+; What the Multiboot loader passed in, both stay 0 when booted from the floppy (see multiboot.c)
+multibootMagic dd 0
+multibootInfo dd 0
\ No newline at end of file
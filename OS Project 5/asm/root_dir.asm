@@ -1,4 +1,5 @@
 ; Root Directory Contents
+; KERNEL_SIZE is the size of kernel.bin, the Makefile passes it in
 rootDir:
 fileName            db "kernel  "
 extension           db "bin"   
@@ -11,5 +12,5 @@ ignored             dw 0
 lastWriteTime       dw 0
 lastWriteDate       dw 0
 startingCluster     dw 2
-fileSize            dd 24576
+fileSize            dd KERNEL_SIZE
 times (512 * 14) - ($ - rootDir) db 0
\ No newline at end of file
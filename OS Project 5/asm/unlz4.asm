@@ -0,0 +1,66 @@
+; kernel.bin on the disk is this stub followed by the real kernel, packed as one LZ4 block (see tools/lz4pack.c)
+; The bootloader loads it to image_offset and calls it in protected mode, it unpacks the kernel to kernel_offset and jumps there
+; The kernel has to end below image_offset, which the memory map needs anyway (the FATs are loaded there)
+image_offset equ 0x20000
+kernel_offset equ 0x1000
+boot_stamps equ 0x0500		; the bootloader's TSC timestamps, the time the kernel is unpacked goes in the fourth one
+
+[bits 32]
+[org image_offset]
+
+unlz4:
+	cld
+	mov esi, packed
+	mov edi, kernel_offset
+
+next_sequence:
+	; token: literal length in the high 4 bits, match length - 4 in the low 4 bits
+	xor eax, eax
+	lodsb
+	mov edx, eax
+	shr eax, 4
+	call read_length
+	mov ecx, eax
+	rep movsb			; copy the literals
+
+	cmp esi, packed_end
+	jae unpacked		; the last sequence has literals only
+
+	xor eax, eax
+	lodsw
+	mov ebx, eax		; ebx = offset back into what has been unpacked
+
+	mov eax, edx
+	and eax, 15
+	call read_length
+	lea ecx, [eax + 4]
+
+	push esi
+	mov esi, edi
+	sub esi, ebx
+	rep movsb			; byte by byte, a match may overlap the bytes it is producing
+	pop esi
+	jmp next_sequence
+
+unpacked:
+	rdtsc
+	mov [boot_stamps + 24], eax
+	mov [boot_stamps + 28], edx
+	jmp kernel_offset
+
+; A length of 15 continues in the following bytes, each one is added until one is not 255
+read_length:
+	cmp eax, 15
+	jne read_length_done
+read_length_byte:
+	movzx ecx, byte [esi]
+	inc esi
+	add eax, ecx
+	cmp ecx, 255
+	je read_length_byte
+read_length_done:
+	ret
+
+packed:
+	incbin KERNEL_LZ4
+packed_end:
@@ -0,0 +1,44 @@
+#include "./types.h"
+
+// Requires blkdev.h to be included first
+
+// The primary ATA channel (ata0 in bochsrc.bxrc)
+#define ATA_PRIMARY_IO 0x1F0
+#define ATA_PRIMARY_CONTROL 0x3F6
+#define ATA_PRIMARY_IRQ 14
+
+// The most sectors moved per interrupt with READ MULTIPLE/WRITE MULTIPLE
+// 16 sectors (8 KB) cuts the interrupts 16 times and is supported by almost every drive (and by Bochs and QEMU)
+#define ATA_MAX_MULTIPLE 16
+
+// A drive on an ATA channel
+typedef struct
+{
+    uint16 io;
+    uint16 control;
+
+    // 0 for the master, 1 for the slave
+    uint8 slave;
+
+    // Sectors per data block (interrupt), 1 if READ/WRITE MULTIPLE is not used
+    uint16 multiple;
+
+    // Set if transfers use bus-master DMA (see ata_dma_init())
+    char dma;
+
+} ata_drive_t;
+
+// Bus-master DMA (PIIX IDE)
+// The PRD table has room for ATA_PRD_ENTRIES pieces of memory per command
+#define ATA_PRD_ENTRIES 64
+
+// A Physical Region Descriptor: one piece of memory a DMA command reads or writes
+typedef struct
+{
+    uint32 address;
+    uint16 byteCount; // 0 means 64 KB
+    uint16 flags;     // bit 15 marks the last entry of the table
+
+} __attribute__((packed)) ata_prd_t;
+
+int ata_init();
\ No newline at end of file
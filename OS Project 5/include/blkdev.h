@@ -0,0 +1,107 @@
+#include "./types.h"
+
+// Everything above the drivers (the FAT layer, the page cache) reads and writes disks through a block_device_t
+// A driver fills one in, registers it, and the device can then be looked up by name ("fd0", ...)
+
+#define BLOCK_SIZE 512
+#define MAX_BLOCK_DEVICES 8
+
+typedef struct block_device block_device_t;
+typedef struct block_request block_request_t;
+
+// What a device can handle in a single transfer
+typedef struct
+{
+    // The most sectors the driver's read()/write() can move at once
+    uint32 maxSectors;
+
+    // Transfers never cross a multiple of this many sectors (a cylinder on a floppy), 0 if there is no such boundary
+    uint32 boundarySectors;
+
+    // How many requests blk_submit() queues up before the device is made to start on them
+    uint32 queueDepth;
+
+    // Set if submit() only starts the requests and an interrupt finishes them, 0 if submit() does the transfers before it returns
+    char background;
+
+} queue_limits_t;
+
+// An asynchronous transfer, see blk_submit()
+struct block_request
+{
+    block_device_t *device;
+    uint32 lba;
+    uint32 count;
+    uint8 *buffer;
+    char write;
+
+    // Set when the request has finished, status is 0 on success or negative on an error
+    volatile char done;
+    int status;
+
+    // Called (maybe from an interrupt) when the request finishes, can be 0
+    void (*complete)(block_request_t *request);
+    void *context;
+
+    block_request_t *next;
+};
+
+struct block_device
+{
+    char name[8];
+
+    // The size of the device in sectors
+    uint32 sectors;
+
+    queue_limits_t limits;
+
+    // Synchronous transfers of at most limits.maxSectors sectors that never cross limits.boundarySectors
+    // Any buffer may be passed in, the driver takes care of DMA restrictions
+    int (*read)(block_device_t *device, uint32 lba, uint8 *buffer, uint32 count);
+    int (*write)(block_device_t *device, uint32 lba, uint8 *buffer, uint32 count);
+
+    // Takes a list of queued requests (sorted by lba) and starts them, calling blk_complete() for each one as it finishes
+    // Can be 0, then the requests are run one after another using read()/write()
+    void (*submit)(block_device_t *device, block_request_t *requests);
+
+    // Makes sure everything written so far is on the disk, can be 0 if writes are never cached
+    int (*flush)(block_device_t *device);
+
+    // Starts moving towards "lba" without transferring anything (a floppy seeks there), can be 0
+    // Only a hint, a request for "lba" has to work whether this was called or not
+    void (*prepare)(block_device_t *device, uint32 lba);
+
+    // Driver data
+    void *private;
+
+    // Requests that were submitted but not handed to the driver yet
+    block_request_t *queue;
+    uint32 queueLength;
+
+    // Whoever has the whole device to itself (the mounted file system, the RAM disk copying it, a volume), 0 if nobody
+    // Only checked before a device is taken over or erased, reads and writes work either way
+    char *holder;
+};
+
+int blk_register(block_device_t *device);
+block_device_t *blk_get(char *name);
+block_device_t *blk_get_index(int index);
+int blk_index(block_device_t *device);
+int blk_read(block_device_t *device, uint32 lba, void *buffer, uint32 count);
+int blk_write(block_device_t *device, uint32 lba, void *buffer, uint32 count);
+int blk_submit(block_device_t *device, block_request_t *request);
+void blk_unplug(block_device_t *device);
+void blk_complete(block_request_t *request, int status);
+int blk_wait(block_request_t *request);
+int blk_flush(block_device_t *device);
+void blk_prepare(block_device_t *device, uint32 lba);
+int blk_claim(block_device_t *device, char *holder);
+void blk_release(block_device_t *device);
+
+// blk_read()/blk_write() without the trace (see blktrace.c), for a driver running its own queued requests one by one
+int blk_transfer(block_device_t *device, uint32 lba, uint8 *buffer, uint32 count, char write);
+
+// Scratch buffers for moving whole runs of sectors around (see copyFile()), at least a cylinder of a floppy big
+#define BLOCK_BUFFER_SIZE (36 * BLOCK_SIZE)
+uint8 *blk_buffer_alloc();
+void blk_buffer_free(uint8 *buffer);
\ No newline at end of file
@@ -0,0 +1,35 @@
+#include "./types.h"
+
+// Requires blkdev.h to be included first
+
+// A ring of the last BLK_TRACE_ENTRIES block requests, dumped over COM1 and replayed on the host by tools/blkreplay.c (see blktrace.c)
+
+#define BLK_TRACE_ENTRIES 1024
+
+// What a trace entry was
+#define BLK_TRACE_WRITE 0x01
+#define BLK_TRACE_ASYNC 0x02    // queued with blk_submit(), everything else is a blk_read()/blk_write()
+#define BLK_TRACE_FLUSH 0x04    // blk_flush(), lba and count are 0
+#define BLK_TRACE_ERROR 0x08    // a blk_read()/blk_write() that failed
+
+typedef struct
+{
+    // Microseconds since blk_trace_start() when the request was made, and how long a blk_read()/blk_write() took (0 for the rest)
+    uint32 time;
+    uint32 duration;
+
+    uint32 lba;
+    uint16 count;
+    uint8 device;       // the device's index in the registry
+    uint8 flags;
+
+    // The return address into whoever called blk_read()/blk_write()/blk_submit()/blk_flush()
+    uint32 caller;
+
+} blk_trace_entry_t;
+
+void blk_trace_start();
+void blk_trace_stop();
+blk_trace_entry_t *blk_trace_record(block_device_t *device, uint32 lba, uint32 count, uint8 flags, void *caller);
+void blk_trace_done(blk_trace_entry_t *entry, int error);
+void blk_trace_dump();
\ No newline at end of file
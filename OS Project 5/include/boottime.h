@@ -0,0 +1,26 @@
+#include "./types.h"
+
+// Timestamps of the boot milestones, and the report of how long each phase took (see boottime.c)
+
+// In the order they happen, the first four are taken before the kernel runs
+typedef enum
+{
+    BOOT_ENTRY,         // the bootloader starts
+    BOOT_LOADED,        // kernel.bin is in memory
+    BOOT_PMODE,         // the switch to protected mode is done
+    BOOT_UNPACKED,      // the kernel is unpacked (unlz4.asm)
+    BOOT_MAIN,          // main() starts
+    BOOT_IDT,           // idt_install() is done
+    BOOT_ISRS,          // isrs_install() is done
+    BOOT_IRQ,           // irq_install() is done
+    BOOT_DISKS,         // the disk drivers are registered
+    BOOT_RAMDISK,       // ramdisk_init() has loaded the floppy into memory
+    BOOT_USER,          // the first user process starts
+    BOOT_FS,            // init_fs() is done
+    BOOT_MILESTONES
+
+} boot_milestone_t;
+
+void boot_init();
+void boot_stamp(boot_milestone_t milestone);
+void boot_report();
\ No newline at end of file
@@ -1,5 +1,12 @@
 #include "./types.h"
 
+// One cylinder (18 sectors on each of the 2 heads) of a 1.44 MB floppy
+#define DMA_BUFFER_SIZE 0x4800
+
+int dma_is_safe(uint32 address, uint32 count);
+uint8 *dma_buffer_alloc();
+void dma_buffer_free(uint8 *buffer);
+
 void maskChannel(uint8 channel, int masked);
 void initFloppyDMA(uint32 address, uint16 count);
 void prepare_for_floppyDMA_read();
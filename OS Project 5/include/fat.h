@@ -1,5 +1,11 @@
 #include "./types.h"
 
+// The block device (see blkdev.h) the file system is mounted from
+// Any registered disk with the same layout works, like "hd0" for the first ATA disk
+// The floppy itself is used if the RAM disk could not be made
+#define FS_DEVICE "ram0"
+#define FS_FALLBACK_DEVICE "fd0"
+
 typedef struct
 {
     // FAT12 Bios Parameter Block
@@ -54,10 +60,23 @@ typedef struct
 
 } __attribute__((packed)) directory_entry_t;
 
+// The root directory is 14 sectors starting at sector 19, which is room for 224 entries
+#define ROOT_DIRECTORY_SECTORS 14
+#define DIRECTORY_ENTRY_COUNT (ROOT_DIRECTORY_SECTORS * 512 / sizeof(directory_entry_t))
+
 typedef struct
 {
     uint32 index;
-    uint8 *startingAddress;
+
+    // The page cache page holding the byte at "index" (0 if none is pinned yet)
+    uint8 *page;
+    uint32 pageIndex;
+    char pageIsDirty;
+
+    // Read-ahead state (see readAhead())
+    uint32 lastPageIndex;   // The page the previous read moved to
+    uint32 aheadWindow;     // How many pages are kept requested ahead of the reader
+    uint32 aheadNext;       // The first page that has not been requested yet
 
     // Set to 0 if not opened
     // Set to non-zero if opened
@@ -79,9 +98,35 @@ typedef struct
     // The directory entry for the directory, containing all its metadata
     directory_entry_t *directoryEntry;
 
+    // Bloom filter of the names in this directory (256 bits)
+    // If a name's bits are not all set, the name is definitely not in the directory
+    uint32 bloom[8];
+
 } __attribute__((packed)) directory_t;
 
+typedef struct
+{
+    // Data clusters the FAT can describe, and how many of them are free
+    uint32 totalClusters;
+    uint32 freeClusters;
+
+    // Directory entries in the current directory, and how many of them hold a file
+    uint32 totalEntries;
+    uint32 usedEntries;
+
+    // Links in the FAT that jump to anything but the next cluster (0 means every file is contiguous)
+    uint32 fragments;
+
+} statfs_t;
+
 void init_fs();
+int mountFs(char *name);
+int formatFs(char *name);
+int statfs(statfs_t *stats);
+void setCluster(uint16 cluster, uint16 value);
+void bloomAdd(directory_t *directory, char *filename, char *ext);
+char bloomMayContain(directory_t *directory, char *filename, char *ext);
+void bloomRebuild(directory_t *directory);
 int openDirectory(directory_t *directory);
 int openFile(char *filename, char* ext);
 int closeFile();
@@ -94,4 +139,20 @@ uint8 readNextByte();
 int writeByte(uint8 byte, uint32 index);
 int writeBytes(uint8 byte, uint32 count);
 int writeNextByte(uint8 byte);
-int findFile(char *filename, char* ext, directory_t directory, directory_entry_t *foundEntry);
\ No newline at end of file
+int findFile(char *filename, char* ext, directory_t directory, directory_entry_t *foundEntry);
+void padName(char *name, int length);
+directory_entry_t *findEntry(char *filename, char *ext);
+uint32 runLength(uint16 cluster, uint32 maxLength);
+uint16 skipClusters(uint16 cluster, uint32 steps);
+uint16 allocateChain(uint32 count);
+uint32 extendChain(directory_entry_t *directoryEntry, uint32 clusterCount);
+void freeChain(uint16 cluster);
+int copyFile(char *srcFilename, char *srcExt, char *dstFilename, char *dstExt);
+int readFilePage(directory_entry_t *directoryEntry, uint32 pageIndex, uint8 *frame);
+int writeFilePage(directory_entry_t *directoryEntry, uint32 pageIndex, uint8 *frame);
+int prefetchFile();
+void *mapFile(uint32 *length);
+void readAhead(uint32 pageIndex);
+void waitFilePage(directory_entry_t *directoryEntry, uint32 pageIndex);
+void drainReadAhead();
+int syncFs();
\ No newline at end of file
@@ -3,4 +3,48 @@
 void floppy_detect_drives();
 int floppy_init();
 int floppy_read(int drive, uint32 lba, void* address, uint16 count);
-int floppy_write(int drive, uint32 lba, void* address, uint16 count);
\ No newline at end of file
+int floppy_write(int drive, uint32 lba, void* address, uint16 count);
+int floppy_register();
+
+// Per drive operation counters, and the timings the drive is currently run with (see "Drive timings" in fdc.c)
+typedef struct
+{
+    uint32 seeks;
+    uint32 seekErrors;
+    uint32 reads;
+    uint32 readErrors;
+    uint32 writes;
+    uint32 writeErrors;
+
+    // VERIFY commands after writes, and how many of them found a bad sector (see floppy_set_verify())
+    uint32 verifies;
+    uint32 verifyErrors;
+
+    // 0 is the fastest level, the times are in milliseconds
+    uint32 level;
+    uint32 stepRate;
+    uint32 headLoad;
+    uint32 headUnload;
+
+} floppy_stats_t;
+
+int floppy_get_stats(int drive, floppy_stats_t *stats);
+
+// Verified writes, every write is checked on the disk with a VERIFY and bad sectors are written again (see fdc.c)
+void floppy_set_verify(int drive, int on);
+int floppy_get_verify(int drive);
+
+// Formatting (see fdc.c), the skews are in sectors
+// A head switch costs nothing on a 1.44 MB drive, a step to the next cylinder and the settle after it about two sectors
+#define FLOPPY_HEAD_SKEW 0
+#define FLOPPY_CYLINDER_SKEW 2
+int floppy_format(int drive, int firstCyl, int cylinders, int interleave, int headSkew, int cylinderSkew);
+int floppy_benchmark_skew(int drive, int firstCyl, int cylinders, int headSkew, int cylinderSkew);
+int floppy_drive_present(int drive);
+
+// Streaming reads of whole tracks, or half tracks on a 2.88 MB disk (see fdc.c)
+#define STREAM_TRACK_SIZE (18 * 512)
+int floppy_stream_start(int drive, uint32 track, uint32 count);
+uint8 *floppy_stream_next();
+void floppy_stream_release();
+void floppy_stream_stop();
\ No newline at end of file
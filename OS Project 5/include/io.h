@@ -11,6 +11,10 @@ void outb(uint16 port, uint8 value);
 void outw(uint16 port, uint16 value);
 uint8  inb(uint16 port);
 uint16 inw(uint16 port);
+void outl(uint16 port, uint32 value);
+uint32 inl(uint16 port);
+void insw(uint16 port, void *buffer, uint32 count);
+void outsw(uint16 port, void *buffer, uint32 count);
 
 void initkeymap();
 char getchar();
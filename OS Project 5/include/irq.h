@@ -21,4 +21,9 @@ void irq_remap(void);
 void irq_install();
 extern  void _irq_handler(regs *r);
 
-void irq_wait(int n);
\ No newline at end of file
+void irq_wait(int n);
+int irq_wait_timeout(int n, uint32 ms);
+void irq_clear(int n);
+uint32 irq_save();
+void irq_restore(uint32 eflags);
+void irq_enable();
\ No newline at end of file
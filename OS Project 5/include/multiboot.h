@@ -0,0 +1,57 @@
+#include "./types.h"
+
+// What a Multiboot loader tells the kernel about the machine (see multiboot.c)
+// https://www.gnu.org/software/grub/manual/multiboot/multiboot.html#Boot-information-format
+
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+#define MULTIBOOT_INFO_MEMORY 0x001
+#define MULTIBOOT_INFO_MEM_MAP 0x040
+
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+typedef struct
+{
+    uint32 flags;
+
+    // KB of memory below 1 MB and from 1 MB up to the first hole
+    uint32 memLower;
+    uint32 memUpper;
+
+    uint32 bootDevice;
+    uint32 cmdline;
+    uint32 modsCount;
+    uint32 modsAddr;
+    uint32 syms[4];
+
+    // The BIOS memory map, a list of multiboot_mmap_entry_t
+    uint32 mmapLength;
+    uint32 mmapAddr;
+
+} __attribute__((packed)) multiboot_info_t;
+
+typedef struct
+{
+    // The size of the rest of the entry, entries can be longer than this struct
+    uint32 size;
+    uint64 base;
+    uint64 length;
+    uint32 type;
+
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+// A region of the memory map, copied out of the loader's memory
+typedef struct
+{
+    uint64 base;
+    uint64 length;
+    uint32 type;
+
+} memory_region_t;
+
+#define MAX_MEMORY_REGIONS 16
+
+int multiboot_init();
+int multiboot_booted();
+int multiboot_memory_map(memory_region_t **regions);
+uint32 multiboot_memory_kb();
\ No newline at end of file
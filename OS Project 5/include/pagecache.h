@@ -0,0 +1,15 @@
+#include "./types.h"
+
+// Requires fat.h to be included first (for directory_entry_t)
+
+void pagecache_init();
+uint8 *pagecache_get(directory_entry_t *directoryEntry, uint32 pageIndex);
+uint8 *pagecache_install(directory_entry_t *directoryEntry, uint32 pageIndex);
+void pagecache_pin(directory_entry_t *directoryEntry, uint32 pageIndex);
+void pagecache_unpin(directory_entry_t *directoryEntry, uint32 pageIndex);
+void pagecache_mark_dirty(directory_entry_t *directoryEntry, uint32 pageIndex);
+void pagecache_mark_loading(directory_entry_t *directoryEntry, uint32 pageIndex, char isLoading);
+void pagecache_flush(directory_entry_t *directoryEntry);
+void pagecache_invalidate(directory_entry_t *directoryEntry);
+void pagecache_discard(directory_entry_t *directoryEntry, uint32 pageIndex);
+int pagecache_sync();
@@ -0,0 +1,39 @@
+#include "./types.h"
+
+// Requires fat.h to be included first (for file_t and directory_entry_t)
+
+#define PAGE_SIZE 4096
+
+// The maximum number of files that can be mapped at once
+// Each mapping gets its own 4 MB window of virtual memory starting at MAPPING_BASE
+#define MAX_MAPPINGS 4
+#define MAPPING_BASE 0x40000000
+#define MAPPING_WINDOW 0x400000
+
+// A file (or part of a file) mapped into virtual memory
+typedef struct
+{
+    // The directory entry of the mapped file
+    directory_entry_t *directoryEntry;
+
+    // Where in the file the mapping starts (page aligned) and how many bytes it covers
+    uint32 offset;
+    uint32 length;
+
+    // The first virtual address of the mapping
+    uint8 *address;
+
+    // Set to 0 if this slot is free
+    // Set to non-zero if it is mapped
+    char isMapped;
+
+} mapping_t;
+
+struct regs;
+
+void paging_install();
+int page_fault_handler(struct regs *r);
+void *mmapFile(file_t *file, uint32 offset, uint32 length);
+int msync(void *address);
+int munmap(void *address);
+void munmapFile(directory_entry_t *directoryEntry);
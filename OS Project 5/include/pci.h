@@ -0,0 +1,43 @@
+#include "./types.h"
+
+#define PCI_MAX_DEVICES 32
+
+// Offsets into a device's configuration space
+#define PCI_VENDOR_ID 0x00
+#define PCI_DEVICE_ID 0x02
+#define PCI_COMMAND 0x04
+#define PCI_BAR0 0x10
+#define PCI_INTERRUPT_LINE 0x3C
+
+// Bits of the command register
+#define PCI_COMMAND_IO 0x01
+#define PCI_COMMAND_MEMORY 0x02
+#define PCI_COMMAND_BUS_MASTER 0x04
+
+// A function found on the PCI bus
+typedef struct
+{
+    uint8 bus;
+    uint8 slot;
+    uint8 function;
+
+    uint16 vendorId;
+    uint16 deviceId;
+    uint8 classCode;
+    uint8 subclass;
+    uint8 progIf;
+
+    // The base address registers as read (bit 0 set means an I/O port range)
+    uint32 bar[6];
+    uint8 irq;
+
+} pci_device_t;
+
+uint32 pci_read32(pci_device_t *device, uint8 offset);
+uint16 pci_read16(pci_device_t *device, uint8 offset);
+void pci_write32(pci_device_t *device, uint8 offset, uint32 value);
+void pci_write16(pci_device_t *device, uint8 offset, uint16 value);
+int pci_init();
+pci_device_t *pci_find_class(uint8 classCode, uint8 subclass);
+pci_device_t *pci_find_device(uint16 vendorId, uint16 deviceId);
+void pci_enable(pci_device_t *device, uint16 bits);
\ No newline at end of file
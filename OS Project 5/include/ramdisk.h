@@ -0,0 +1,13 @@
+#include "./types.h"
+
+// Requires blkdev.h to be included first
+
+// The RAM disk's copy of the disk lives at 0x400000 - 0x6FFFFF (right after the page cache frames)
+// which is enough for a 2.88 MB floppy
+#define RAMDISK_ADDRESS 0x400000
+#define RAMDISK_MAX_SECTORS 5760
+
+// Written sectors are tracked, and written back, in groups of one 1.44 MB floppy track
+#define RAMDISK_GROUP_SECTORS 18
+
+int ramdisk_init(char *backingName);
\ No newline at end of file
@@ -0,0 +1,9 @@
+#include "./types.h"
+
+// Output on the first serial port (COM1), for logs that have to leave the machine (see serial.c)
+
+void serial_init();
+void serial_putchar(char character);
+void serial_print(char *string);
+void serial_printint(uint32 n);
+void serial_printhex(uint32 n);
\ No newline at end of file
@@ -0,0 +1,17 @@
+#include "./types.h"
+
+// Real time delays and timeouts (see timer.c)
+
+// A point in time to wait for, as a TSC value
+typedef uint64 deadline_t;
+
+void timer_init();
+uint32 timer_ms();
+uint64 timer_cycles();
+uint32 timer_cycles_to_us(uint64 cycles);
+void udelay(uint32 us);
+void msleep(uint32 ms);
+deadline_t deadline_us(uint32 us);
+deadline_t deadline_ms(uint32 ms);
+int deadline_passed(deadline_t deadline);
+void timer_idle();
\ No newline at end of file
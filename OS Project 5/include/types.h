@@ -8,3 +8,6 @@ typedef unsigned    char        uint8;
 typedef unsigned    short       uint16;
 typedef unsigned    int         uint32;
 
+// 64 bit integers, only used for TSC values (adding, subtracting and comparing, never dividing)
+typedef unsigned    long long   uint64;
+
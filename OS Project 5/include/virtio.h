@@ -0,0 +1,60 @@
+#include "./types.h"
+
+// Requires blkdev.h to be included first
+
+// virtio-blk over legacy (transitional) PCI
+#define VIRTIO_VENDOR_ID 0x1AF4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+// The virtqueue lives at 0x700000 (right after the RAM disk), 64 KB is enough for a queue of 1024 entries
+// The per-request headers, status bytes and indirect tables follow it at 0x710000
+#define VIRTIO_QUEUE_ADDRESS 0x700000
+#define VIRTIO_SLOT_ADDRESS 0x710000
+
+// How many commands can be in flight, and how many data buffers (merged requests) one command can have
+#define VIRTIO_MAX_SLOTS 32
+#define VIRTIO_MAX_SEGMENTS 16
+
+// A descriptor: one piece of memory the device reads or writes
+typedef struct
+{
+    uint32 address;
+    uint32 addressHigh;
+    uint32 length;
+    uint16 flags;
+    uint16 next;
+
+} virtq_desc_t;
+
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2
+#define VIRTQ_DESC_F_INDIRECT 4
+
+// The ring the driver hands descriptor chains to the device in
+// ring[] has one entry per queue entry, and is followed by usedEvent
+typedef struct
+{
+    uint16 flags;
+    volatile uint16 index;
+    uint16 ring[];
+
+} virtq_avail_t;
+
+typedef struct
+{
+    uint32 id;
+    uint32 length;
+
+} virtq_used_elem_t;
+
+// The ring the device returns finished chains in
+// ring[] has one entry per queue entry, and is followed by availEvent
+typedef struct
+{
+    uint16 flags;
+    volatile uint16 index;
+    virtq_used_elem_t ring[];
+
+} virtq_used_t;
+
+int virtio_blk_init();
\ No newline at end of file
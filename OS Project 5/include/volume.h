@@ -0,0 +1,13 @@
+#include "./types.h"
+
+// Requires blkdev.h to be included first
+
+// A volume is a block device made out of two other block devices, its members (see volume.c)
+#define VOLUME_STRIPE 0     // chunks alternate between the members, the volume is as big as both together
+#define VOLUME_MIRROR 1     // both members hold everything, the volume is as big as the smaller one
+
+// Stripe chunks are one track of a 1.44 MB floppy
+#define VOLUME_CHUNK_SECTORS 18
+
+int volume_create(char *name, int mode, char *first, char *second);
+uint32 volume_map(uint32 lba, uint32 count, int *member, uint32 *memberLba);
\ No newline at end of file
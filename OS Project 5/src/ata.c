@@ -0,0 +1,660 @@
+#include "./types.h"
+#include "./io.h"
+#include "./irq.h"
+#include "./timer.h"
+#include "./blkdev.h"
+#include "./pci.h"
+#include "./ata.h"
+
+/*
+ * ATA/IDE hard disks in PIO mode (LBA28)
+ *
+ * Data moves with READ MULTIPLE/WRITE MULTIPLE, so the drive interrupts once per block of up to
+ * ATA_MAX_MULTIPLE sectors instead of once per sector, and each block is moved with a single
+ * rep insw/rep outsw. Drives that do not support them fall back to READ SECTORS/WRITE SECTORS.
+ *
+ * The drives on the primary channel are registered as "hd0" (master) and "hd1" (slave).
+ * When there is a PIIX IDE controller on the PCI bus, drives that support it use bus-master
+ * DMA instead (see below).
+ */
+
+enum AtaRegisters
+{
+    ATA_DATA            = 0,
+    ATA_ERROR           = 1, // read-only
+    ATA_FEATURES        = 1, // write-only
+    ATA_SECTOR_COUNT    = 2,
+    ATA_LBA_LOW         = 3,
+    ATA_LBA_MID         = 4,
+    ATA_LBA_HIGH        = 5,
+    ATA_DRIVE_HEAD      = 6,
+    ATA_STATUS          = 7, // read-only
+    ATA_COMMAND         = 7  // write-only
+};
+
+enum AtaCommands
+{
+    ATA_READ_SECTORS    = 0x20,
+    ATA_WRITE_SECTORS   = 0x30,
+    ATA_READ_MULTIPLE   = 0xC4,
+    ATA_WRITE_MULTIPLE  = 0xC5,
+    ATA_SET_MULTIPLE    = 0xC6,
+    ATA_READ_DMA        = 0xC8,
+    ATA_WRITE_DMA       = 0xCA,
+    ATA_CACHE_FLUSH     = 0xE7,
+    ATA_IDENTIFY        = 0xEC,
+    ATA_SET_FEATURES    = 0xEF
+};
+
+//
+// The status byte:
+// ----------------
+//
+//  7   6    5   4   3   2   1   0
+// BSY DRDY DF  SRV DRQ  -   -  ERR
+//
+#define ATA_STATUS_BSY 0x80
+#define ATA_STATUS_DF  0x20
+#define ATA_STATUS_DRQ 0x08
+#define ATA_STATUS_ERR 0x01
+
+// How many times a status is polled before giving up on the drive
+#define ATA_TIMEOUT 10000000
+
+// How long a DMA command may run before it is aborted, in milliseconds (a drive may have to spin up first)
+#define ATA_DMA_TIMEOUT 10000
+
+ata_drive_t ataDrives[2];
+block_device_t ataDevices[2];
+
+volatile int ataInterrupt = 0;
+volatile uint8 ataStatus;
+
+volatile int ataDmaActive = 0;
+void ata_dma_irq();
+
+void ata_irq(regs *r){
+    (void) r;
+
+    if(ataDmaActive){
+        ata_dma_irq();
+        return;
+    }
+
+    // reading the status acknowledges the interrupt
+    ataStatus = inb(ATA_PRIMARY_IO + ATA_STATUS);
+    ataInterrupt = 1;
+}
+
+// Reading the alternate status 4 times gives the drive the 400ns it needs after a drive select
+void ata_delay(ata_drive_t *drive){
+    for(int i = 0; i < 4; i++){
+        inb(drive->control);
+    }
+}
+
+// Waits until the drive is not busy, returns its status (or 0xFF if it never stopped being busy)
+uint8 ata_wait_ready(ata_drive_t *drive){
+    for(uint32 i = 0; i < ATA_TIMEOUT; i++){
+        uint8 status = inb(drive->control);
+        if(!(status & ATA_STATUS_BSY)){
+            return status;
+        }
+    }
+
+    return 0xFF;
+}
+
+// Waits for the drive to interrupt, returns the status it reported
+// If the interrupt never comes (interrupts are off, or it got lost) the status register is polled instead
+uint8 ata_wait_irq(ata_drive_t *drive){
+    for(uint32 i = 0; i < ATA_TIMEOUT && !ataInterrupt; i++){};
+
+    if(!ataInterrupt){
+        uint8 status = ata_wait_ready(drive);
+        inb(drive->io + ATA_STATUS);
+        return status;
+    }
+
+    ataInterrupt = 0;
+    return ataStatus;
+}
+
+void ata_select(ata_drive_t *drive, uint32 lba){
+    outb(drive->io + ATA_DRIVE_HEAD, 0xE0 | (drive->slave << 4) | ((lba >> 24) & 0x0F));
+    ata_delay(drive);
+}
+
+/*
+ * Reads or writes "count" (1 - 256) sectors starting at "lba"
+ */
+int ata_transfer(ata_drive_t *drive, uint32 lba, uint8 *buffer, uint32 count, int write){
+    int command;
+    if(drive->multiple > 1){
+        command = write ? ATA_WRITE_MULTIPLE : ATA_READ_MULTIPLE;
+    } else {
+        command = write ? ATA_WRITE_SECTORS : ATA_READ_SECTORS;
+    }
+
+    ata_select(drive, lba);
+    if(ata_wait_ready(drive) & ATA_STATUS_BSY){
+        printf("Error: The ATA drive is not responding!\n");
+        return -1;
+    }
+
+    outb(drive->io + ATA_SECTOR_COUNT, count & 0xFF); // 0 means 256
+    outb(drive->io + ATA_LBA_LOW, lba & 0xFF);
+    outb(drive->io + ATA_LBA_MID, (lba >> 8) & 0xFF);
+    outb(drive->io + ATA_LBA_HIGH, (lba >> 16) & 0xFF);
+
+    ataInterrupt = 0;
+    outb(drive->io + ATA_COMMAND, command);
+
+    // a write does not interrupt for its first block, the drive just asks for it
+    uint8 status = write ? ata_wait_ready(drive) : 0;
+
+    while(count > 0){
+        uint32 block = count < drive->multiple ? count : drive->multiple;
+
+        if(!write){
+            status = ata_wait_irq(drive);
+        }
+
+        if((status & (ATA_STATUS_ERR | ATA_STATUS_DF | ATA_STATUS_BSY)) || !(status & ATA_STATUS_DRQ)){
+            printf(write ? "Error writing the ATA drive!\n" : "Error reading the ATA drive!\n");
+            return -1;
+        }
+
+        if(write){
+            outsw(drive->io + ATA_DATA, buffer, block * 256);
+            status = ata_wait_irq(drive);
+        } else {
+            insw(drive->io + ATA_DATA, buffer, block * 256);
+        }
+
+        buffer += block * 512;
+        count -= block;
+    }
+
+    if(write && (status & (ATA_STATUS_ERR | ATA_STATUS_DF))){
+        printf("Error writing the ATA drive!\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Bus-master DMA
+ *
+ * The bus-master registers of the PIIX IDE function (BAR4) point the controller at a table of PRDs,
+ * and the controller moves the data to/from those pieces of memory by itself. Requests are
+ * transferred straight to/from their own buffers (page cache frames, the RAM disk, ...) so the
+ * CPU never touches the data. Queued requests that continue where the previous one ended on
+ * the disk are merged into one READ DMA/WRITE DMA with PRDs for each of their buffers, so a batch
+ * of pages spread all over memory still goes in a single command.
+ *
+ * A command is started when requests are submitted, and the IRQ14 handler finishes it and starts
+ * the next one, so the CPU is free while the disk works. Requests are completed from the interrupt.
+ * Whoever waits for the channel calls ata_dma_poll(), which finishes a command whose interrupt
+ * did not come (interrupts are off, or it got lost) and aborts one that runs past ATA_DMA_TIMEOUT.
+ */
+enum AtaBusMasterRegisters
+{
+    ATA_BM_COMMAND  = 0,
+    ATA_BM_STATUS   = 2,
+    ATA_BM_PRDT     = 4
+};
+
+// Only the first 16 MB are identity mapped (see paging.c), so buffers above that have no known physical address
+#define ATA_DMA_LIMIT 0x1000000
+
+uint16 ataBusMaster = 0;
+
+// 512 bytes, aligned so the table never crosses a 64 KB boundary
+ata_prd_t ataPrdTable[ATA_PRD_ENTRIES] __attribute__((aligned(512)));
+
+block_request_t *ataDmaPending = 0;     // requests waiting for the channel
+block_request_t *ataDmaCommand;         // the requests the running command transfers (up to ataDmaPending)
+deadline_t ataDmaDeadline;              // when the running command is given up on
+
+// Returns 1 if a transfer can be done with DMA
+int ata_dma_ok(uint8 *buffer, uint32 count){
+    uint32 address = (uint32) buffer;
+    return count > 0 && count <= 256 && !(address & 1) && address + (count * 512) <= ATA_DMA_LIMIT;
+}
+
+// Adds PRDs for a buffer to the table (a PRD can not cross a 64 KB boundary)
+// returns the new number of entries, or -1 if the buffer does not fit
+int ata_prd_add(int entries, uint8 *buffer, uint32 bytes){
+    uint32 address = (uint32) buffer;
+
+    while(bytes > 0){
+        if(entries == ATA_PRD_ENTRIES){
+            return -1;
+        }
+
+        uint32 chunk = 0x10000 - (address & 0xFFFF);
+        if(chunk > bytes){
+            chunk = bytes;
+        }
+
+        ataPrdTable[entries].address = address;
+        ataPrdTable[entries].byteCount = chunk & 0xFFFF;
+        ataPrdTable[entries].flags = 0;
+        entries++;
+
+        address += chunk;
+        bytes -= chunk;
+    }
+
+    return entries;
+}
+
+// Completes the requests of the command that just ended (or was given up on)
+void ata_dma_complete(int error){
+    block_request_t *request = ataDmaCommand;
+    block_request_t *end = ataDmaPending;
+    while(request != end){
+        block_request_t *next = request->next;
+        blk_complete(request, error);
+        request = next;
+    }
+}
+
+/*
+ * Starts a command for the requests at the head of the pending list
+ * requests for a drive that stays busy are failed, and the next ones are tried
+ * must be called with interrupts off (or from the interrupt handler)
+ */
+void ata_dma_start(){
+    block_request_t *first = ataDmaPending;
+    if(first == 0){
+        ataDmaActive = 0;
+        return;
+    }
+
+    ata_drive_t *drive = (ata_drive_t *) first->device->private;
+    block_request_t *request = first;
+    uint32 count = 0;
+    int entries = 0;
+
+    // take every request that continues where the previous one ended
+    while(request && request->device == first->device && request->write == first->write
+          && request->lba == first->lba + count && count + request->count <= 256){
+        int added = ata_prd_add(entries, request->buffer, request->count * 512);
+        if(added < 0){
+            break;
+        }
+
+        entries = added;
+        count += request->count;
+        request = request->next;
+    }
+
+    ataPrdTable[entries - 1].flags = 0x8000;
+    ataDmaCommand = first;
+    ataDmaPending = request;
+    ataDmaActive = 1;
+
+    ata_select(drive, first->lba);
+    if(ata_wait_ready(drive) & ATA_STATUS_BSY){
+        printf("Error: The ATA drive is not responding!\n");
+        ata_dma_complete(-1);
+        ata_dma_start();
+        return;
+    }
+
+    uint16 bm = ataBusMaster;
+    outb(bm + ATA_BM_COMMAND, 0);
+    outl(bm + ATA_BM_PRDT, (uint32) ataPrdTable);
+    outb(bm + ATA_BM_STATUS, inb(bm + ATA_BM_STATUS) | 0x06); // clear the interrupt and error bits
+    outb(bm + ATA_BM_COMMAND, first->write ? 0x00 : 0x08);    // bit 3 set: the controller writes to memory
+
+    outb(drive->io + ATA_SECTOR_COUNT, count & 0xFF);
+    outb(drive->io + ATA_LBA_LOW, first->lba & 0xFF);
+    outb(drive->io + ATA_LBA_MID, (first->lba >> 8) & 0xFF);
+    outb(drive->io + ATA_LBA_HIGH, (first->lba >> 16) & 0xFF);
+    outb(drive->io + ATA_COMMAND, first->write ? ATA_WRITE_DMA : ATA_READ_DMA);
+
+    ataDmaDeadline = deadline_ms(ATA_DMA_TIMEOUT);
+    outb(bm + ATA_BM_COMMAND, inb(bm + ATA_BM_COMMAND) | 0x01); // go
+}
+
+// Called from IRQ14 when the running command is done
+void ata_dma_finish(){
+    uint16 bm = ataBusMaster;
+    uint8 bmStatus = inb(bm + ATA_BM_STATUS);
+    outb(bm + ATA_BM_COMMAND, 0);
+    uint8 status = inb(ATA_PRIMARY_IO + ATA_STATUS);
+    outb(bm + ATA_BM_STATUS, 0x06);
+
+    int error = 0;
+    if((bmStatus & 0x02) || (status & (ATA_STATUS_ERR | ATA_STATUS_DF))){
+        printf("Error: ATA DMA transfer failed!\n");
+        error = -1;
+    }
+
+    ata_dma_complete(error);
+    ata_dma_start();
+}
+
+// IRQ14 while a DMA command runs
+void ata_dma_irq(){
+    // only the end of the running command counts, not an interrupt left over from one ata_dma_poll() finished
+    if(inb(ataBusMaster + ATA_BM_STATUS) & 0x04){
+        ata_dma_finish();
+    } else {
+        inb(ATA_PRIMARY_IO + ATA_STATUS);
+    }
+}
+
+// Stops the running command and fails its requests
+// The drive is still in the middle of the command, so the channel gets a software reset (SRST) to stop it
+void ata_dma_abort(){
+    ata_drive_t *drive = (ata_drive_t *) ataDmaCommand->device->private;
+
+    outb(ataBusMaster + ATA_BM_COMMAND, 0);
+    outb(ataBusMaster + ATA_BM_STATUS, 0x06);
+
+    outb(drive->control, 0x04);
+    ata_delay(drive);
+    outb(drive->control, 0x00);
+    ata_wait_ready(drive);
+
+    ata_dma_complete(-1);
+    ata_dma_start();
+}
+
+// Makes progress on the channel without relying on IRQ14: finishes the running command if the
+// controller is done with it, or aborts it once it is past its deadline
+// Called in a loop by everything that waits for the channel, so a wait always ends
+void ata_dma_poll(){
+    uint32 eflags = irq_save();
+
+    if(ataDmaActive){
+        if(inb(ataBusMaster + ATA_BM_STATUS) & 0x04){
+            ata_dma_finish();
+        } else if(deadline_passed(ataDmaDeadline)){
+            printf("Error: ATA DMA transfer timed out!\n");
+            ata_dma_abort();
+        }
+    }
+
+    irq_restore(eflags);
+}
+
+// Adds a list of requests to the end of the pending list, and starts the channel if it is idle
+void ata_dma_queue(block_request_t *requests){
+    uint32 eflags = irq_save();
+
+    block_request_t **link = &ataDmaPending;
+    while(*link){
+        link = &(*link)->next;
+    }
+    *link = requests;
+
+    if(!ataDmaActive){
+        ata_dma_start();
+    }
+
+    irq_restore(eflags);
+}
+
+void ata_blk_submit(block_device_t *device, block_request_t *requests){
+    block_request_t *dmaRequests = 0;
+    block_request_t **tail = &dmaRequests;
+
+    while(requests){
+        block_request_t *next = requests->next;
+
+        if(ata_dma_ok(requests->buffer, requests->count)){
+            *tail = requests;
+            tail = &requests->next;
+        } else {
+            blk_complete(requests, blk_transfer(device, requests->lba, requests->buffer, requests->count, requests->write));
+        }
+
+        requests = next;
+    }
+
+    *tail = 0;
+    if(dmaRequests){
+        ata_dma_queue(dmaRequests);
+    }
+}
+
+// Moves one transfer with DMA and waits for it
+int ata_dma_run(block_device_t *device, uint32 lba, uint8 *buffer, uint32 count, int write){
+    block_request_t request;
+    request.device = device;
+    request.lba = lba;
+    request.count = count;
+    request.buffer = buffer;
+    request.write = write;
+    request.done = 0;
+    request.complete = 0;
+    request.next = 0;
+
+    ata_dma_queue(&request);
+    while(!request.done){
+        ata_dma_poll();
+    }
+
+    return request.status;
+}
+
+int ata_blk_read(block_device_t *device, uint32 lba, uint8 *buffer, uint32 count){
+    ata_drive_t *drive = (ata_drive_t *) device->private;
+
+    if(drive->dma && ata_dma_ok(buffer, count)){
+        return ata_dma_run(device, lba, buffer, count, 0);
+    }
+
+    while(ataDmaActive){
+        ata_dma_poll();
+    }
+    return ata_transfer(drive, lba, buffer, count, 0);
+}
+
+int ata_blk_write(block_device_t *device, uint32 lba, uint8 *buffer, uint32 count){
+    ata_drive_t *drive = (ata_drive_t *) device->private;
+
+    if(drive->dma && ata_dma_ok(buffer, count)){
+        return ata_dma_run(device, lba, buffer, count, 1);
+    }
+
+    while(ataDmaActive){
+        ata_dma_poll();
+    }
+    return ata_transfer(drive, lba, buffer, count, 1);
+}
+
+// Makes the drive write out its write cache
+int ata_blk_flush(block_device_t *device){
+    ata_drive_t *drive = (ata_drive_t *) device->private;
+
+    while(ataDmaActive){
+        ata_dma_poll();
+    }
+
+    ata_select(drive, 0);
+    ataInterrupt = 0;
+    outb(drive->io + ATA_COMMAND, ATA_CACHE_FLUSH);
+
+    if(ata_wait_irq(drive) & (ATA_STATUS_ERR | ATA_STATUS_DF)){
+        printf("Error flushing the ATA drive!\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Sends IDENTIFY DEVICE and reads the 256 words it returns
+ * returns 0 if there is an ATA drive (not ATAPI) there
+ */
+int ata_identify(ata_drive_t *drive, uint16 *data){
+    ata_select(drive, 0);
+    outb(drive->io + ATA_SECTOR_COUNT, 0);
+    outb(drive->io + ATA_LBA_LOW, 0);
+    outb(drive->io + ATA_LBA_MID, 0);
+    outb(drive->io + ATA_LBA_HIGH, 0);
+
+    ataInterrupt = 0;
+    outb(drive->io + ATA_COMMAND, ATA_IDENTIFY);
+
+    // no drive
+    if(inb(drive->io + ATA_STATUS) == 0){
+        return -1;
+    }
+
+    uint8 status = ata_wait_ready(drive);
+
+    // ATAPI and SATA drives put a signature here instead of answering
+    if(inb(drive->io + ATA_LBA_MID) != 0 || inb(drive->io + ATA_LBA_HIGH) != 0){
+        return -1;
+    }
+
+    for(uint32 i = 0; i < ATA_TIMEOUT && !(status & (ATA_STATUS_DRQ | ATA_STATUS_ERR)); i++){
+        status = inb(drive->control);
+    }
+
+    if(status & ATA_STATUS_ERR || !(status & ATA_STATUS_DRQ)){
+        return -1;
+    }
+
+    insw(drive->io + ATA_DATA, data, 256);
+    ataInterrupt = 0;
+    return 0;
+}
+
+// Turns on READ/WRITE MULTIPLE with the biggest block (a power of 2, at most ATA_MAX_MULTIPLE) the drive supports
+void ata_set_multiple(ata_drive_t *drive, uint16 *identify){
+    uint16 supported = identify[47] & 0xFF;
+    uint16 multiple = ATA_MAX_MULTIPLE;
+
+    while(multiple > supported){
+        multiple /= 2;
+    }
+
+    drive->multiple = 1;
+    if(multiple < 2){
+        return;
+    }
+
+    ata_select(drive, 0);
+    outb(drive->io + ATA_SECTOR_COUNT, multiple);
+    ataInterrupt = 0;
+    outb(drive->io + ATA_COMMAND, ATA_SET_MULTIPLE);
+
+    if(!(ata_wait_irq(drive) & ATA_STATUS_ERR)){
+        drive->multiple = multiple;
+    }
+}
+
+/*
+ * Looks for the PIIX IDE controller and switches the drives that support it to bus-master DMA
+ * (using the fastest multiword DMA mode they have)
+ */
+void ata_dma_init(uint16 identify[2][256]){
+    pci_device_t *ide = pci_find_class(0x01, 0x01);
+
+    // prog-if bit 7: the controller can bus-master, BAR4 must be an I/O range
+    if(ide == 0 || !(ide->progIf & 0x80) || !(ide->bar[4] & 1)){
+        return;
+    }
+
+    ataBusMaster = ide->bar[4] & 0xFFFC;
+    pci_enable(ide, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    for(int i = 0; i < 2; i++){
+        ata_drive_t *drive = &ataDrives[i];
+
+        // word 49 bit 8: DMA is supported, word 63: the multiword DMA modes
+        if(ataDevices[i].read == 0 || !(identify[i][49] & 0x100) || !(identify[i][63] & 0x07)){
+            continue;
+        }
+
+        uint8 mode = (identify[i][63] & 0x04) ? 2 : (identify[i][63] & 0x02) ? 1 : 0;
+
+        ata_select(drive, 0);
+        outb(drive->io + ATA_FEATURES, 0x03);              // set transfer mode
+        outb(drive->io + ATA_SECTOR_COUNT, 0x20 | mode);   // multiword DMA
+        ataInterrupt = 0;
+        outb(drive->io + ATA_COMMAND, ATA_SET_FEATURES);
+
+        if(ata_wait_irq(drive) & ATA_STATUS_ERR){
+            continue;
+        }
+
+        drive->dma = 1;
+        ataDevices[i].submit = ata_blk_submit;
+        ataDevices[i].limits.background = 1;
+    }
+}
+
+/*
+ * Finds the drives on the primary channel and registers them
+ * returns how many drives were found
+ */
+int ata_init(){
+    // nothing is connected to the channel (the bus floats high)
+    if(inb(ATA_PRIMARY_IO + ATA_STATUS) == 0xFF){
+        return 0;
+    }
+
+    irq_install_handler(ATA_PRIMARY_IRQ, ata_irq);
+    outb(ATA_PRIMARY_CONTROL, 0); // nIEN = 0, let the drives interrupt
+    irq_enable();
+
+    int found = 0;
+    uint16 identify[2][256];
+
+    for(int i = 0; i < 2; i++){
+        ata_drive_t *drive = &ataDrives[i];
+        drive->io = ATA_PRIMARY_IO;
+        drive->control = ATA_PRIMARY_CONTROL;
+        drive->slave = i;
+        drive->multiple = 1;
+        drive->dma = 0;
+
+        if(ata_identify(drive, identify[i]) != 0){
+            continue;
+        }
+
+        // word 49 bit 9: LBA is supported
+        if(!(identify[i][49] & 0x200)){
+            continue;
+        }
+
+        ata_set_multiple(drive, identify[i]);
+
+        block_device_t *device = &ataDevices[i];
+        device->name[0] = 'h';
+        device->name[1] = 'd';
+        device->name[2] = '0' + i;
+        device->name[3] = 0;
+
+        // words 60 and 61: sectors addressable with LBA28
+        device->sectors = identify[i][60] | ((uint32) identify[i][61] << 16);
+        device->limits.maxSectors = 256;
+        device->limits.boundarySectors = 0;
+        device->limits.queueDepth = 1;
+        device->read = ata_blk_read;
+        device->write = ata_blk_write;
+        device->submit = 0;
+        device->flush = ata_blk_flush;
+        device->private = drive;
+
+        if(blk_register(device) >= 0){
+            found++;
+        }
+    }
+
+    if(found){
+        ata_dma_init(identify);
+    }
+
+    return found;
+}
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include "./types.h"
+#include "./io.h"
+#include "./dma.h"
+#include "./blkdev.h"
+#include "./blktrace.h"
+
+// The block device layer sits between the file system and the disk drivers
+// blk_read()/blk_write() split a transfer into pieces the driver can take (see queue_limits_t)
+// blk_submit() queues requests without waiting for them, they are sorted by lba and handed to the driver
+// as one batch once the queue is full or someone waits on one of them, so a driver sees the whole batch at once
+// and can move it in as few disk operations as possible (the floppy streams whole tracks, see fdc.c)
+// Every request made here is recorded in the block trace (see blktrace.c)
+
+block_device_t *blockDevices[MAX_BLOCK_DEVICES];
+int blockDeviceCount = 0;
+
+// Adds a device to the registry and returns its index, or -1 if the registry is full
+int blk_register(block_device_t *device)
+{
+    if(blockDeviceCount == MAX_BLOCK_DEVICES)
+    {
+        printf("Error: Too many block devices!\n");
+        return -1;
+    }
+
+    if(device->limits.maxSectors == 0) device->limits.maxSectors = 1;
+    if(device->limits.queueDepth == 0) device->limits.queueDepth = 1;
+
+    device->queue = 0;
+    device->queueLength = 0;
+    device->holder = 0;
+
+    blockDevices[blockDeviceCount] = device;
+    return blockDeviceCount++;
+}
+
+// Looks a device up by name (like "fd0")
+// Returns 0 if there is no such device
+block_device_t *blk_get(char *name)
+{
+    for(int i = 0; i < blockDeviceCount; i++)
+    {
+        char *deviceName = blockDevices[i]->name;
+        int j = 0;
+
+        while(j < 8 && deviceName[j] == name[j] && name[j] != 0) j++;
+
+        if(j == 8 || deviceName[j] == name[j]) return blockDevices[i];
+    }
+
+    return 0;
+}
+
+// Returns the device registered as number "index", or 0 if there is none
+block_device_t *blk_get_index(int index)
+{
+    if(index < 0 || index >= blockDeviceCount) return 0;
+
+    return blockDevices[index];
+}
+
+// Returns the index a device was registered under, or -1 if it is not registered
+int blk_index(block_device_t *device)
+{
+    for(int i = 0; i < blockDeviceCount; i++)
+    {
+        if(blockDevices[i] == device) return i;
+    }
+
+    return -1;
+}
+
+// Moves "count" sectors starting at "lba", in pieces that fit the device's queue limits
+int blk_transfer(block_device_t *device, uint32 lba, uint8 *buffer, uint32 count, char write)
+{
+    if(lba + count > device->sectors || lba + count < lba)
+    {
+        printf("Error: Transfer past the end of the device!\n");
+        return -1;
+    }
+
+    while(count > 0)
+    {
+        uint32 chunk = count;
+        if(chunk > device->limits.maxSectors) chunk = device->limits.maxSectors;
+
+        uint32 boundary = device->limits.boundarySectors;
+        if(boundary != 0 && chunk > boundary - (lba % boundary)) chunk = boundary - (lba % boundary);
+
+        int error = write ? device->write(device, lba, buffer, chunk) : device->read(device, lba, buffer, chunk);
+        if(error) return error;
+
+        lba += chunk;
+        buffer += chunk * BLOCK_SIZE;
+        count -= chunk;
+    }
+
+    return 0;
+}
+
+// Reads "count" sectors starting at "lba" into "buffer"
+// Returns 0 on success
+int blk_read(block_device_t *device, uint32 lba, void *buffer, uint32 count)
+{
+    blk_trace_entry_t *trace = blk_trace_record(device, lba, count, 0, __builtin_return_address(0));
+    int error = blk_transfer(device, lba, (uint8 *)buffer, count, 0);
+    blk_trace_done(trace, error);
+
+    return error;
+}
+
+// Writes "count" sectors from "buffer" starting at "lba"
+// Returns 0 on success
+int blk_write(block_device_t *device, uint32 lba, void *buffer, uint32 count)
+{
+    blk_trace_entry_t *trace = blk_trace_record(device, lba, count, BLK_TRACE_WRITE, __builtin_return_address(0));
+    int error = blk_transfer(device, lba, (uint8 *)buffer, count, 1);
+    blk_trace_done(trace, error);
+
+    return error;
+}
+
+// Queues a request without waiting for it
+// The caller keeps the request (and its buffer) alive until request->done is set, see blk_wait()
+// Returns 0 if the request was queued
+int blk_submit(block_device_t *device, block_request_t *request)
+{
+    if(request->lba + request->count > device->sectors || request->lba + request->count < request->lba)
+    {
+        printf("Error: Request past the end of the device!\n");
+        return -1;
+    }
+
+    blk_trace_record(device, request->lba, request->count, BLK_TRACE_ASYNC | (request->write ? BLK_TRACE_WRITE : 0), __builtin_return_address(0));
+
+    request->device = device;
+    request->done = 0;
+    request->status = 0;
+
+    // Keep the queue sorted by lba so the driver can sweep across the disk once
+    block_request_t **link = &device->queue;
+    while(*link != 0 && (*link)->lba <= request->lba) link = &(*link)->next;
+
+    request->next = *link;
+    *link = request;
+    device->queueLength++;
+
+    if(device->queueLength >= device->limits.queueDepth) blk_unplug(device);
+
+    return 0;
+}
+
+// Hands every queued request to the driver
+void blk_unplug(block_device_t *device)
+{
+    block_request_t *requests = device->queue;
+    if(requests == 0) return;
+
+    device->queue = 0;
+    device->queueLength = 0;
+
+    if(device->submit)
+    {
+        device->submit(device, requests);
+        return;
+    }
+
+    // No asynchronous support, just run them in order
+    while(requests != 0)
+    {
+        block_request_t *next = requests->next;
+        blk_complete(requests, blk_transfer(device, requests->lba, requests->buffer, requests->count, requests->write));
+        requests = next;
+    }
+}
+
+// Called by drivers when a request has finished
+void blk_complete(block_request_t *request, int status)
+{
+    request->status = status;
+
+    if(request->complete) request->complete(request);
+
+    // Last, the owner may reuse the request as soon as this is set
+    request->done = 1;
+}
+
+// Waits for a request to finish (starting the device's queue if the request is still on it)
+// Returns the request's status
+int blk_wait(block_request_t *request)
+{
+    if(!request->done) blk_unplug(request->device);
+
+    while(!request->done){};
+
+    return request->status;
+}
+
+// Makes sure all writes have reached the disk
+int blk_flush(block_device_t *device)
+{
+    blk_trace_record(device, 0, 0, BLK_TRACE_FLUSH, __builtin_return_address(0));
+
+    blk_unplug(device);
+
+    if(device->flush) return device->flush(device);
+
+    return 0;
+}
+
+// Lets a device get ready for a request at "lba" while another device is busy (see volume.c)
+void blk_prepare(block_device_t *device, uint32 lba)
+{
+    if(device->prepare) device->prepare(device, lba);
+}
+
+// Marks a device as taken over by "holder" (like "md0"), so nobody else erases it or builds on it
+// Returns 0 on success, or -1 (and says who has it) if the device already has a holder
+int blk_claim(block_device_t *device, char *holder)
+{
+    if(device->holder != 0)
+    {
+        printf("Error: ");
+        printf(device->name);
+        printf(" is used by ");
+        printf(device->holder);
+        printf("!\n");
+        return -1;
+    }
+
+    device->holder = holder;
+    return 0;
+}
+
+void blk_release(block_device_t *device)
+{
+    device->holder = 0;
+}
+
+// The scratch buffers come from the DMA pool, so every driver can transfer into them directly
+uint8 *blk_buffer_alloc()
+{
+    return dma_buffer_alloc();
+}
+
+void blk_buffer_free(uint8 *buffer)
+{
+    dma_buffer_free(buffer);
+}
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "./types.h"
+#include "./io.h"
+#include "./irq.h"
+#include "./timer.h"
+#include "./serial.h"
+#include "./blkdev.h"
+#include "./blktrace.h"
+
+// Every request that goes through blk_read(), blk_write(), blk_submit() and blk_flush() is recorded here (see blkdev.c),
+// with when it was made, where it went and who made it. Once the ring is full the oldest entries are overwritten.
+// Requests a driver hands back to its own device (a queue it runs synchronously) are not counted twice, but a device
+// built on others (the RAM disk, a volume) makes requests of its own to the devices below it, with itself as the caller.
+//
+// blk_trace_dump() sends the ring over COM1 as text, tools/blkreplay.c reads it out of the serial log:
+//
+//   blktrace begin <entries> <dropped>
+//   blktrace device <index> <name> <sectors>       (one line per registered device)
+//   <time> <duration> <device> <R|W|F><S|A>[E] <lba> <count> <caller>
+//   blktrace end
+//
+// Times are in microseconds since blk_trace_start() (they wrap after about 71 minutes), the caller is in hex
+// and can be looked up in the symbols of build/kernel.elf
+
+blk_trace_entry_t blkTrace[BLK_TRACE_ENTRIES];
+uint32 blkTraceCount = 0;       // entries ever recorded, the newest one is at (blkTraceCount - 1) % BLK_TRACE_ENTRIES
+int blkTraceOn = 0;
+uint64 blkTraceStart;
+
+// Empties the ring and starts recording, the timer has to be calibrated
+void blk_trace_start()
+{
+    blkTraceCount = 0;
+    blkTraceStart = timer_cycles();
+    blkTraceOn = 1;
+}
+
+void blk_trace_stop()
+{
+    blkTraceOn = 0;
+}
+
+// Records a request and returns its entry, for blk_trace_done() once it has finished
+// Returns 0 when nothing is being recorded
+blk_trace_entry_t *blk_trace_record(block_device_t *device, uint32 lba, uint32 count, uint8 flags, void *caller)
+{
+    if(!blkTraceOn) return 0;
+
+    // Requests are also queued from interrupt handlers (read-ahead completions)
+    uint32 eflags = irq_save();
+    blk_trace_entry_t *entry = &blkTrace[blkTraceCount % BLK_TRACE_ENTRIES];
+    blkTraceCount++;
+    irq_restore(eflags);
+
+    int index = blk_index(device);
+
+    entry->time = timer_cycles_to_us(timer_cycles() - blkTraceStart);
+    entry->duration = 0;
+    entry->lba = lba;
+    entry->count = count;
+    entry->device = index < 0 ? 0xFF : index;
+    entry->flags = flags;
+    entry->caller = (uint32) caller;
+
+    return entry;
+}
+
+// Notes how long a synchronous request took
+void blk_trace_done(blk_trace_entry_t *entry, int error)
+{
+    if(!entry) return;
+
+    entry->duration = timer_cycles_to_us(timer_cycles() - blkTraceStart) - entry->time;
+    if(error) entry->flags |= BLK_TRACE_ERROR;
+}
+
+void blk_trace_print_entry(blk_trace_entry_t *entry)
+{
+    serial_printint(entry->time);
+    serial_putchar(' ');
+    serial_printint(entry->duration);
+    serial_putchar(' ');
+    serial_printint(entry->device);
+    serial_putchar(' ');
+    serial_putchar((entry->flags & BLK_TRACE_FLUSH) ? 'F' : (entry->flags & BLK_TRACE_WRITE) ? 'W' : 'R');
+    serial_putchar((entry->flags & BLK_TRACE_ASYNC) ? 'A' : 'S');
+    if(entry->flags & BLK_TRACE_ERROR) serial_putchar('E');
+    serial_putchar(' ');
+    serial_printint(entry->lba);
+    serial_putchar(' ');
+    serial_printint(entry->count);
+    serial_putchar(' ');
+    serial_printhex(entry->caller);
+    serial_print("\n");
+}
+
+// Sends the ring over COM1, oldest entry first, and starts a new trace
+void blk_trace_dump()
+{
+    // Nothing new is recorded while the dump runs
+    int wasOn = blkTraceOn;
+    blkTraceOn = 0;
+
+    uint32 entries = blkTraceCount < BLK_TRACE_ENTRIES ? blkTraceCount : BLK_TRACE_ENTRIES;
+
+    serial_print("blktrace begin ");
+    serial_printint(entries);
+    serial_putchar(' ');
+    serial_printint(blkTraceCount - entries);
+    serial_print("\n");
+
+    block_device_t *device;
+    for(int i = 0; (device = blk_get_index(i)) != 0; i++)
+    {
+        serial_print("blktrace device ");
+        serial_printint(i);
+        serial_putchar(' ');
+        for(int j = 0; j < 8 && device->name[j] != 0; j++) serial_putchar(device->name[j]);
+        serial_putchar(' ');
+        serial_printint(device->sectors);
+        serial_print("\n");
+    }
+
+    for(uint32 i = blkTraceCount - entries; i < blkTraceCount; i++)
+    {
+        blk_trace_print_entry(&blkTrace[i % BLK_TRACE_ENTRIES]);
+    }
+
+    serial_print("blktrace end\n");
+
+    printf("Dumped ");
+    printint(entries);
+    printf(" block requests to COM1\n");
+
+    if(wasOn) blk_trace_start();
+}
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include "./types.h"
+#include "./io.h"
+#include "./timer.h"
+#include "./serial.h"
+#include "./multiboot.h"
+#include "./boottime.h"
+
+// The bootloader (and unlz4.asm) leave their TSC timestamps at BOOTLOADER_STAMPS, the kernel takes the rest
+// boot_report() prints the time between each milestone and the one before it, on the screen and on COM1,
+// so a slower boot can be pinned on one phase.
+// When booted by a Multiboot loader there are no bootloader timestamps, and their phases are left out.
+
+#define BOOTLOADER_STAMPS ((uint64 *) 0x500)
+#define BOOTLOADER_MILESTONES (BOOT_UNPACKED + 1)
+
+char *bootMilestoneNames[BOOT_MILESTONES] = {
+    "bootloader entry",
+    "kernel loaded",
+    "protected mode",
+    "kernel unpacked",
+    "main",
+    "idt_install",
+    "isrs_install",
+    "irq_install",
+    "disk drivers",
+    "ramdisk_init",
+    "first user process",
+    "init_fs"
+};
+
+uint64 bootStamps[BOOT_MILESTONES];
+
+// Takes over the bootloader's timestamps (before anything can overwrite them) and stamps BOOT_MAIN
+void boot_init()
+{
+    if(!multiboot_booted())
+    {
+        for(int i = 0; i < BOOTLOADER_MILESTONES; i++) bootStamps[i] = BOOTLOADER_STAMPS[i];
+    }
+
+    boot_stamp(BOOT_MAIN);
+}
+
+void boot_stamp(boot_milestone_t milestone)
+{
+    bootStamps[milestone] = timer_cycles();
+}
+
+// Prints on the screen and on COM1
+void boot_print(char *string)
+{
+    printf(string);
+    serial_print(string);
+}
+
+void boot_printint(uint32 n)
+{
+    printint(n);
+    serial_printint(n);
+}
+
+// One line per milestone: the time since the one before and since the first one, in microseconds
+// Needs the timer to be calibrated
+void boot_report()
+{
+    int first = -1;
+    int previous = -1;
+
+    boot_print("Boot phases (us):\n");
+
+    for(int i = 0; i < BOOT_MILESTONES; i++)
+    {
+        // Not taken, or the stamp went backwards (a bootloader without timestamps left memory as it was)
+        if(bootStamps[i] == 0 || (previous >= 0 && bootStamps[i] < bootStamps[previous])) continue;
+
+        if(first < 0) first = i;
+
+        boot_print("  ");
+        boot_print(bootMilestoneNames[i]);
+        boot_print(": +");
+        boot_printint(previous < 0 ? 0 : timer_cycles_to_us(bootStamps[i] - bootStamps[previous]));
+        boot_print(" (");
+        boot_printint(timer_cycles_to_us(bootStamps[i] - bootStamps[first]));
+        boot_print(")\n");
+
+        previous = i;
+    }
+}
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "./types.h"
 #include "./io.h"
+#include "./dma.h"
 
 #define low_16(address) (uint16)((address) & 0xFFFF)
 #define high_16(address) (uint16)(((address) >> 16) & 0xFFFF)
@@ -37,6 +38,43 @@ enum dma_registers {
     ISA_DMA_REGISTER_Channel7PageAddress = 0x8A,
 };
 
+// The ISA DMA controller only has 16 address bits plus an 8 bit page register
+// so a transfer cannot go above 16 MB, and cannot cross a 64 KB boundary (the page register does not increment)
+#define DMA_LIMIT 0x1000000
+
+// Bounce buffers for transfers that break those rules
+// They all sit in the 64 KB page starting at 0x30000 (above the FATs, below the user stack)
+// so the kernel and its variables can use everything from 0x1000 up to the FATs at 0x20000
+#define DMA_POOL_ADDRESS 0x30000
+#define DMA_BUFFER_COUNT 3
+uint8 dmaBufferUsed[DMA_BUFFER_COUNT] = {0, 0, 0};
+
+// Returns 1 if the DMA controller can transfer directly to/from this memory
+int dma_is_safe(uint32 address, uint32 count){
+    if(count == 0){
+        return 1;
+    }
+
+    uint32 last = address + count - 1;
+    return last < DMA_LIMIT && (address >> 16) == (last >> 16);
+}
+
+// Returns a free DMA_BUFFER_SIZE bounce buffer, or 0 if they are all in use
+uint8 *dma_buffer_alloc(){
+    for(int i = 0; i < DMA_BUFFER_COUNT; i++){
+        if(!dmaBufferUsed[i]){
+            dmaBufferUsed[i] = 1;
+            return (uint8 *)(DMA_POOL_ADDRESS + (i * DMA_BUFFER_SIZE));
+        }
+    }
+
+    return 0;
+}
+
+void dma_buffer_free(uint8 *buffer){
+    dmaBufferUsed[((uint32)buffer - DMA_POOL_ADDRESS) / DMA_BUFFER_SIZE] = 0;
+}
+
 void maskChannel(uint8 channel, int masked){
     uint8 out = 0;
     uint16 port = 0x0A;
@@ -1,6 +1,9 @@
 #include "./fat.h"
-#include "./fdc.h"
+#include "./io.h"
+#include "./blkdev.h"
 #include "./string.h"
+#include "./paging.h"
+#include "./pagecache.h"
 
 // FAT Copies
 // First copy is fat0 stored at 
@@ -14,36 +17,367 @@ void *startAddress = (void *) 0x20000;
 directory_t currentDirectory;  // The current directory we have opened
 directory_entry_t rootDirectoryEntry;   // The root directory's directory entry (this does not exist on the disk since the root is not inside of another directory)
 file_t currentFile;            // The current file we have opened
+statfs_t fsStats;              // Usage counters, kept up to date by every FAT and directory change
+block_device_t *fsDevice;      // The disk the file system lives on (see FS_DEVICE)
+
+// Changes a cluster's entry in both FATs
+// Every change to the FATs goes through here so the free cluster and fragment counters never need a rescan
+void setCluster(uint16 cluster, uint16 value)
+{
+    uint16 oldValue = fat0->clusters[cluster];
+
+    if(oldValue == 0 && value != 0) fsStats.freeClusters--;
+    if(oldValue != 0 && value == 0) fsStats.freeClusters++;
+
+    // A fragment is a link to anything but the very next cluster
+    if(oldValue >= 2 && oldValue < 2304 && oldValue != cluster + 1) fsStats.fragments--;
+    if(value >= 2 && value < 2304 && value != cluster + 1) fsStats.fragments++;
+
+    fat0->clusters[cluster] = value;
+    fat1->clusters[cluster] = value;
+}
+
+// Counts everything statfs() reports from scratch
+// Only done once when the file system is mounted
+void countStats()
+{
+    fsStats.totalClusters = 2304 - 2;
+    fsStats.freeClusters = 0;
+    fsStats.fragments = 0;
+
+    for(uint16 cluster = 2; cluster < 2304; cluster++)
+    {
+        uint16 value = fat0->clusters[cluster];
+
+        if(value == 0) fsStats.freeClusters++;
+        if(value >= 2 && value < 2304 && value != cluster + 1) fsStats.fragments++;
+    }
+
+    directory_entry_t *directoryEntry = (directory_entry_t *)currentDirectory.startingAddress;
+    fsStats.totalEntries = DIRECTORY_ENTRY_COUNT;
+    fsStats.usedEntries = 0;
+
+    for(uint32 index = 0; index < fsStats.totalEntries; index++, directoryEntry++)
+    {
+        if(directoryEntry->filename[0] != 0) fsStats.usedEntries++;
+    }
+}
+
+// Copies the file system's usage counters into "stats"
+// This never touches the disk or scans the FAT
+int statfs(statfs_t *stats)
+{
+    *stats = fsStats;
+    return 0;
+}
+
+// Bloom filter of 8.3 names
+// Each name sets 3 of the 256 bits in its directory's filter, picked from two FNV-1a hashes of the padded name
+// Lookups for names that are not in the directory (like every 'c' command) usually find an unset bit and stop
+// without looking at a single directory entry
+#define BLOOM_BITS 256
+#define BLOOM_HASHES 3
+
+void bloomHash(char *filename, char *ext, uint32 *hash0, uint32 *hash1)
+{
+    uint32 hash = 2166136261u;
+
+    for(int i = 0; i < 11; i++)
+    {
+        hash ^= (uint8)(i < 8 ? filename[i] : ext[i - 8]);
+        hash *= 16777619u;
+    }
+
+    *hash0 = hash;
+    *hash1 = (hash >> 16) | 1; // odd, so the 3 bits are spread out
+}
+
+void bloomAdd(directory_t *directory, char *filename, char *ext)
+{
+    uint32 hash0, hash1;
+    bloomHash(filename, ext, &hash0, &hash1);
+
+    for(int i = 0; i < BLOOM_HASHES; i++)
+    {
+        uint32 bit = (hash0 + (i * hash1)) % BLOOM_BITS;
+        directory->bloom[bit / 32] |= 1u << (bit % 32);
+    }
+}
+
+// Returns 0 if the name is definitely not in the directory, 1 if it might be
+char bloomMayContain(directory_t *directory, char *filename, char *ext)
+{
+    uint32 hash0, hash1;
+    bloomHash(filename, ext, &hash0, &hash1);
+
+    for(int i = 0; i < BLOOM_HASHES; i++)
+    {
+        uint32 bit = (hash0 + (i * hash1)) % BLOOM_BITS;
+        if(!(directory->bloom[bit / 32] & (1u << (bit % 32)))) return 0;
+    }
+
+    return 1;
+}
+
+// Builds the filter from the directory's entries
+// Done when the directory is loaded and after a delete (bits cannot be removed from a Bloom filter)
+void bloomRebuild(directory_t *directory)
+{
+    for(int i = 0; i < BLOOM_BITS / 32; i++)
+    {
+        directory->bloom[i] = 0;
+    }
+
+    directory_entry_t *directoryEntry = (directory_entry_t *)directory->startingAddress;
+    uint32 maxDirectoryEntryCount = DIRECTORY_ENTRY_COUNT;
+
+    for(uint32 index = 0; index < maxDirectoryEntryCount; index++, directoryEntry++)
+    {
+        if(directoryEntry->filename[0] != 0)
+        {
+            bloomAdd(directory, (char *)directoryEntry->filename, (char *)directoryEntry->ext);
+        }
+    }
+}
+
+// Replaces the null terminator (and anything after it) with spaces so names can be compared against directory entries
+// The first character is left alone so an empty name stays empty
+void padName(char *name, int length)
+{
+    char nullFound = 0;
+    for(int i = 1; i < length; i++)
+    {
+        if (name[i] == 0 && !nullFound) nullFound = 1;
+        if (nullFound) name[i] = ' ';
+    }
+}
 
 // Initialize the file system
-// Loads the FATs and root directory
+// Mounts FS_DEVICE, or FS_FALLBACK_DEVICE if that does not work
 void init_fs()
 {
-    // The FATs and directory are loaded into 0x20000, 0x21200, and 0x22400
-    // These addresses were chosen because they are far enough away from the kernel (0x01000 - 0x07000)
+    if(mountFs(FS_DEVICE) != 0 && mountFs(FS_FALLBACK_DEVICE) != 0)
+    {
+        printf("Error: There is no disk to mount!\n");
+    }
+}
 
-    // Read the first copy of the FAT (Drive 0, Cluster 1, 512 bytes * 9 clusters)
-    fat0 = (fat_t *) startAddress; // Put FAT at 0x20000
-    floppy_read(0, 1,  (void *)fat0, sizeof(fat_t));
+// Checks that a boot sector describes the layout this file system uses
+// (the FATs at sectors 1 and 10, the root directory at 19, one sector per cluster)
+// Returns 0 if it does
+int checkBootSector(uint8 *sector, block_device_t *device)
+{
+    boot_sector_t *bootSector = (boot_sector_t *)sector;
+
+    if(sector[510] != 0x55 || sector[511] != 0xAA) return -1;
+    if(bootSector->bytesPerSector != 512 || bootSector->sectorsPerCluster != 1) return -1;
+    if(bootSector->ReservedSectors != 1 || bootSector->fatCount != 2 || bootSector->sectorsPerFat != sizeof(fat_t) / 512) return -1;
+    if(bootSector->rootDirectoryEntries != DIRECTORY_ENTRY_COUNT) return -1;
+    if(bootSector->sectorCount > device->sectors) return -1;
+
+    // 0xF0 (removable disks) or 0xF8 - 0xFF
+    if(bootSector->mediaDescriptorType != 0xF0 && bootSector->mediaDescriptorType < 0xF8) return -1;
+
+    return 0;
+}
+
+// Mounts the file system on the block device called "name" in place of the mounted one (which is synced first)
+// Loads the FATs and root directory, the device is held by the file system from then on (see blk_claim())
+// Everything is read and checked before the mounted disk is let go, so if anything fails it stays mounted
+// Returns 0 on success, -1 if there is no such device, it is used by something else, cannot be read or holds no file system
+int mountFs(char *name)
+{
+    // Everything is read and written through the block device layer
+    block_device_t *device = blk_get(name);
+    if(device == 0) return -1;
+    if(device == fsDevice) return 0;
+
+    if(currentFile.isOpened)
+    {
+        printf("Error: Close the file before mounting another disk!\n");
+        return -1;
+    }
+
+    if(blk_claim(device, "fs") != 0) return -1;
+
+    // The boot sector, both FATs and the root directory are next to each other (sectors 0 - 32), they are read in one go
+    uint32 sectors = 19 + ROOT_DIRECTORY_SECTORS;
+    uint8 *buffer = blk_buffer_alloc();
+    int error = buffer == 0 ? -1 : 0;
+
+    if(error == 0) error = blk_read(device, 0, (void *)buffer, sectors);
+    if(error == 0 && checkBootSector(buffer, device) != 0)
+    {
+        printf("Error: There is no file system on the disk!\n");
+        error = -1;
+    }
+
+    // Write out what the mounted disk still has in memory, it stays mounted if that does not work
+    if(error == 0 && fsDevice != 0)
+    {
+        drainReadAhead();
+        error = syncFs();
+    }
+
+    if(error != 0)
+    {
+        if(buffer != 0) blk_buffer_free(buffer);
+        blk_release(device);
+        printf("Error: Could not mount the disk!\n");
+        return -1;
+    }
+
+    if(fsDevice != 0) blk_release(fsDevice);
+    fsDevice = device;
 
-    // Read the second copy of the FAT (Drive 0, Cluster 10, 512 bytes * 9 clusters)
+    // The FATs and directory are loaded into 0x20000, 0x21200, and 0x22400
+    // These addresses were chosen because they are far enough away from the kernel (0x01000 - 0x0AFFF)
+    fat0 = (fat_t *) startAddress; // Put FAT at 0x20000
     fat1 = (fat_t *) (startAddress+sizeof(fat_t)); // Put FAT at 0x21200
-    floppy_read(0, 10, (void *)fat1, sizeof(fat_t));
+    currentDirectory.startingAddress = (uint8 *) (startAddress+(sizeof(fat_t)*2)); // Put ROOT at 0x22400
+
+    // The first copy of the FAT (sector 1, 9 sectors), the second copy (sector 10, 9 sectors)
+    // and the root directory (sector 19, 14 sectors)
+    uint8 *destination = (uint8 *)startAddress;
+    for(uint32 i = 512; i < sectors * 512; i++)
+    {
+        destination[i - 512] = buffer[i];
+    }
+    blk_buffer_free(buffer);
 
-    // Read the root directory (Drive 0, Cluster 19, 512 bytes * 14 clusters)
     currentDirectory.isOpened = 1;
     currentDirectory.directoryEntry = &rootDirectoryEntry;
-
-    currentDirectory.startingAddress = (uint8 *) (startAddress+(sizeof(fat_t)*2)); // Put ROOT at 0x22400
     stringcopy("ROOT    ", (char *)currentDirectory.directoryEntry->filename, 8);
 
-    floppy_read(0, 19, (void *)currentDirectory.startingAddress, 512 * 14);
+    // File data is read into the page cache as it is used
+    pagecache_init();
+
+    countStats();
+    bloomRebuild(&currentDirectory);
 
     // Start our file out blank
     currentFile.isOpened = 0;
     currentFile.directoryEntry = 0;
     currentFile.index = 0;
-    currentFile.startingAddress = 0;
+    currentFile.page = 0;
+
+    return 0;
+}
+
+// Writes a new, empty file system onto the block device called "name", laid out like the boot floppy (see bootloader.asm)
+// The disk is held while it is written, and the mounted disk can not be formatted
+// The boot sector only holds the BIOS parameter block (the disk does not boot), both FATs are empty and so is the root directory
+// Returns 0 on success
+int formatFs(char *name)
+{
+    block_device_t *device = blk_get(name);
+    if(device == 0 || device->sectors < 2880)
+    {
+        printf("Error: There is no disk big enough to format!\n");
+        return -1;
+    }
+
+    if(device == fsDevice)
+    {
+        printf("Error: The mounted disk can not be formatted!\n");
+        return -1;
+    }
+
+    if(blk_claim(device, "format") != 0) return -1;
+
+    uint8 *buffer = blk_buffer_alloc();
+    if(buffer == 0)
+    {
+        printf("Error: No buffer free for the format!\n");
+        blk_release(device);
+        return -1;
+    }
+
+    // The boot sector
+    for(uint32 i = 0; i < 512; i++)
+    {
+        buffer[i] = 0;
+    }
+
+    boot_sector_t *bootSector = (boot_sector_t *) buffer;
+    bootSector->jumpInstruction[0] = 0xEB; // jmp $ (a BIOS that boots the disk just stops), nop
+    bootSector->jumpInstruction[1] = 0xFE;
+    bootSector->jumpInstruction[2] = 0x90;
+    stringcopy("MSWIN4.1", (char *)bootSector->oem, 8);
+    bootSector->bytesPerSector = 512;
+    bootSector->sectorsPerCluster = 1;
+    bootSector->ReservedSectors = 1;
+    bootSector->fatCount = 2;
+    bootSector->rootDirectoryEntries = DIRECTORY_ENTRY_COUNT;
+    bootSector->sectorCount = 2880;
+    bootSector->mediaDescriptorType = 0xF8;
+    bootSector->sectorsPerFat = sizeof(fat_t) / 512;
+    bootSector->sectorsPerTrack = 18;
+    bootSector->headCount = 2;
+    bootSector->signature = 0x29;
+    stringcopy("NO NAME    ", (char *)bootSector->volumeLabel, 11);
+    stringcopy("FAT16   ", (char *)bootSector->systemID, 8);
+    buffer[510] = 0x55;
+    buffer[511] = 0xAA;
+
+    int error = blk_write(device, 0, (void *)buffer, 1);
+
+    // Both FATs, the two reserved entries are 0 like on the boot floppy (see fat.asm)
+    fat_t *fat = (fat_t *) buffer;
+    for(uint32 i = 0; i < 2304; i++)
+    {
+        fat->clusters[i] = 0;
+    }
+
+    if(error == 0) error = blk_write(device, 1, (void *)buffer, sizeof(fat_t) / 512);
+    if(error == 0) error = blk_write(device, 10, (void *)buffer, sizeof(fat_t) / 512);
+
+    // The root directory
+    for(uint32 i = 0; i < ROOT_DIRECTORY_SECTORS * 512; i++)
+    {
+        buffer[i] = 0;
+    }
+
+    if(error == 0) error = blk_write(device, 19, (void *)buffer, ROOT_DIRECTORY_SECTORS);
+
+    blk_buffer_free(buffer);
+    blk_release(device);
+
+    if(error != 0) printf("Error: Could not format the disk!\n");
+    return error;
+}
+
+// Unpins the page the current file was reading/writing
+void releaseCursor()
+{
+    if(currentFile.page != 0)
+    {
+        pagecache_unpin(currentFile.directoryEntry, currentFile.pageIndex);
+        currentFile.page = 0;
+    }
+}
+
+// Returns the page of the current file holding "index", reading it into the page cache if needed
+// The page stays pinned (so it cannot be evicted) until the file moves on to another page or is closed
+// This way readByte()/writeByte() only look up the page cache once every 4 KB
+uint8 *cursorPage(uint32 index)
+{
+    uint32 pageIndex = index / 4096;
+
+    if(currentFile.page == 0 || currentFile.pageIndex != pageIndex)
+    {
+        releaseCursor();
+
+        uint8 *page = pagecache_get(currentFile.directoryEntry, pageIndex);
+        if(page == 0) return 0;
+
+        pagecache_pin(currentFile.directoryEntry, pageIndex);
+        currentFile.page = page;
+        currentFile.pageIndex = pageIndex;
+        currentFile.pageIsDirty = 0;
+    }
+
+    return currentFile.page;
 }
 
 void renameFile(char *newFilename, char *newExt){
@@ -53,13 +387,22 @@ void renameFile(char *newFilename, char *newExt){
         printf("Error: File was not opened!\n");
         return;
     }
-    // Copy the new filename and extension into the directory entry
+    // Save anything written to the file so far
+    releaseCursor();
+    pagecache_flush(currentFile.directoryEntry);
+
+    // Copy the new filename and extension into the directory entry, padded with spaces like every other entry
+    padName(newFilename, 8);
+    padName(newExt, 3);
     stringcopy(newFilename, (char *)currentFile.directoryEntry->filename, 8);
     stringcopy(newExt, (char *)currentFile.directoryEntry->ext, 3);
 
-    floppy_write(0, 19, (void *)currentDirectory.startingAddress, 512 * 14); // Write the directory to the disk
-    floppy_write(0, 1, (void *)fat0, sizeof(fat_t)); // Write the first FAT to the disk
-    floppy_write(0, 10, (void *)fat1, sizeof(fat_t)); // Write the second FAT to the disk
+    // Lookups hash the padded name, so the filter gets the bytes that are now in the entry
+    bloomAdd(&currentDirectory, (char *)currentFile.directoryEntry->filename, (char *)currentFile.directoryEntry->ext);
+
+    blk_write(fsDevice, 19, (void *)currentDirectory.startingAddress, ROOT_DIRECTORY_SECTORS); // Write the directory to the disk
+    blk_write(fsDevice, 1, (void *)fat0, sizeof(fat_t) / 512); // Write the first FAT to the disk
+    blk_write(fsDevice, 10, (void *)fat1, sizeof(fat_t) / 512); // Write the second FAT to the disk
 
     currentFile.isOpened = 0; // Mark the file as closed
 }
@@ -71,9 +414,13 @@ void moveFile(directory_t *toDirectory){
         printf("Error: File was not opened!\n");
         return;
     }
+    // Save anything written to the file so far
+    releaseCursor();
+    pagecache_flush(currentFile.directoryEntry);
+
     // Copy the directory entry to the new directory
     directory_entry_t *directoryEntry = (directory_entry_t *)toDirectory->startingAddress;
-    uint32 maxDirectoryEntryCount = 16;
+    uint32 maxDirectoryEntryCount = DIRECTORY_ENTRY_COUNT;
 
     // Check for an empty directory entry
     for(uint32 index = 0; index < maxDirectoryEntryCount; index++, directoryEntry++)
@@ -83,13 +430,15 @@ void moveFile(directory_t *toDirectory){
         {
             // Copy the directory entry to the new directory
             *directoryEntry = *currentFile.directoryEntry;
+            if(toDirectory->startingAddress == currentDirectory.startingAddress) fsStats.usedEntries++;
+            bloomAdd(toDirectory, (char *)directoryEntry->filename, (char *)directoryEntry->ext);
             break;
         }
     }
 
-    floppy_write(0, 19, (void *)toDirectory->startingAddress, 512 * 14); // Write the directory to the disk
-    floppy_write(0, 1, (void *)fat0, sizeof(fat_t)); // Write the first FAT to the disk
-    floppy_write(0, 10, (void *)fat1, sizeof(fat_t)); // Write the second FAT to the disk
+    blk_write(fsDevice, 19, (void *)toDirectory->startingAddress, ROOT_DIRECTORY_SECTORS); // Write the directory to the disk
+    blk_write(fsDevice, 1, (void *)fat0, sizeof(fat_t) / 512); // Write the first FAT to the disk
+    blk_write(fsDevice, 10, (void *)fat1, sizeof(fat_t) / 512); // Write the second FAT to the disk
 
     currentFile.isOpened = 0; // Mark the file as closed
 }
@@ -103,44 +452,42 @@ int closeFile()
         return -1;
 
     }
+    directory_entry_t *directoryEntry = currentFile.directoryEntry;
+
+    // Let go of the pages we were using, changes made through a memory mapping are handed to the page cache
+    releaseCursor();
+    drainReadAhead();
+    munmapFile(directoryEntry);
+
     // Calculate number of clusters needed
-    uint32 clustersNeeded = (currentFile.directoryEntry->fileSize + 511) / 512;
-    uint8 *dataPtr = currentFile.startingAddress;
+    uint32 clustersNeeded = (directoryEntry->fileSize + 511) / 512;
+    if(clustersNeeded == 0) clustersNeeded = 1;
 
-    uint16 cluster = currentFile.directoryEntry->startingCluster;
-    uint16 prevCluster = 0;
+    // If the file grew, link new clusters onto the end of the chain
+    uint32 clustersOwned = extendChain(directoryEntry, clustersNeeded);
+    uint16 cluster = skipClusters(directoryEntry->startingCluster, clustersOwned - 1);
 
-    // Allocate new cluster if needed
-    for(uint32 i = 0; i < clustersNeeded; i++)
+    if(clustersOwned < clustersNeeded)
     {
-        
-        if(cluster == 0 || cluster == 0xFFFF)
-        {
-            // search for free cluster
-            uint16 newCluster;
-            for(newCluster = 2; newCluster < 2304; newCluster++)
-            {
-                if(fat0->clusters[newCluster] == 0)
-                {
-                    break;
-                }
-            }
-            // Link previous cluster to new cluster
-            fat0->clusters[cluster] = newCluster;
-            fat1->clusters[cluster] = newCluster;
-            cluster = newCluster; // Update the current cluster to the new cluster
-        }
-        
-        floppy_write(0, cluster + 31, (void *) (dataPtr + (i * 512)), 512); // Write data to floppy disk
-        prevCluster = cluster; // Save current cluster for next iteration
-        cluster = fat0->clusters[cluster]; // Get next cluster
-    }
-    // Mark the last cluster as end of file
-    fat0->clusters[prevCluster] = 0xFFFF;
-    fat1->clusters[prevCluster] = 0xFFFF;
-    floppy_write(0, 1, (void *)fat0, sizeof(fat_t)); // Write the first FAT to the disk
-    floppy_write(0, 10, (void *)fat1, sizeof(fat_t)); // Write the second FAT to the disk (redundant)
-    floppy_write(0, 19, (void *)currentDirectory.startingAddress, 512 * 14); // Write the directory to the disk
+        printf("Error: Not enough free space on the disk, the file was cut short!\n");
+        directoryEntry->fileSize = clustersOwned * 512;
+    }
+    else if(fat0->clusters[cluster] != 0xFFFF)
+    {
+        // The chain is longer than the file, free the leftover clusters
+        uint16 extra = fat0->clusters[cluster];
+
+        // Mark the last cluster as end of file
+        setCluster(cluster, 0xFFFF);
+        freeChain(extra);
+    }
+
+    // Only the pages that were written to go back to the floppy
+    pagecache_flush(directoryEntry);
+
+    blk_write(fsDevice, 1, (void *)fat0, sizeof(fat_t) / 512); // Write the first FAT to the disk
+    blk_write(fsDevice, 10, (void *)fat1, sizeof(fat_t) / 512); // Write the second FAT to the disk (redundant)
+    blk_write(fsDevice, 19, (void *)currentDirectory.startingAddress, ROOT_DIRECTORY_SECTORS); // Write the directory to the disk
 
     currentFile.isOpened = 0; // Mark the file as closed
 
@@ -149,9 +496,13 @@ int closeFile()
 
 int createFile(char *filename, char *ext)
 {
+    // Pad the name the same way openFile() does so it can be found again
+    padName(filename, 8);
+    padName(ext, 3);
+
     // Create a new file in the current directory
     directory_entry_t *directoryEntry = (directory_entry_t *)currentDirectory.startingAddress;
-    uint32 maxDirectoryEntryCount = 16;
+    uint32 maxDirectoryEntryCount = DIRECTORY_ENTRY_COUNT;
 
     // Check for an empty directory entry
     for(uint32 index = 0; index < maxDirectoryEntryCount; index++, directoryEntry++)
@@ -159,9 +510,14 @@ int createFile(char *filename, char *ext)
         // Check if entry is empty (first byte is null '\0')
         if(directoryEntry->filename[0] == 0)
         {
+            // Forget any cached pages of a file that used to live in this entry
+            pagecache_invalidate(directoryEntry);
+
             // Copy the filename and extension into the directory entry
             stringcopy(filename, (char *)directoryEntry->filename, 8);
             stringcopy(ext, (char *)directoryEntry->ext, 3);
+            fsStats.usedEntries++;
+            bloomAdd(&currentDirectory, filename, ext);
 
             // Set the starting cluster, Cluster 1 is boot sector.
             for(uint16 startingCluster = 2; startingCluster < 2304; startingCluster++)
@@ -172,14 +528,13 @@ int createFile(char *filename, char *ext)
                     directoryEntry->startingCluster = startingCluster; // Set the starting cluster in the directory entry
                     directoryEntry->fileSize = 512; // Set the file size to 512 bytes (1 sector)
                     // Mark the cluster as end of file
-                    fat0->clusters[startingCluster] = 0xFFFF;
-                    fat1->clusters[startingCluster] = 0xFFFF;
+                    setCluster(startingCluster, 0xFFFF);
                     break;
                 }
             }
-            floppy_write(0, 19, (void *)currentDirectory.startingAddress, 512 * 14); // Write the directory to the disk
-            floppy_write(0, 1, (void *)fat0, sizeof(fat_t)); // Write the first FAT to the disk
-            floppy_write(0, 10, (void *)fat1, sizeof(fat_t)); // Write the second FAT to the disk
+            blk_write(fsDevice, 19, (void *)currentDirectory.startingAddress, ROOT_DIRECTORY_SECTORS); // Write the directory to the disk
+            blk_write(fsDevice, 1, (void *)fat0, sizeof(fat_t) / 512); // Write the first FAT to the disk
+            blk_write(fsDevice, 10, (void *)fat1, sizeof(fat_t) / 512); // Write the second FAT to the disk
             
             currentFile.isOpened = 0; // Mark the file as closed
             return 0;
@@ -198,6 +553,13 @@ int deleteFile()
         return -1;
 
     }
+    // The file's cached pages are thrown away, there is no point writing them back
+    // (but not while a read-ahead is still filling one of them)
+    releaseCursor();
+    drainReadAhead();
+    munmapFile(currentFile.directoryEntry);
+    pagecache_invalidate(currentFile.directoryEntry);
+
     // Set the cluster to current file's starting address
     uint16 cluster = currentFile.directoryEntry->startingCluster;
     // Loop through and free all clusters in the file
@@ -205,24 +567,25 @@ int deleteFile()
     {
         uint16 nextCluster = fat0->clusters[cluster]; // Get the next cluster from FAT 0
         // Mark the cluster as free in both FATs
-        fat0->clusters[cluster] = 0;
-        fat1->clusters[cluster] = 0;
+        setCluster(cluster, 0);
         cluster = nextCluster; // Get the next cluster from FAT 0
     }
     // Clear the directory entry
     currentFile.directoryEntry->filename[0] = 0; // Set the first byte of the filename to null
+    fsStats.usedEntries--;
+    bloomRebuild(&currentDirectory);
 
-    floppy_write(0, 19, (void *)currentDirectory.startingAddress, 512 * 14); // Write the directory to the disk
-    floppy_write(0, 1, (void *)fat0, sizeof(fat_t)); // Write the first FAT to the disk
-    floppy_write(0, 10, (void *)fat1, sizeof(fat_t)); // Write the second FAT to the disk
+    blk_write(fsDevice, 19, (void *)currentDirectory.startingAddress, ROOT_DIRECTORY_SECTORS); // Write the directory to the disk
+    blk_write(fsDevice, 1, (void *)fat0, sizeof(fat_t) / 512); // Write the first FAT to the disk
+    blk_write(fsDevice, 10, (void *)fat1, sizeof(fat_t) / 512); // Write the second FAT to the disk
 
     currentFile.isOpened = 0; // Mark the file as closed
     return 0;
 }
 
-// Returns a byte from a file that is currently loaded into memory
+// Returns a byte from a file that is currently opened
 // This does NOT modify the floppy disk
-// This function requires the file to have been loaded into memory with floppy_read()
+// The byte comes from the page cache, which reads the page from the floppy the first time it is used
 uint8 readByte(uint32 index)
 {
     // Are we trying to read from the end of a file?
@@ -231,12 +594,26 @@ uint8 readByte(uint32 index)
         return -2;
     }
 
-    // Check if the file is opened and is not a NULL pointer
-    if(currentFile.isOpened && currentFile.startingAddress != 0)
+    // Check if the file is opened and its page could be loaded
+    char newPage = currentFile.page == 0 || currentFile.pageIndex != index / 4096;
+    uint8 *page = currentFile.isOpened ? cursorPage(index) : 0;
+    if(page != 0)
     {
+        // Moving to another page is when the pages after it get requested
+        if(newPage) readAhead(index / 4096);
+
         currentFile.index = index + 1;              // Point us to the next index
         // Return the byte at the specified index
-        return currentFile.startingAddress[index];
+        return page[index % 4096];
+    }
+
+    if(currentFile.isOpened)
+    {
+        printf("Error: The file could not be read!\n");
+
+        // A reader going through readNextByte() gets the end of the file next, instead of failing on the same byte forever
+        currentFile.index = currentFile.directoryEntry->fileSize;
+        return -1;
     }
 
     // If the file was not opened, or was a NULL pointer, return error
@@ -244,38 +621,51 @@ uint8 readByte(uint32 index)
     return -1;
 }
 
-// Returns the next byte from a file that is currently loaded into memory
+// Returns the next byte from a file that is currently opened
 uint8 readNextByte()
 {
     return readByte(currentFile.index);
 }
 
-// Writes a byte to the current file that is currently loaded into memory
+// Writes a byte to the current file (in the page cache)
 // This does NOT modify the floppy disk
-// To write this to the floppy disk, we have to call floppy_write()
+// The dirty page is written to the floppy disk when the file is closed (or the page is evicted)
 int writeByte(uint8 byte, uint32 index)
 {
-    // Check if the file is opened and is not a NULL pointer
-    if(currentFile.isOpened && currentFile.startingAddress != 0)
+    // Check if the file is opened and its page could be loaded
+    uint8 *page = currentFile.isOpened ? cursorPage(index) : 0;
+    if(page != 0)
     {
-        currentFile.startingAddress[index] = byte;  // Place the byte at the address + index
+        page[index % 4096] = byte;                  // Place the byte in the page
+        if(!currentFile.pageIsDirty)
+        {
+            pagecache_mark_dirty(currentFile.directoryEntry, currentFile.pageIndex);
+            currentFile.pageIsDirty = 1;
+        }
+
         if(index + 1 > currentFile.directoryEntry->fileSize) currentFile.directoryEntry->fileSize = index + 1;    // Increase the file size
         currentFile.index = index + 1;              // Point us to the next index
         return 0;
     }
 
+    if(currentFile.isOpened)
+    {
+        printf("Error: The file could not be read, so it was not written!\n");
+        return -1;
+    }
+
     // If the file was not opened, or was a NULL pointer, return error
     printf("Error: File was not opened or pointed to NULL!\n");
     return -1;
 }
 
-// Writes a byte to the current file that is currently loaded into memory at the next index
+// Writes a byte to the current file at the next index
 int writeNextByte(uint8 byte)
 {
     return writeByte(byte, currentFile.index);
 }
 
-// Writes a byte to the current file that is currently loaded into memory at the next index multiple times
+// Writes a byte to the current file at the next index multiple times
 int writeBytes(uint8 byte, uint32 count)
 {
     for(int i = 0; i < (int)count; i++)
@@ -288,7 +678,8 @@ int writeBytes(uint8 byte, uint32 count)
     return 0;
 }
 
-// Finds a file within our current directory and loads every sector of the file into memory
+// Finds a file within our current directory and opens it
+// The file's data is not read here, pages are read into the page cache as they are used (and stay there after the file is closed)
 // Returns 0 if the file was found in the current directory
 // Returns -3 if the file was not found in the current directory
 // Returns other error codes if something went wrong
@@ -302,23 +693,15 @@ int openFile(char *filename, char *ext)
     }
 	
     // Scrub null terminators from our filename and extension and pad with spaces for more accurate comparisons
-    char nullFound = 0;
-    for(int i = 1; i < 8; i++)
-    {
-        if (filename[i] == 0 && !nullFound) nullFound = 1;
-        if (nullFound) filename[i] = ' ';
-    }
+    padName(filename, 8);
+    padName(ext, 3);
 
-    nullFound = 0;
-    for(int i = 1; i < 3; i++)
-    {
-        if (ext[i] == 0 && !nullFound) nullFound = 1;
-        if (nullFound) ext[i] = ' ';
-    }
+    // Most lookups for missing files end here without reading a single directory entry
+    if(!bloomMayContain(&currentDirectory, filename, ext)) return -3;
 
     // Get a pointer to the first address of the directory entry in this directory
 	directory_entry_t *directoryEntry = (directory_entry_t *)currentDirectory.startingAddress;
-    uint32 maxDirectoryEntryCount = 16;
+    uint32 maxDirectoryEntryCount = DIRECTORY_ENTRY_COUNT;
     char fileExists = 0;
 
     // Assume we can have a maximum of 16 directory entries per directory
@@ -341,6 +724,7 @@ int openFile(char *filename, char *ext)
         // Check if the file has been corrupted
         // Check each entry in the FAT table, ensure both FATs are consistent before opening the file
         uint16 cluster = directoryEntry->startingCluster;
+        uint16 sectorCount = 0;
         while(cluster != 0xFFFF)
         {
             // Check if the copies of the FATs are consistent
@@ -352,28 +736,8 @@ int openFile(char *filename, char *ext)
 
             // Get the next cluster
             cluster = fat0->clusters[cluster];
-        }
-
-        // Set the starting address of the file to some memory location
-        uint8 *startingAddress = (void *)0x30000;
-
-        // Starting at the first sector, each each sector from floppy into memory
-        cluster = directoryEntry->startingCluster;
-        uint16 sectorCount = 0;
-
-        // Loop through every link in the FAT
-        while(cluster != 0xFFFF)
-        {
-            // Convert the cluster to a sector
-            uint32 sector = cluster + 31;
-            
-            // Read the sector from the floppy disk
-            floppy_read(0, sector, (void *) startingAddress + (512 * sectorCount), 512);
             sectorCount++;
 
-            // Get the next cluster
-            cluster = fat0->clusters[cluster];
-
             // It is possible to get stuck in an infinite loop, reading FAT entries forever
             // We prevent that here by checking if the amount of sectors could actually fit on disk
             if(sectorCount > 2880)
@@ -383,14 +747,668 @@ int openFile(char *filename, char *ext)
             }
         }
 
-        // If no error has occured, label the file as opened and point it to all the data we just read in
+        // If no error has occured, label the file as opened
         currentFile.directoryEntry = directoryEntry;
-        currentFile.startingAddress = startingAddress;
+        currentFile.page = 0;
         currentFile.index = 0;
+        currentFile.lastPageIndex = 0xFFFFFFFF;    // So reading page 0 first counts as sequential
+        currentFile.aheadWindow = 0;
+        currentFile.aheadNext = 0;
         currentFile.isOpened = 1;
         return 0;
     }
 
     // If we did not find the file return -3
 	return -3;
+}
+
+// Returns the directory entry in the current directory matching the (padded) filename and extension
+// Returns 0 if there is no such entry
+directory_entry_t *findEntry(char *filename, char *ext)
+{
+    if(!bloomMayContain(&currentDirectory, filename, ext)) return 0;
+
+    directory_entry_t *directoryEntry = (directory_entry_t *)currentDirectory.startingAddress;
+    uint32 maxDirectoryEntryCount = DIRECTORY_ENTRY_COUNT;
+
+    for(uint32 index = 0; index < maxDirectoryEntryCount; index++, directoryEntry++)
+    {
+        if(directoryEntry->filename[0] == 0) continue;
+
+        if(stringcompare((char *)directoryEntry->filename, filename, 8) && stringcompare((char *)directoryEntry->ext, ext, 3))
+        {
+            return directoryEntry;
+        }
+    }
+
+    return 0;
+}
+
+// Counts how many clusters of a chain, starting at "cluster", are stored one after another on the disk
+// The run stops after "maxLength" clusters, at the end of the chain, or where the disk's transfers
+// have to stop anyway (limits.boundarySectors, a cylinder on a floppy) so that the whole run is moved in one piece
+uint32 runLength(uint16 cluster, uint32 maxLength)
+{
+    uint32 boundary = fsDevice->limits.boundarySectors;
+    uint32 length = 1;
+
+    while(length < maxLength && fat0->clusters[cluster] == cluster + 1 && (boundary == 0 || (cluster + 1 + 31) % boundary != 0))
+    {
+        cluster++;
+        length++;
+    }
+
+    return length;
+}
+
+// Follows the chain "steps" links forward from "cluster"
+uint16 skipClusters(uint16 cluster, uint32 steps)
+{
+    for(uint32 i = 0; i < steps && cluster != 0xFFFF; i++)
+    {
+        cluster = fat0->clusters[cluster];
+    }
+
+    return cluster;
+}
+
+// Allocates and links a chain of "count" free clusters in both FATs
+// A single contiguous run is preferred (first fit), otherwise the lowest free clusters are used so runs stay as long as possible
+// Returns the first cluster of the chain, or 0 if the disk does not have enough free clusters
+uint16 allocateChain(uint32 count)
+{
+    // The counters answer this without scanning the FAT
+    if(fsStats.freeClusters < count) return 0;
+
+    uint16 first = 0;
+    uint32 runStart = 0;
+    uint32 runSize = 0;
+    uint32 freeCount = 0;
+
+    // Look for a contiguous run that fits the whole chain
+    for(uint16 cluster = 2; cluster < 2304; cluster++)
+    {
+        if(fat0->clusters[cluster] == 0 && fat1->clusters[cluster] == 0)
+        {
+            if(runSize == 0) runStart = cluster;
+            runSize++;
+            freeCount++;
+
+            if(runSize == count && first == 0) first = runStart;
+        }
+        else
+        {
+            runSize = 0;
+        }
+    }
+
+    if(freeCount < count) return 0;
+
+    uint16 prevCluster = 0;
+    uint16 cluster = (first != 0) ? first : 2;
+
+    for(uint32 i = 0; i < count; i++, cluster++)
+    {
+        // Skip over used clusters (only happens when no single run was big enough)
+        while(fat0->clusters[cluster] != 0 || fat1->clusters[cluster] != 0) cluster++;
+
+        if(prevCluster == 0)
+        {
+            first = cluster;
+        }
+        else
+        {
+            setCluster(prevCluster, cluster);
+        }
+
+        // Mark the cluster as end of file for now, the next iteration will link it
+        setCluster(cluster, 0xFFFF);
+        prevCluster = cluster;
+    }
+
+    return first;
+}
+
+// Makes a file's chain at least "clusterCount" clusters long, linking new clusters onto its end if it is shorter
+// A file that grows while it is open only gets its clusters here (from closeFile(), or when a page is written back)
+// Returns how many clusters the chain has up to "clusterCount", less than that if the disk is full
+uint32 extendChain(directory_entry_t *directoryEntry, uint32 clusterCount)
+{
+    uint16 cluster = directoryEntry->startingCluster;
+    uint32 clustersOwned = 1;
+
+    while(clustersOwned < clusterCount && fat0->clusters[cluster] != 0xFFFF)
+    {
+        cluster = fat0->clusters[cluster];
+        clustersOwned++;
+    }
+
+    if(clustersOwned < clusterCount)
+    {
+        uint16 newCluster = allocateChain(clusterCount - clustersOwned);
+        if(newCluster == 0) return clustersOwned;
+
+        setCluster(cluster, newCluster);
+        clustersOwned = clusterCount;
+    }
+
+    return clustersOwned;
+}
+
+// Frees every cluster of a chain starting at "cluster", in both FATs
+void freeChain(uint16 cluster)
+{
+    while(cluster != 0xFFFF && cluster >= 2 && cluster < 2304)
+    {
+        uint16 nextCluster = fat0->clusters[cluster];
+        setCluster(cluster, 0);
+        cluster = nextCluster;
+    }
+}
+
+// Copies a file in the current directory to a new file in the current directory
+// The data never goes through readByte()/writeByte(), instead each run of contiguous source clusters
+// (up to a scratch buffer full, see runLength()) is read into a block layer scratch buffer with a single transfer
+// and written back out the same way
+// Returns 0 if the file was copied
+// Returns -1 if the directory is full
+// Returns -2 if the source file's FAT chain is shorter than its size
+// Returns -3 if the source file was not found
+// Returns -4 if the destination file already exists
+// Returns -5 if there is not enough free space on the disk
+// Returns -6 if no scratch buffer is free
+// Returns -7 if the disk could not be read or written
+int copyFile(char *srcFilename, char *srcExt, char *dstFilename, char *dstExt)
+{
+    padName(srcFilename, 8);
+    padName(srcExt, 3);
+    padName(dstFilename, 8);
+    padName(dstExt, 3);
+
+    directory_entry_t *source = findEntry(srcFilename, srcExt);
+    if(source == 0) return -3;
+
+    if(findEntry(dstFilename, dstExt) != 0) return -4;
+
+    // Find an empty directory entry for the copy
+    directory_entry_t *destination = (directory_entry_t *)currentDirectory.startingAddress;
+    uint32 maxDirectoryEntryCount = DIRECTORY_ENTRY_COUNT;
+    uint32 index;
+
+    for(index = 0; index < maxDirectoryEntryCount; index++, destination++)
+    {
+        if(destination->filename[0] == 0) break;
+    }
+
+    if(index == maxDirectoryEntryCount) return -1;
+
+    // Every file owns at least one cluster (see createFile())
+    uint32 clusterCount = (source->fileSize + 511) / 512;
+    if(clusterCount == 0) clusterCount = 1;
+
+    // The copy is made from the disk, so make sure it has the source's latest data
+    pagecache_flush(source);
+    pagecache_invalidate(destination);
+
+    // Borrow a scratch buffer big enough for a whole run
+    // (before the chain is allocated, so failing here leaves the FATs alone)
+    uint8 *trackBuffer = blk_buffer_alloc();
+    if(trackBuffer == 0) return -6;
+
+    uint16 firstCluster = allocateChain(clusterCount);
+    if(firstCluster == 0)
+    {
+        blk_buffer_free(trackBuffer);
+        return -5;
+    }
+
+    uint16 srcCluster = source->startingCluster;
+    uint16 dstCluster = firstCluster;
+    uint32 remaining = clusterCount;
+    int error = 0;
+
+    while(remaining > 0 && error == 0)
+    {
+        // The chain ended before the file size said it would
+        if(srcCluster == 0xFFFF || srcCluster < 2)
+        {
+            error = -2;
+            break;
+        }
+
+        // Read the next source run in one transfer, no more than the buffer holds
+        uint32 count = runLength(srcCluster, remaining < BLOCK_BUFFER_SIZE / BLOCK_SIZE ? remaining : BLOCK_BUFFER_SIZE / BLOCK_SIZE);
+        if(blk_read(fsDevice, srcCluster + 31, (void *)trackBuffer, count) != 0)
+        {
+            error = -7;
+            break;
+        }
+
+        // Write it out as however many destination runs it takes
+        uint32 written = 0;
+        while(written < count && error == 0)
+        {
+            uint32 length = runLength(dstCluster, count - written);
+            if(blk_write(fsDevice, dstCluster + 31, (void *)(trackBuffer + (written * 512)), length) != 0) error = -7;
+
+            written += length;
+            dstCluster = skipClusters(dstCluster, length);
+        }
+
+        srcCluster = skipClusters(srcCluster, count);
+        remaining -= count;
+    }
+
+    blk_buffer_free(trackBuffer);
+
+    // Nothing points at the new chain yet, give it back before the FATs are written out
+    if(error != 0)
+    {
+        freeChain(firstCluster);
+        return error;
+    }
+
+    // Fill in the new directory entry, keeping the source's metadata
+    *destination = *source;
+    stringcopy(dstFilename, (char *)destination->filename, 8);
+    stringcopy(dstExt, (char *)destination->ext, 3);
+    destination->startingCluster = firstCluster;
+    fsStats.usedEntries++;
+    bloomAdd(&currentDirectory, dstFilename, dstExt);
+
+    blk_write(fsDevice, 19, (void *)currentDirectory.startingAddress, ROOT_DIRECTORY_SECTORS); // Write the directory to the disk
+    blk_write(fsDevice, 1, (void *)fat0, sizeof(fat_t) / 512); // Write the first FAT to the disk
+    blk_write(fsDevice, 10, (void *)fat1, sizeof(fat_t) / 512); // Write the second FAT to the disk
+
+    return 0;
+}
+
+// Reads one 4 KB page (8 clusters) of a file into memory
+// Bytes past the end of the file are zeroed
+// A page past the end of the file is left zeroed, it is a new page for a file that is growing
+// Returns 0 on success, -1 if the disk could not be read
+int readFilePage(directory_entry_t *directoryEntry, uint32 pageIndex, uint8 *frame)
+{
+    uint32 clustersPerPage = 4096 / 512;
+    uint32 firstCluster = pageIndex * clustersPerPage;
+    uint32 fileClusters = (directoryEntry->fileSize + 511) / 512;
+
+    for(uint32 i = 0; i < 4096; i++)
+    {
+        frame[i] = 0;
+    }
+
+    if(firstCluster >= fileClusters) return 0;
+
+    uint32 count = fileClusters - firstCluster;
+    if(count > clustersPerPage) count = clustersPerPage;
+
+    uint16 cluster = skipClusters(directoryEntry->startingCluster, firstCluster);
+
+    // Read the clusters of this page in as few transfers as possible
+    for(uint32 i = 0; i < count && cluster != 0xFFFF; )
+    {
+        uint32 length = runLength(cluster, count - i);
+        if(blk_read(fsDevice, cluster + 31, (void *)(frame + (i * 512)), length) != 0) return -1;
+
+        i += length;
+        cluster = skipClusters(cluster, length);
+    }
+
+    // Clear the slack at the end of the last cluster
+    uint32 end = directoryEntry->fileSize - (firstCluster * 512);
+    for(uint32 i = end; i < 4096; i++)
+    {
+        frame[i] = 0;
+    }
+
+    return 0;
+}
+
+// Writes one 4 KB page (8 clusters) of a file back to the disk
+// Only the part of the page inside the file is written, a page never makes the file bigger
+// The file may have grown past its chain while it is open, then the chain is extended first
+// Returns 0 on success, -1 if the page is past the end of the file (there is nothing to write)
+// Returns -2 if part of the page could not be written (the disk is full), the page still has to be written later
+int writeFilePage(directory_entry_t *directoryEntry, uint32 pageIndex, uint8 *frame)
+{
+    uint32 clustersPerPage = 4096 / 512;
+    uint32 firstCluster = pageIndex * clustersPerPage;
+    uint32 fileClusters = (directoryEntry->fileSize + 511) / 512;
+
+    if(firstCluster >= fileClusters) return -1;
+
+    uint32 count = fileClusters - firstCluster;
+    if(count > clustersPerPage) count = clustersPerPage;
+
+    if(extendChain(directoryEntry, firstCluster + count) < firstCluster + count) return -2;
+
+    uint16 cluster = skipClusters(directoryEntry->startingCluster, firstCluster);
+
+    for(uint32 i = 0; i < count; )
+    {
+        uint32 length = runLength(cluster, count - i);
+        if(blk_write(fsDevice, cluster + 31, (void *)(frame + (i * 512)), length) != 0) return -2;
+
+        i += length;
+        cluster = skipClusters(cluster, length);
+    }
+
+    return 0;
+}
+
+// How many block requests prefetchFile() queues before it waits for them
+// A page needs one request for each run of contiguous clusters in it, so at least 8 are needed
+#define PREFETCH_REQUESTS 32
+
+block_request_t prefetchRequests[PREFETCH_REQUESTS];
+uint32 prefetchPages[PREFETCH_REQUESTS];
+
+// Reads the whole opened file into the page cache
+// Every page that is not cached yet is queued as block requests (one per run of contiguous clusters in the page)
+// and the disk gets them in batches, so its driver sees one long read (the floppy streams it a track at a time)
+// Meant to be called before reading through the whole file (like fileproc's 'r' command)
+int prefetchFile()
+{
+    if(!currentFile.isOpened)
+    {
+        printf("Error: File was not opened!\n");
+        return -1;
+    }
+
+    directory_entry_t *directoryEntry = currentFile.directoryEntry;
+    uint32 fileClusters = (directoryEntry->fileSize + 511) / 512;
+    uint32 pageCount = (fileClusters + 7) / 8;
+    uint16 cluster = directoryEntry->startingCluster;
+    uint32 pageIndex = 0;
+    int error = 0;
+
+    while(pageIndex < pageCount)
+    {
+        uint32 requestCount = 0;
+        uint32 pageTotal = 0;
+        uint8 *lastFrame = 0;
+
+        // Queue pages until a page might not fit in the requests that are left
+        for(; pageIndex < pageCount && requestCount + 8 <= PREFETCH_REQUESTS; pageIndex++)
+        {
+            uint32 count = fileClusters - (pageIndex * 8);
+            if(count > 8) count = 8;
+
+            uint8 *frame = pagecache_install(directoryEntry, pageIndex);
+            if(frame == 0)
+            {
+                cluster = skipClusters(cluster, count);
+                continue;
+            }
+
+            // The page must stay where it is until its data has arrived
+            pagecache_pin(directoryEntry, pageIndex);
+            prefetchPages[pageTotal++] = pageIndex;
+
+            for(uint32 i = 0; i < count; )
+            {
+                if(cluster < 2 || cluster >= 2304)
+                {
+                    printf("Error: The file's FAT chain is shorter than its size!\n");
+                    error = 1;
+                    break;
+                }
+
+                uint32 length = runLength(cluster, count - i);
+
+                block_request_t *request = &prefetchRequests[requestCount++];
+                request->lba = cluster + 31;
+                request->count = length;
+                request->buffer = frame + (i * 512);
+                request->write = 0;
+                request->complete = 0;
+
+                if(blk_submit(fsDevice, request) != 0)
+                {
+                    requestCount--;
+                    error = 1;
+                    break;
+                }
+
+                i += length;
+                cluster = skipClusters(cluster, length);
+            }
+
+            if(pageIndex == pageCount - 1) lastFrame = frame;
+
+            if(error) break;
+        }
+
+        for(uint32 i = 0; i < requestCount; i++)
+        {
+            if(blk_wait(&prefetchRequests[i]) != 0) error = 1;
+        }
+
+        // The last cluster was read whole, clear what is past the end of the file
+        if(lastFrame != 0 && !error)
+        {
+            for(uint32 i = directoryEntry->fileSize - ((pageCount - 1) * 4096); i < 4096; i++)
+            {
+                lastFrame[i] = 0;
+            }
+        }
+
+        // Pages that did not arrive are dropped so they get read again when they are used
+        for(uint32 i = 0; i < pageTotal; i++)
+        {
+            pagecache_unpin(directoryEntry, prefetchPages[i]);
+            if(error) pagecache_discard(directoryEntry, prefetchPages[i]);
+        }
+
+        if(error) return -1;
+    }
+
+    return 0;
+}
+
+// Maps the whole opened file into virtual memory (see mmapFile()), "length" is set to the size of the mapping
+// Returns the address of the mapping, or 0 if the file could not be mapped
+void *mapFile(uint32 *length)
+{
+    if(!currentFile.isOpened)
+    {
+        printf("Error: File was not opened!\n");
+        return 0;
+    }
+
+    if(currentFile.directoryEntry->fileSize == 0)
+    {
+        printf("Error: An empty file cannot be mapped!\n");
+        return 0;
+    }
+
+    *length = currentFile.directoryEntry->fileSize;
+    if(*length > MAPPING_WINDOW) *length = MAPPING_WINDOW;
+
+    return mmapFile(&currentFile, 0, *length);
+}
+
+// Read-ahead
+// readByte() tells readAhead() every time a read moves to another page
+// Moving on to the next page doubles the window (up to READAHEAD_MAX_PAGES, 64 clusters or about 3.5 floppy tracks)
+// and the pages inside the window are requested without waiting for them, a jump anywhere else halves the window
+// While a page is on its way it sits in the page cache pinned and marked as loading,
+// whoever needs it first waits for it in waitFilePage()
+// Only pages stored in a single run of clusters are read ahead (one request each), others are read when they are used
+// What it gains depends on the disk the file system is mounted from:
+// - ATA (with DMA) and virtio-blk read in the background, the requests are started right away
+//   and the next pages arrive while the reader works on this one
+// - The floppy's submit() does its transfers before returning, so its requests stay queued until the reader reaches
+//   the first of them and are then streamed in together: nothing overlaps, but a page at a time becomes several tracks at a time
+// - The RAM disk (ram0, where the file system normally is) has no submit(), a page costs the same copy now or later,
+//   so nothing is read ahead
+#define READAHEAD_MAX_PAGES 8
+
+typedef struct
+{
+    block_request_t request;
+    directory_entry_t *directoryEntry;
+    uint32 pageIndex;
+    char inUse;
+
+} readahead_t;
+
+readahead_t readAheads[READAHEAD_MAX_PAGES];
+
+// Hands the pages of finished read-ahead requests over to the page cache
+// Done here rather than in the requests' completion callbacks since those can run in an interrupt
+void reapReadAhead()
+{
+    for(int i = 0; i < READAHEAD_MAX_PAGES; i++)
+    {
+        readahead_t *ahead = &readAheads[i];
+        if(!ahead->inUse || !ahead->request.done) continue;
+
+        pagecache_mark_loading(ahead->directoryEntry, ahead->pageIndex, 0);
+        pagecache_unpin(ahead->directoryEntry, ahead->pageIndex);
+
+        if(ahead->request.status != 0)
+        {
+            // Dropped so it is read again (and the error shows up) when it is used
+            pagecache_discard(ahead->directoryEntry, ahead->pageIndex);
+        }
+        else
+        {
+            // The last cluster was read whole, clear what is past the end of the file
+            for(uint32 j = ahead->directoryEntry->fileSize - (ahead->pageIndex * 4096); j < 4096; j++)
+            {
+                ahead->request.buffer[j] = 0;
+            }
+        }
+
+        ahead->inUse = 0;
+    }
+}
+
+// Requests one page of a file without waiting for it
+// Returns -1 if every read-ahead slot is busy, otherwise 0 (also when the page is cached already or was skipped)
+int startReadAhead(directory_entry_t *directoryEntry, uint32 pageIndex, uint32 fileClusters)
+{
+    readahead_t *ahead = 0;
+    for(int i = 0; i < READAHEAD_MAX_PAGES && ahead == 0; i++)
+    {
+        if(!readAheads[i].inUse) ahead = &readAheads[i];
+    }
+
+    if(ahead == 0) return -1;
+
+    uint32 count = fileClusters - (pageIndex * 8);
+    if(count > 8) count = 8;
+
+    uint16 cluster = skipClusters(directoryEntry->startingCluster, pageIndex * 8);
+    if(cluster < 2 || cluster >= 2304) return 0;
+
+    for(uint32 i = 1; i < count; i++)
+    {
+        if(fat0->clusters[cluster + i - 1] != cluster + i) return 0;
+    }
+
+    uint8 *frame = pagecache_install(directoryEntry, pageIndex);
+    if(frame == 0) return 0;
+
+    pagecache_pin(directoryEntry, pageIndex);
+    pagecache_mark_loading(directoryEntry, pageIndex, 1);
+
+    ahead->request.lba = cluster + 31;
+    ahead->request.count = count;
+    ahead->request.buffer = frame;
+    ahead->request.write = 0;
+    ahead->request.complete = 0;
+    ahead->directoryEntry = directoryEntry;
+    ahead->pageIndex = pageIndex;
+
+    if(blk_submit(fsDevice, &ahead->request) != 0)
+    {
+        pagecache_mark_loading(directoryEntry, pageIndex, 0);
+        pagecache_unpin(directoryEntry, pageIndex);
+        pagecache_discard(directoryEntry, pageIndex);
+        return 0;
+    }
+
+    ahead->inUse = 1;
+    return 0;
+}
+
+// Adjusts the read-ahead window of the opened file after a read moved to "pageIndex"
+// and requests the pages in the window that have not been requested yet
+void readAhead(uint32 pageIndex)
+{
+    directory_entry_t *directoryEntry = currentFile.directoryEntry;
+    uint32 fileClusters = (directoryEntry->fileSize + 511) / 512;
+    uint32 pageCount = (fileClusters + 7) / 8;
+
+    if(fsDevice->submit == 0) return;
+
+    reapReadAhead();
+
+    if(pageIndex == currentFile.lastPageIndex + 1)
+    {
+        currentFile.aheadWindow = currentFile.aheadWindow ? currentFile.aheadWindow * 2 : 1;
+        if(currentFile.aheadWindow > READAHEAD_MAX_PAGES) currentFile.aheadWindow = READAHEAD_MAX_PAGES;
+    }
+    else
+    {
+        // Whatever was requested for the old position is probably not needed soon
+        currentFile.aheadWindow /= 2;
+        currentFile.aheadNext = pageIndex + 1;
+    }
+
+    currentFile.lastPageIndex = pageIndex;
+    if(currentFile.aheadNext <= pageIndex) currentFile.aheadNext = pageIndex + 1;
+
+    while(currentFile.aheadNext <= pageIndex + currentFile.aheadWindow && currentFile.aheadNext < pageCount)
+    {
+        if(startReadAhead(directoryEntry, currentFile.aheadNext, fileClusters) != 0) break;
+        currentFile.aheadNext++;
+    }
+
+    // Devices that read in the background start on the window now instead of when the reader waits for it
+    if(fsDevice->limits.background) blk_unplug(fsDevice);
+}
+
+// Called by the page cache when it is asked for a page that is still being read ahead
+void waitFilePage(directory_entry_t *directoryEntry, uint32 pageIndex)
+{
+    for(int i = 0; i < READAHEAD_MAX_PAGES; i++)
+    {
+        readahead_t *ahead = &readAheads[i];
+
+        if(ahead->inUse && ahead->directoryEntry == directoryEntry && ahead->pageIndex == pageIndex)
+        {
+            blk_wait(&ahead->request);
+        }
+    }
+
+    reapReadAhead();
+}
+
+// Waits for every read-ahead request, so no page is still being filled when a file's pages are dropped
+void drainReadAhead()
+{
+    for(int i = 0; i < READAHEAD_MAX_PAGES; i++)
+    {
+        if(readAheads[i].inUse) blk_wait(&readAheads[i].request);
+    }
+
+    reapReadAhead();
+}
+
+// Writes everything that was changed (cached file pages, and whatever the disk itself keeps in memory) out to the disk
+// Returns 0 on success
+int syncFs()
+{
+    int error = pagecache_sync();
+
+    // Writing pages back may have extended the chain of a file that is still open
+    if(blk_write(fsDevice, 1, (void *)fat0, sizeof(fat_t) / 512) != 0) error = -1; // Write the first FAT to the disk
+    if(blk_write(fsDevice, 10, (void *)fat1, sizeof(fat_t) / 512) != 0) error = -1; // Write the second FAT to the disk
+
+    if(blk_flush(fsDevice) != 0) error = -1;
+    return error;
 }
\ No newline at end of file
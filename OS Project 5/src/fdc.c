@@ -2,6 +2,9 @@
 #include "./io.h"
 #include "./dma.h"
 #include "./irq.h"
+#include "./fdc.h"
+#include "./blkdev.h"
+#include "./timer.h"
 // standard IRQ number for floppy controllers
 static const int floppy_irq = 6;
 
@@ -100,6 +103,29 @@ enum FLOPPYSpeeds{
  */
 
 
+/*
+ * Media geometry
+ *
+ * Every drive reads and writes with the geometry of the disk that is in it. 2.88 MB disks have
+ * 36 sectors per track, are read at 1 Mbps and are written in perpendicular mode, so a revolution
+ * (and a seek) moves twice the data of a 1.44 MB disk. Only drives the CMOS reports as 2.88 MB are
+ * checked for such a disk (see floppy_detect_media()), everything else is 1.44 MB.
+ */
+#define MAX_SECTORS_PER_TRACK 36
+
+typedef struct {
+    uint8 sectorsPerTrack;
+    uint8 dataRate;         // written to the CCR
+    uint8 formatGap;        // GAP3 between sectors when formatting
+    uint8 perpendicular;
+} floppy_geometry_t;
+
+floppy_geometry_t floppy_hd = { 18, KB500, 0x6C, 0 };
+floppy_geometry_t floppy_ed = { 36, MB1, 0x54, 1 };
+
+floppy_geometry_t *floppyGeometry[4] = { &floppy_hd, &floppy_hd, &floppy_hd, &floppy_hd };
+
+
 /*
  * Floppy Util
  */
@@ -109,23 +135,24 @@ enum FLOPPYSpeeds{
 
 
 void lba_2_chs_f(int sectors_per_track, uint32 lba, uint16* cyl, uint16* head, uint16* sector);
-void lba_2_chs(uint32 lba, uint16* cyl, uint16* head, uint16* sector);
+void lba_2_chs(int drive, uint32 lba, uint16* cyl, uint16* head, uint16* sector);
 void floppy_detect_drives();
 uint8 get_drive_type();
+uint8 floppy_drive_type(int drive);
 void floppy_write_cmd(char cmd);
 unsigned char floppy_read_data();
 
 void lba_2_chs_f(int sectors_per_track, uint32 lba, uint16* cyl, uint16* head, uint16* sector)
 {
     *cyl    = lba / (2 * sectors_per_track);
-    *head   = ((lba % (2 * sectors_per_track)) / 18);
+    *head   = ((lba % (2 * sectors_per_track)) / sectors_per_track);
     *sector = ((lba % (2 * sectors_per_track)) % sectors_per_track + 1);
 
 }
 
-void lba_2_chs(uint32 lba, uint16* cyl, uint16* head, uint16* sector)
+void lba_2_chs(int drive, uint32 lba, uint16* cyl, uint16* head, uint16* sector)
 {
-    lba_2_chs_f(18, lba, cyl, head, sector);
+    lba_2_chs_f(floppyGeometry[drive]->sectorsPerTrack, lba, cyl, head, sector);
 }
 
 
@@ -160,48 +187,104 @@ uint8 get_drive_type(){
 
 }
 
+/*
+ * Returns the CMOS type (an index into drive_types) of drive 0 or 1, 0 for any other drive
+ */
+uint8 floppy_drive_type(int drive){
+    outb(0x70, 0x10);
+    uint8 drives = inb(0x71);
+
+    if(drive == 0){
+        return drives >> 4;
+    }
+    if(drive == 1){
+        return drives & 0xf;
+    }
+    return 0;
+}
+
+/*
+ * Timeouts, in milliseconds
+ * FIFO:    a working controller takes or hands over a command/result byte within microseconds
+ * COMMAND: a READ DATA/WRITE DATA/FORMAT TRACK covers at most a cylinder, so a seek, a head load and a couple of revolutions
+ * SEEK:    stepping across the whole disk at the slowest step rate, with room to spare
+ */
+#define FLOPPY_FIFO_TIMEOUT 100
+#define FLOPPY_COMMAND_TIMEOUT 3000
+#define FLOPPY_SEEK_TIMEOUT 2000
+
+// how long to poll before the CPU is halted between polls, in microseconds
+#define FLOPPY_SPIN_US 50
+
+/*
+ * Waits until the controller wants a byte written or read (RQM) for up to "ms" milliseconds
+ * the first FLOPPY_SPIN_US are polled flat out, after that the CPU is halted between polls (see timer_idle())
+ * returns 0 if RQM is set, -1 on a timeout
+ */
+int floppy_wait_rqm(uint32 ms){
+    deadline_t spin = deadline_us(FLOPPY_SPIN_US);
+    deadline_t deadline = deadline_ms(ms);
+
+    while(!(inb(FLOPPY_MAIN_STATUS_REGISTER) & 0x80)){
+        if(deadline_passed(deadline)){
+            return -1;
+        }
+        if(deadline_passed(spin)){
+            timer_idle();
+        }
+    }
+    return 0;
+}
+
 /*
  * https://wiki.osdev.org/Floppy_Disk_Controller#The_Proper_Way_to_issue_a_command
  */
 void floppy_write_cmd(char cmd) {
-    int i; // do timeout, 60 seconds
-    for(i = 0; i < 600; i++) {
-        //sleep(1); // sleep 10 ms
-        if(0x80 & inb(FLOPPY_MAIN_STATUS_REGISTER)) {
-            return (void) outb(FLOPPY_DATA_FIFO, cmd);
-        }
+    if(floppy_wait_rqm(FLOPPY_FIFO_TIMEOUT) != 0){
+        printf("Error: The floppy controller did not take a command!");
+        return;
     }
-    //printError("floppy_write_cmd: timeout");
+    outb(FLOPPY_DATA_FIFO, cmd);
 }
 
 /*
  * https://wiki.osdev.org/Floppy_Disk_Controller#The_Proper_Way_to_issue_a_command
  */
 unsigned char floppy_read_data() {
-
-    int i; // do timeout, 60 seconds
-    for(i = 0; i < 600; i++) {
-        //sleep(1); // sleep 10 ms
-        if(0x80 & inb(FLOPPY_MAIN_STATUS_REGISTER)) {
-            return inb(FLOPPY_DATA_FIFO);
-        }
+    if(floppy_wait_rqm(FLOPPY_FIFO_TIMEOUT) != 0){
+        printf("Error: The floppy controller did not answer!");
+        return 0;
     }
-    //printError("floppy_read_data: timeout");
-    return 0; // not reached
+    return inb(FLOPPY_DATA_FIFO);
 }
 
 
 // Floppy Command Definitions
 
 void floppy_configure(int implied_seek, int FIFO, int drive_polling_mode, int threshold);
+void floppy_perpendicular();
+int floppy_read_id(int drive);
+void floppy_detect_media(int drive);
 void floppy_lock();
 void floppy_reset(int firstTime);
 void floppy_recalibrate(uint8  drive);
+int floppy_seek(int drive, int cyl, int head);
 void floppy_sense_interrupt(uint8 *st0, uint8 *cyl);
-void specify();
+void specify(int drive);
 void drive_select(int drive);
+void floppy_tuning_init();
+void floppy_tune(int drive, int failed);
+void floppy_account(int drive, int cyl, int write, int failed, uint8 st0, uint8 st2);
+void floppy_account_seek(int drive, int cyl, int failed);
+void floppy_seek_start(int drive, int cyl, int head);
+void floppy_seek_finish(int drive);
 void floppy_rw_command(int drive, int head, int cyl, int sect, int EOT, uint8 *st0, uint8 *st1, uint8 *st2,
                        int *headResult, int *cylResult, int *sectResult, int command);
+int floppy_read_dma(int drive, uint32 lba, void* address, uint16 count);
+int floppy_write_dma(int drive, uint32 lba, void* address, uint16 count);
+int floppy_transfer(int drive, uint32 lba, uint8* address, uint32 count, int write);
+int floppy_write_verified(int drive, uint32 lba, uint8* address, uint32 count);
+void floppy_issue_rw(int drive, int head, int cyl, int sect, int EOT, int command, int MT);
 
 
 // Floppy Commands
@@ -217,6 +300,7 @@ int floppy_init(){
     floppy_configure(1, 1, 0, 8);
     floppy_lock();
     floppy_reset(1);
+    floppy_perpendicular();
 
     // floppy_recalibrate all drives
     for(int i = 0; i < 4; i++){
@@ -226,33 +310,244 @@ int floppy_init(){
     return 0;
 }
 
+/*
+ * Overlapped seeks
+ *
+ * floppy_seek_start() sends a SEEK and returns straight away, the drive steps on its own while the
+ * controller is used for another drive. The seek is finished (its interrupt sensed) by the next
+ * drive_select() of that drive, and its motor is left running until then.
+ */
+volatile int seekPending[4];
+int seekTarget[4];
+
+int floppyTuningReady = 0;
+
 /*
  * https://wiki.osdev.org/Floppy_Disk_Controller#Drive_Selection
  */
 void drive_select(int drive){
-    outb(FLOPPY_CONFIGURATION_CONTROL_REGISTER, 0); // This is usually correct, even tho it changes if not using 1.44Mb drive.
-    specify();
+    // the timings are set up before the first drive is used, whether the controller was set up by floppy_init() or by the BIOS
+    if(!floppyTuningReady){
+        floppy_tuning_init();
+        floppyTuningReady = 1;
+    }
+
+    if(seekPending[drive]){
+        floppy_seek_finish(drive);
+    }
+
+    outb(FLOPPY_CONFIGURATION_CONTROL_REGISTER, floppyGeometry[drive]->dataRate);
+    specify(drive);
 
     // Select drive in DOR and turn on its motor
+    // the other motors are left running, a striped volume (see volume.c) goes back and forth between
+    // the drives and would wait for a drive to spin up again every time
     uint8 DOR = inb(FLOPPY_DIGITAL_OUTPUT_REGISTER);
-    // turn off all motors | select drive | turn on drive's motor
-    DOR = (DOR & 0xC) | (drive | (1 << (4 + drive)));
+    // keep motors and NRST/DMA | select drive | turn on drive's motor
+    DOR = (DOR & 0xFC) | (drive | (1 << (4 + drive)));
     outb(FLOPPY_DIGITAL_OUTPUT_REGISTER, DOR);
 }
 
+/*
+ * Drive timings
+ *
+ * The step rate, head load and head unload times sent with SPECIFY are picked per drive from the
+ * levels below. A drive starts on the values this driver always used (level 3) and after every
+ * TUNE_WINDOW operations without an error it moves one level faster. TUNE_MAX_ERRORS errors within
+ * a window move it one level slower straight away, and it never tries the failing level again.
+ *
+ * A wrong cylinder after a seek points at the step rate, a sector that was found but did not read
+ * back right points at the head not having settled, the counts are kept apart (see floppy_get_stats()).
+ *
+ * The head unload time stays at its longest at every level, an unloaded head has to settle again.
+ */
+#define TIMING_LEVELS 6
+#define TIMING_START 3
+#define TUNE_WINDOW 32
+#define TUNE_MAX_ERRORS 2
+
+typedef struct {
+    uint8 stepRate;     // ms per cylinder
+    uint8 headLoad;     // ms
+    uint16 headUnload;  // ms
+} floppy_timing_t;
+
+// Fastest first, every level is within what a 3.5" drive is rated for
+floppy_timing_t floppy_timings[TIMING_LEVELS] = {
+    {  3,  4, 256 },
+    {  4,  8, 256 },
+    {  6, 10, 256 },
+    {  8, 10, 256 },
+    { 12, 16, 256 },
+    { 15, 30, 256 }
+};
+
+typedef struct {
+    floppy_stats_t stats;
+    uint32 windowOps;
+    uint32 windowErrors;
+    uint32 minLevel;    // the fastest level that has not failed yet
+    int cylinder;       // where the heads are, -1 if unknown
+} floppy_tuning_t;
+
+floppy_tuning_t floppyTuning[4];
+
+void floppy_set_level(int drive, uint32 level){
+    floppy_stats_t *stats = &floppyTuning[drive].stats;
+
+    stats->level = level;
+    stats->stepRate = floppy_timings[level].stepRate;
+    stats->headLoad = floppy_timings[level].headLoad;
+    stats->headUnload = floppy_timings[level].headUnload;
+}
+
+void floppy_tuning_init(){
+    for(int drive = 0; drive < 4; drive++){
+        floppy_tuning_t *tuning = &floppyTuning[drive];
+
+        tuning->stats.seeks = 0;
+        tuning->stats.seekErrors = 0;
+        tuning->stats.reads = 0;
+        tuning->stats.readErrors = 0;
+        tuning->stats.writes = 0;
+        tuning->stats.writeErrors = 0;
+        tuning->stats.verifies = 0;
+        tuning->stats.verifyErrors = 0;
+        tuning->windowOps = 0;
+        tuning->windowErrors = 0;
+        tuning->minLevel = 0;
+        tuning->cylinder = -1;
+        floppy_set_level(drive, TIMING_START);
+    }
+}
+
+/*
+ * Moves a drive between timing levels, called after every operation
+ * the new timings are sent by the next drive_select()
+ */
+void floppy_tune(int drive, int failed){
+    floppy_tuning_t *tuning = &floppyTuning[drive];
+
+    tuning->windowOps++;
+    if(failed){
+        tuning->windowErrors++;
+    }
+
+    if(tuning->windowErrors >= TUNE_MAX_ERRORS){
+        uint32 level = tuning->stats.level;
+        if(level + 1 < TIMING_LEVELS){
+            level++;
+        }
+
+        tuning->minLevel = level;
+        floppy_set_level(drive, level);
+    } else if(tuning->windowOps >= TUNE_WINDOW){
+        if(tuning->windowErrors == 0 && tuning->stats.level > tuning->minLevel){
+            floppy_set_level(drive, tuning->stats.level - 1);
+        }
+    } else {
+        return;
+    }
+
+    tuning->windowOps = 0;
+    tuning->windowErrors = 0;
+}
+
+/*
+ * Counts one READ DATA/WRITE DATA to cylinder "cyl", the implied seek is counted when the heads had to move
+ */
+void floppy_account(int drive, int cyl, int write, int failed, uint8 st0, uint8 st2){
+    floppy_tuning_t *tuning = &floppyTuning[drive];
+
+    // wrong cylinder, bad cylinder, or the drive gave up stepping
+    int seekFailed = failed && ((st2 & 0x12) || (st0 & 0x10));
+
+    if(cyl != tuning->cylinder || seekFailed){
+        tuning->stats.seeks++;
+        if(seekFailed){
+            tuning->stats.seekErrors++;
+        }
+    }
+    tuning->cylinder = seekFailed ? -1 : cyl;
+
+    if(write){
+        tuning->stats.writes++;
+        if(failed && !seekFailed){
+            tuning->stats.writeErrors++;
+        }
+    } else {
+        tuning->stats.reads++;
+        if(failed && !seekFailed){
+            tuning->stats.readErrors++;
+        }
+    }
+
+    floppy_tune(drive, failed);
+}
+
+/*
+ * Counts a SEEK or RECALIBRATE
+ */
+void floppy_account_seek(int drive, int cyl, int failed){
+    floppy_tuning_t *tuning = &floppyTuning[drive];
+
+    tuning->stats.seeks++;
+    if(failed){
+        tuning->stats.seekErrors++;
+    }
+    tuning->cylinder = failed ? -1 : cyl;
+
+    floppy_tune(drive, failed);
+}
+
+/*
+ * Copies a drive's counters and current timings into "stats"
+ * returns -1 if there is no such drive
+ */
+int floppy_get_stats(int drive, floppy_stats_t *stats){
+    if(drive < 0 || drive > 3){
+        return -1;
+    }
+
+    *stats = floppyTuning[drive].stats;
+    return 0;
+}
+
 /*
  * https://wiki.osdev.org/Floppy_Disk_Controller#Specify
+ *
+ * The controller keeps one set of timings for all drives, so SPECIFY is only sent when the bytes
+ * change (another drive or data rate, a new timing level) or after a reset cleared them
  */
-void specify(){
-    /*
-     * According to the OsDev wiki, these values should change according
-     * to failed operation statistics for performance.
-     * but, because no1 uses floppies, performance isn't that important
-     * so, we'll just use very safe values
-     */
-    int SRT = 8;
-    int HLT = 5;
-    int HUT = 0;
+int specified = -1;
+
+void specify(int drive){
+    floppy_stats_t *stats = &floppyTuning[drive].stats;
+
+    // at 500 Kbps the step rate is 16 - SRT ms, the head load time HLT * 2 ms and the head unload time HUT * 16 ms (0 is the longest)
+    // at 1 Mbps every unit is half as long, so the same times take twice the units (and are cut off at the longest the field holds)
+    int scale = floppyGeometry[drive]->dataRate == MB1 ? 2 : 1;
+
+    int SRT = 16 - (stats->stepRate * scale);
+    if(SRT < 0){
+        SRT = 0;
+    }
+
+    int HLT = (stats->headLoad * scale) / 2;
+    if(HLT > 127){
+        HLT = 127;
+    }
+
+    int HUT = (stats->headUnload * scale) / 16;
+    if(HUT > 15){
+        HUT = 0;
+    }
+
+    int bytes = (SRT << 4 | HUT) << 8 | (HLT << 1 | 0);
+    if(bytes == specified){
+        return;
+    }
+    specified = bytes;
 
     floppy_write_cmd(FLOPPY_SPECIFY);
     floppy_write_cmd(SRT << 4 | HUT);
@@ -272,11 +567,78 @@ void floppy_configure(int implied_seek, int FIFO, int drive_polling_mode, int th
 
 }
 
+/*
+ * https://wiki.osdev.org/Floppy_Disk_Controller#Perpendicular_Mode
+ * turns perpendicular recording on for every drive holding a 2.88 MB disk (OW set, one D bit per drive)
+ */
+void floppy_perpendicular(){
+    uint8 drives = 0;
+    for(int drive = 0; drive < 4; drive++){
+        if(floppyGeometry[drive]->perpendicular){
+            drives |= 1 << (2 + drive);
+        }
+    }
+
+    floppy_write_cmd(FLOPPY_PERPENDICULAR_MODE);
+    floppy_write_cmd(0x80 | drives);
+}
+
+/*
+ * https://wiki.osdev.org/Floppy_Disk_Controller#Read_ID
+ * returns 0 if a sector ID could be read at the drive's current data rate
+ */
+int floppy_read_id(int drive){
+    drive_select(drive);
+
+    int MFM = 0x40;
+    floppy_write_cmd(MFM | FLOPPY_READ_ID);
+    floppy_write_cmd(drive);
+
+    // without a readable disk the controller gives up after two index pulses
+    if(floppy_wait_rqm(FLOPPY_COMMAND_TIMEOUT) != 0){
+        floppy_reset(0);
+        return -1;
+    }
+
+    uint8 st0 = floppy_read_data();
+    for(int i = 0; i < 6; i++){
+        floppy_read_data();
+    }
+
+    return (st0 >> 6) == 0 ? 0 : -1;
+}
+
+/*
+ * Picks the geometry of the disk in "drive"
+ * a 2.88 MB drive is tried at 1 Mbps first (a few times, the motor may still be spinning up),
+ * if no sector ID shows up at that rate the disk is taken to be a 1.44 MB one
+ */
+#define DETECT_TRIES 5
+
+void floppy_detect_media(int drive){
+    floppyGeometry[drive] = &floppy_hd;
+
+    if(floppy_drive_type(drive) == 5){
+        floppyGeometry[drive] = &floppy_ed;
+        floppy_perpendicular();
+
+        for(int i = 0; i < DETECT_TRIES; i++){
+            if(floppy_read_id(drive) == 0){
+                return;
+            }
+        }
+
+        floppyGeometry[drive] = &floppy_hd;
+        floppy_perpendicular();
+    }
+}
+
 /*
  * https://wiki.osdev.org/Floppy_Disk_Controller#Lock
  */
 void floppy_lock(){
-    floppy_write_cmd(FLOPPY_LOCK);
+    // bit 7 set locks, without it the command unlocks (and the next reset throws the CONFIGURE away)
+    floppy_write_cmd(0x80 | FLOPPY_LOCK);
     floppy_read_data();
 }
 
@@ -284,18 +646,103 @@ void floppy_lock(){
  * https://wiki.osdev.org/Floppy_Disk_Controller#Recalibrate
  */
 void floppy_recalibrate(uint8 drive){
-    floppy_write_cmd(FLOPPY_RECALIBRATE);
-    floppy_write_cmd(drive);
+    // some controllers stop after 77 steps, so it can take more than one try to get back from cylinder 79
+    for(int tries = 0; tries < 3; tries++){
+        irq_clear(floppy_irq);
+        floppy_write_cmd(FLOPPY_RECALIBRATE);
+        floppy_write_cmd(drive);
+
+        uint8 st0 = 0;
+        uint8 cyl = 0;
+        if(irq_wait_timeout(floppy_irq, FLOPPY_SEEK_TIMEOUT) == 0){
+            floppy_sense_interrupt(&st0, &cyl);
+        }
+
+        // a recalibrate is a seek to cylinder 0, "seek end" is only set if it got there
+        floppy_account_seek(drive & 3, 0, !(st0 & 0x20));
+
+        if(st0 & 0x20)
+            return;
+    }
+}
+
+/*
+ * https://wiki.osdev.org/Floppy_Disk_Controller#Seek
+ * READ DATA/WRITE DATA seek by themselves (implied seek), this is only needed for FORMAT TRACK
+ * returns 0 if the heads got to "cyl"
+ */
+int floppy_seek(int drive, int cyl, int head){
+    // the interrupt of the last READ/WRITE/FORMAT (whose result was polled for) must not be taken for this one
+    irq_clear(floppy_irq);
+    floppy_write_cmd(FLOPPY_SEEK);
+    floppy_write_cmd((head << 2) | drive);
+    floppy_write_cmd(cyl);
 
-    irq_wait(floppy_irq);
     uint8 st0 = 0;
-    uint8 cyl = 0;
-    floppy_sense_interrupt(&st0, &cyl);
+    uint8 cylOut = 0;
+    if(irq_wait_timeout(floppy_irq, FLOPPY_SEEK_TIMEOUT) == 0){
+        floppy_sense_interrupt(&st0, &cylOut);
+    }
+
+    int failed = !(st0 & 0x20) || cylOut != cyl;
+    floppy_account_seek(drive, cyl, failed);
+
+    if(failed){
+        printf("Error seeking floppy!");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Starts a SEEK without waiting for it (see "Overlapped seeks")
+ */
+void floppy_seek_start(int drive, int cyl, int head){
+    if(seekPending[drive]){
+        return;
+    }
+
+    uint8 DOR = inb(FLOPPY_DIGITAL_OUTPUT_REGISTER);
+    outb(FLOPPY_DIGITAL_OUTPUT_REGISTER, DOR | (1 << (4 + drive)));
 
-    if(!(st0 & 0x20))
-        floppy_recalibrate(drive);
+    floppy_write_cmd(FLOPPY_SEEK);
+    floppy_write_cmd((head << 2) | drive);
+    floppy_write_cmd(cyl);
+
+    seekTarget[drive] = cyl;
+    seekPending[drive] = 1;
 }
 
+/*
+ * Waits for a seek started by floppy_seek_start()
+ * SENSE INTERRUPT answers "invalid command" (0x80) until a seek has ended, and reports one drive at a time
+ */
+void floppy_seek_finish(int drive){
+    deadline_t deadline = deadline_ms(FLOPPY_SEEK_TIMEOUT);
+
+    while(seekPending[drive] && !deadline_passed(deadline)){
+        uint8 st0 = 0;
+        uint8 cyl = 0;
+        floppy_sense_interrupt(&st0, &cyl);
+
+        if(st0 == 0x80){
+            timer_idle();
+            continue;
+        }
+
+        int done = st0 & 3;
+        if(seekPending[done]){
+            seekPending[done] = 0;
+            floppy_account_seek(done, seekTarget[done], !(st0 & 0x20) || cyl != seekTarget[done]);
+        }
+    }
+
+    // the interrupt was never seen, the next implied seek puts the heads right
+    if(seekPending[drive]){
+        seekPending[drive] = 0;
+        floppyTuning[drive].cylinder = -1;
+    }
+}
 
 /*
  * https://wiki.osdev.org/Floppy_Disk_Controller#Sense_Interrupt
@@ -303,15 +750,9 @@ void floppy_recalibrate(uint8 drive){
 void floppy_sense_interrupt(uint8 *st0, uint8 *cyl){
     floppy_write_cmd(FLOPPY_SENSE_INTERRUPT);
 
-    uint8 RQM;
-    while(1){
-        RQM = inb(FLOPPY_MAIN_STATUS_REGISTER) & 0x80;
-        if(RQM)
-            break;
-    }
-
+    // with no interrupt to report there is a single "invalid command" byte
     *st0 = floppy_read_data();
-    *cyl = floppy_read_data();
+    *cyl = *st0 == 0x80 ? 0 : floppy_read_data();
 
 }
 
@@ -320,32 +761,244 @@ void floppy_sense_interrupt(uint8 *st0, uint8 *cyl){
  */
 void floppy_reset(int firstTime){
     uint8 DOR = inb(FLOPPY_DIGITAL_OUTPUT_REGISTER);
+    specified = -1;
+    irq_clear(floppy_irq);
     outb(FLOPPY_DIGITAL_OUTPUT_REGISTER, 0);
-    //sleep(10);
-    outb(FLOPPY_DIGITAL_OUTPUT_REGISTER, DOR & 0x8);
+    udelay(10); // the reset has to be held for at least 4 microseconds
+    // NRST has to be set again to leave the reset, the selected drive and its motor are kept
+    outb(FLOPPY_DIGITAL_OUTPUT_REGISTER, DOR | 0xC);
     if(!firstTime){ // check if IRQs were enabled
-        irq_wait(floppy_irq);
+        irq_wait_timeout(floppy_irq, FLOPPY_COMMAND_TIMEOUT);
     }
 }
 
 
 
 /*
- * https://wiki.osdev.org/Floppy_Disk_Controller#Read.2FWrite
+ * floppy_read()/floppy_write() accept any buffer
+ * the transfer is split so each piece can be handed to the DMA controller:
+ * - pieces that are below 16 MB and inside one 64 KB page go straight to/from the caller's buffer
+ * - anything else (a sector straddling a 64 KB boundary, memory above 16 MB, mapped files)
+ *   goes through a bounce buffer from the DMA pool
  */
+int floppy_read(int drive, uint32 lba, void* address, uint16 count){
+    return floppy_transfer(drive, lba, (uint8 *) address, count, 0);
+}
 
 int floppy_write(int drive, uint32 lba, void* address, uint16 count){
+    return floppy_transfer(drive, lba, (uint8 *) address, count, 1);
+}
+
+int floppy_transfer(int drive, uint32 lba, uint8* address, uint32 count, int write){
+    while(count > 0){
+        uint32 chunk = count;
+        uint32 toBoundary = 0x10000 - ((uint32) address & 0xFFFF);
+        uint8 *bounce = 0;
+
+        if(!dma_is_safe((uint32) address, chunk)){
+            if(dma_is_safe((uint32) address, toBoundary) && toBoundary >= 512){
+                // zero-copy up to the last whole sector before the 64 KB boundary
+                chunk = toBoundary & ~511;
+            } else {
+                bounce = dma_buffer_alloc();
+                if(!bounce){
+                    printf("Error: No DMA bounce buffer free!");
+                    return -3;
+                }
+                if(chunk > DMA_BUFFER_SIZE){
+                    chunk = DMA_BUFFER_SIZE;
+                }
+            }
+        }
+
+        int error;
+        if(bounce){
+            if(write){
+                for(uint32 i = 0; i < chunk; i++){
+                    bounce[i] = address[i];
+                }
+                error = floppy_write_verified(drive, lba, bounce, chunk);
+            } else {
+                error = floppy_read_dma(drive, lba, bounce, chunk);
+                for(uint32 i = 0; i < chunk; i++){
+                    address[i] = bounce[i];
+                }
+            }
+            dma_buffer_free(bounce);
+        } else {
+            if(write){
+                error = floppy_write_verified(drive, lba, address, chunk);
+            } else {
+                error = floppy_read_dma(drive, lba, address, chunk);
+            }
+        }
+
+        if(error){
+            return error;
+        }
+
+        address += chunk;
+        lba += chunk / 512;
+        count -= chunk;
+    }
+
+    return 0;
+}
+
+/*
+ * Verified writes
+ *
+ * Reading every written sector back would move all the data over DMA a second time. The VERIFY
+ * command instead has the controller read the sectors and check their CRCs on its own, nothing
+ * is transferred. It costs the extra revolution a read would, but no memory or DMA bandwidth.
+ *
+ * VERIFY is sent once per track with EOT set to the last sector written there (and without
+ * multi-track), so the controller stops right after it and reports a normal termination.
+ * When a sector fails, the result bytes say which one, only that sector is written again and
+ * the verify carries on from there.
+ */
+#define VERIFY_RETRIES 3
+
+char floppyVerify[4];
+
+void floppy_set_verify(int drive, int on){
+    if(drive >= 0 && drive < 4){
+        floppyVerify[drive] = on != 0;
+    }
+}
+
+int floppy_get_verify(int drive){
+    return drive >= 0 && drive < 4 && floppyVerify[drive];
+}
+
+/*
+ * Checks "count" sectors starting at "lba", all on one track
+ * returns 0 if every CRC was good, 1 if a sector is bad (its lba goes into "bad"), or -1 if the controller gave up
+ */
+int floppy_verify_track(int drive, uint32 lba, uint32 count, uint32 *bad){
+    uint16 cyl;
+    uint16 head;
+    uint16 sector;
+    lba_2_chs(drive, lba, &cyl, &head, &sector);
+
+    int MFM = 0x40;
+    floppy_write_cmd(MFM | FLOPPY_VERIFY);
+    floppy_write_cmd((head << 2) | drive);
+    floppy_write_cmd(cyl);
+    floppy_write_cmd(head);
+    floppy_write_cmd(sector);
+    floppy_write_cmd(2);                    // 512 bytes per sector
+    floppy_write_cmd(sector + count - 1);   // stop after the last sector written
+    floppy_write_cmd(0x1b);
+    floppy_write_cmd(0xff);
+
+    if(floppy_wait_rqm(FLOPPY_COMMAND_TIMEOUT) != 0){
+        printf("Error: The floppy controller timed out!");
+        floppy_reset(0);
+        return -1;
+    }
+
+    uint8 st0 = floppy_read_data();
+    uint8 st1 = floppy_read_data();
+    uint8 st2 = floppy_read_data();
+    floppy_read_data();
+    floppy_read_data();
+    uint8 sectResult = floppy_read_data();
+    floppy_read_data();
+
+    floppyTuning[drive].stats.verifies++;
+    floppyTuning[drive].cylinder = cyl;
+
+    if(st0 >> 6 == 0){
+        return 0;
+    }
+
+    floppyTuning[drive].stats.verifyErrors++;
+
+    // not a bad sector, the heads are on the wrong cylinder or the disk is gone
+    if((st0 & 0x18) || (st2 & 0x12)){
+        floppyTuning[drive].cylinder = -1;
+        return -1;
+    }
+
+    // the controller stops on the sector that failed
+    *bad = lba;
+    if(sectResult >= sector && sectResult < sector + count){
+        *bad = lba + (sectResult - sector);
+    }
+    return (st1 & 0x25) || (st2 & 0x21) ? 1 : -1;
+}
+
+/*
+ * Writes "count" bytes from a DMA-safe buffer, if verified writes are on for the drive every track
+ * written is verified afterwards and bad sectors are written again (at most VERIFY_RETRIES times each)
+ */
+int floppy_write_verified(int drive, uint32 lba, uint8* address, uint32 count){
+    int error = floppy_write_dma(drive, lba, address, count);
+    if(error || !floppyVerify[drive]){
+        return error;
+    }
+
+    uint32 end = lba + count / 512;
+    uint32 sectorsPerTrack = floppyGeometry[drive]->sectorsPerTrack;
+    uint32 next = lba;
+    uint32 failing = end;
+    int retries = 0;
+
+    while(next < end){
+        uint32 sectors = sectorsPerTrack - (next % sectorsPerTrack);
+        if(sectors > end - next){
+            sectors = end - next;
+        }
+
+        uint32 bad;
+        int result = floppy_verify_track(drive, next, sectors, &bad);
+
+        if(result == 0){
+            next += sectors;
+            continue;
+        }
+        if(result < 0){
+            // the controller lost track of the heads, verify the whole track again
+            bad = next;
+        }
+
+        if(bad == failing){
+            retries++;
+        } else {
+            failing = bad;
+            retries = 0;
+        }
+        if(retries == VERIFY_RETRIES){
+            printf("Error: A written floppy sector does not verify!");
+            return -1;
+        }
+
+        error = floppy_write_dma(drive, bad, address + (bad - lba) * 512, 512);
+        if(error){
+            return error;
+        }
+        next = bad;
+    }
+
+    return 0;
+}
+
+/*
+ * https://wiki.osdev.org/Floppy_Disk_Controller#Read.2FWrite
+ */
+
+int floppy_write_dma(int drive, uint32 lba, void* address, uint16 count){
     count--;
-    initFloppyDMA((uint32) address, count);
 
     drive_select(drive);
 
     uint16 cyl;
     uint16 head;
     uint16 sector;
-    lba_2_chs(lba, &cyl, &head, &sector);
+    lba_2_chs(drive, lba, &cyl, &head, &sector);
 
-    int EOT = 19;
+    int EOT = floppyGeometry[drive]->sectorsPerTrack;
 
     uint8 st0;
     uint8 st1;
@@ -357,6 +1010,8 @@ int floppy_write(int drive, uint32 lba, void* address, uint16 count){
 
     for(int i = 0; i < 20; i++){
 
+        // a failed try leaves the DMA address wherever the controller stopped
+        initFloppyDMA((uint32) address, count);
         prepare_for_floppyDMA_write();
 
         floppy_rw_command(drive, head, cyl, sector, EOT, &st0, &st1, &st2, &headOut, &cylOut, &sectOut, FLOPPY_WRITE_DATA);
@@ -377,6 +1032,7 @@ int floppy_write(int drive, uint32 lba, void* address, uint16 count){
         if(st2 & 0x04) {error = 1;}
         if(st2 & 0x02) {error = 1;}
         if(st1 & 0x02) {error = 2;}
+        floppy_account(drive, cyl, 1, error, st0, st2);
         if(!error){
             return 0;
         }
@@ -393,17 +1049,17 @@ int floppy_write(int drive, uint32 lba, void* address, uint16 count){
 
 }
 
-int floppy_read(int drive, uint32 lba, void* address, uint16 count){
-    initFloppyDMA((uint32) address, count);
+int floppy_read_dma(int drive, uint32 lba, void* address, uint16 count){
+    count--;
 
     drive_select(drive);
 
     uint16 cyl;
     uint16 head;
     uint16 sector;
-    lba_2_chs(lba, &cyl, &head, &sector);
+    lba_2_chs(drive, lba, &cyl, &head, &sector);
 
-    int EOT = 19;
+    int EOT = floppyGeometry[drive]->sectorsPerTrack;
 
     uint8 st0;
     uint8 st1;
@@ -415,6 +1071,8 @@ int floppy_read(int drive, uint32 lba, void* address, uint16 count){
 
     for(int i = 0; i < 20; i++){
 
+        // a failed try leaves the DMA address wherever the controller stopped
+        initFloppyDMA((uint32) address, count);
         prepare_for_floppyDMA_read();
 
         floppy_rw_command(drive, head, cyl, sector, EOT, &st0, &st1, &st2, &headOut, &cylOut, &sectOut, FLOPPY_READ_DATA);
@@ -435,6 +1093,7 @@ int floppy_read(int drive, uint32 lba, void* address, uint16 count){
         if(st2 & 0x04) {error = 1;}
         if(st2 & 0x02) {error = 1;}
         if(st1 & 0x02) {error = 2;}
+        floppy_account(drive, cyl, 0, error, st0, st2);
         if(!error){
             return 0;
         }
@@ -453,6 +1112,51 @@ int floppy_read(int drive, uint32 lba, void* address, uint16 count){
 void floppy_rw_command(int drive, int head, int cyl, int sect, int EOT, uint8 *st0, uint8 *st1, uint8 *st2,
                        int *headResult, int *cylResult, int *sectResult, int command) {
     int MT = 0x80; // set to 0x80 to enable multi-track, or 0 to disable
+
+    floppy_issue_rw(drive, head, cyl, sect, EOT, command, MT);
+
+    // the result phase starts when the transfer is done
+    if(floppy_wait_rqm(FLOPPY_COMMAND_TIMEOUT) != 0){
+        printf("Error: The floppy controller timed out!");
+
+        // report an abnormal termination so the caller retries, after a reset the controller takes commands again
+        *st0 = 0xC0;
+        *st1 = 0;
+        *st2 = 0;
+        *cylResult = 0;
+        *headResult = 0;
+        *sectResult = 0;
+        floppy_reset(0);
+        return;
+    }
+
+    // First result byte = st0 status register
+    *st0 = floppy_read_data();
+
+    // Second result byte = st1 status register
+    *st1 = floppy_read_data();
+
+    // Third result byte = st2 status register
+    *st2 = floppy_read_data();
+
+    // Fourth result byte = cylinder number
+    *cylResult = floppy_read_data();
+
+
+    // Fifth result byte = ending head number
+    *headResult = floppy_read_data();
+
+    // Sixth result byte = ending sector number
+    *sectResult = floppy_read_data();
+
+    // Seventh result byte = 2
+    floppy_read_data();
+}
+
+/*
+ * Sends a READ DATA/WRITE DATA command without waiting for it to finish
+ */
+void floppy_issue_rw(int drive, int head, int cyl, int sect, int EOT, int command, int MT) {
     int MFM = 0x40; //set to 0x40 to enable magnetic-encoding-mode, or 0 to disable. According to the wiki this should always be on
 
     // Read command = MT bit | MFM bit | 0x6
@@ -481,37 +1185,555 @@ void floppy_rw_command(int drive, int head, int cyl, int sect, int EOT, uint8 *s
 
     // Eighth parameter byte = 0xff (all floppy drives use 512bytes per sector)
     floppy_write_cmd(0xff);
+}
+
+
+/*
+ * Streaming reads
+ *
+ * A DMA bounce buffer is split into two halves of one track each, and the DMA channel is
+ * programmed once, in auto-init mode, over the whole buffer. Every READ DATA reads one track
+ * (without a TC the controller stops at EOT), the DMA address just keeps going into the other
+ * half, and at TC it reloads the start of the buffer by itself.
+ *
+ * The next READ DATA is issued from the IRQ6 handler as soon as a track completes, as long as
+ * the consumer has released the half it will land in. The controller fills one half while the
+ * consumer works on the other, so a sequential read runs at the speed of the disk.
+ *
+ * No other floppy command may be used while a stream is running.
+ *
+ * A "track" of the stream is always 18 sectors (STREAM_TRACK_SIZE), on a 2.88 MB disk every
+ * real track is read as two of them (sectors 1 - 18 and 19 - 36) so the buffer halves still fit.
+ */
+#define STREAM_SECTORS 18
+
+uint8 *streamBuffer = 0;
+int streamDrive;
+uint32 streamNextTrack;              // the next track to issue a READ DATA for
+uint32 streamEndTrack;               // one past the last track of the stream
+uint32 streamTracksLeft;             // tracks the consumer has not released yet
+int streamFillHalf;                  // the half the next READ DATA fills
+int streamConsumeHalf;               // the half the consumer gets next
+volatile int streamInFlight = 0;     // a READ DATA is running
+volatile int streamHalfFull[2];
+volatile int streamError;
+
+// how many times the IRQ6 handler polls the main status register for each result byte (about a microsecond each)
+#define STREAM_RESULT_POLLS 1000
+
+void floppy_stream_issue(){
+    if(streamInFlight || streamError || streamNextTrack >= streamEndTrack || streamHalfFull[streamFillHalf]){
+        return;
+    }
+
+    // tracks are numbered like LBAs: (cylinder * 2 + head) * pieces + piece
+    uint32 pieces = floppyGeometry[streamDrive]->sectorsPerTrack / STREAM_SECTORS;
+    uint32 track = streamNextTrack / pieces;
+    int first = ((streamNextTrack % pieces) * STREAM_SECTORS) + 1;
+
+    floppy_issue_rw(streamDrive, track % 2, track / 2, first, first + STREAM_SECTORS - 1, FLOPPY_READ_DATA, 0);
+    streamInFlight = 1;
+}
+
+void floppy_stream_irq(regs *r){
+    (void) r;
+
+    if(!streamInFlight){
+        return;
+    }
+
+    // an overlapped seek on the other drive ended, READ DATA is still running (no result bytes waiting)
+    if((inb(FLOPPY_MAIN_STATUS_REGISTER) & 0xD0) != 0xD0){
+        return;
+    }
+
+    // st0, st1, st2, cylinder, head, sector, 2
+    // read from the FIFO right here, floppy_read_data() may halt the CPU while it waits and this is an interrupt handler
+    uint8 result[7];
+    for(int i = 0; i < 7; i++){
+        int polls = 0;
+        while((inb(FLOPPY_MAIN_STATUS_REGISTER) & 0xC0) != 0xC0){
+            if(++polls == STREAM_RESULT_POLLS){
+                // still in flight, so floppy_stream_stop() resets the controller
+                streamError = 1;
+                return;
+            }
+        }
+        result[i] = inb(FLOPPY_DATA_FIFO);
+    }
+
+    uint8 st0 = result[0];
+    uint8 st1 = result[1];
+    uint8 st2 = result[2];
+
+    streamInFlight = 0;
 
-    uint8 RQM;
-    uint8 MSR;
-    while(1){
-        MSR = inb(FLOPPY_MAIN_STATUS_REGISTER);
-        RQM = (MSR & 0x80) > 1;
-        //printf(toString(MSR, 2));
-        //sleep(10);
-        if(RQM)
+    // Reading up to EOT without a TC ends with "abnormal termination" and only the End of Cylinder bit set, that is expected
+    int failed = (st0 >> 6) != 0 && !((st0 >> 6) == 1 && st1 == 0x80);
+    uint32 pieces = floppyGeometry[streamDrive]->sectorsPerTrack / STREAM_SECTORS;
+    floppy_account(streamDrive, streamNextTrack / pieces / 2, 0, failed, st0, st2);
+
+    if(failed){
+        streamError = 1;
+        return;
+    }
+
+    streamHalfFull[streamFillHalf] = 1;
+    streamFillHalf ^= 1;
+    streamNextTrack++;
+
+    floppy_stream_issue();
+}
+
+/*
+ * Starts reading "count" tracks, starting at "track" (lba / 18)
+ * returns 0 if the stream was started
+ */
+int floppy_stream_start(int drive, uint32 track, uint32 count){
+    streamBuffer = dma_buffer_alloc();
+    if(!streamBuffer){
+        printf("Error: No DMA buffer free for streaming!");
+        return -1;
+    }
+
+    streamDrive = drive;
+    streamNextTrack = track;
+    streamEndTrack = track + count;
+    streamTracksLeft = count;
+    streamFillHalf = 0;
+    streamConsumeHalf = 0;
+    streamHalfFull[0] = 0;
+    streamHalfFull[1] = 0;
+    streamError = 0;
+
+    drive_select(drive);
+
+    // program the channel once over both halves, the auto-init bit takes care of wrapping around
+    initFloppyDMA((uint32) streamBuffer, (2 * STREAM_TRACK_SIZE) - 1);
+    prepare_for_floppyDMA_read();
+
+    // the stream is driven by IRQ6
+    irq_install_handler(floppy_irq, floppy_stream_irq);
+    irq_enable();
+
+    floppy_stream_issue();
+    return 0;
+}
+
+/*
+ * Waits for the next track of the stream and returns it (STREAM_TRACK_SIZE bytes)
+ * returns 0 when the stream is finished or a read failed
+ */
+uint8 *floppy_stream_next(){
+    if(streamTracksLeft == 0){
+        return 0;
+    }
+
+    // the stream is driven by interrupts, so the CPU can sleep until the track is in
+    deadline_t deadline = deadline_ms(FLOPPY_COMMAND_TIMEOUT);
+    while(!streamHalfFull[streamConsumeHalf] && !streamError){
+        if(deadline_passed(deadline)){
+            streamError = 1;
             break;
+        }
+        timer_idle();
     }
 
-    // First result byte = st0 status register
-    *st0 = floppy_read_data();
+    if(streamError){
+        printf("Error reading floppy!");
+        return 0;
+    }
 
-    // Second result byte = st1 status register
-    *st1 = floppy_read_data();
+    return streamBuffer + (streamConsumeHalf * STREAM_TRACK_SIZE);
+}
 
-    // Third result byte = st2 status register
-    *st2 = floppy_read_data();
+/*
+ * Hands the track returned by floppy_stream_next() back to the controller
+ */
+void floppy_stream_release(){
+    streamTracksLeft--;
 
-    // Fourth result byte = cylinder number
-    *cylResult = floppy_read_data();
+    uint32 eflags = irq_save();
 
+    streamHalfFull[streamConsumeHalf] = 0;
+    streamConsumeHalf ^= 1;
 
-    // Fifth result byte = ending head number
-    *headResult = floppy_read_data();
+    // the controller may have been waiting for this half
+    floppy_stream_issue();
 
-    // Sixth result byte = ending sector number
-    *sectResult = floppy_read_data();
+    irq_restore(eflags);
+}
 
-    // Seventh result byte = 2
+void floppy_stream_stop(){
+    deadline_t deadline = deadline_ms(FLOPPY_COMMAND_TIMEOUT);
+    while(streamInFlight && !streamError && !deadline_passed(deadline)){
+        timer_idle();
+    }
+
+    // a READ DATA that never finished leaves the controller in its execution phase
+    if(streamInFlight){
+        streamInFlight = 0;
+        floppy_reset(0);
+    }
+
+    irq_uninstall_handler(floppy_irq);
+    dma_buffer_free(streamBuffer);
+    streamBuffer = 0;
+}
+
+
+
+/*
+ * Formatting
+ *
+ * FORMAT TRACK writes a track from a list of sector IDs (cylinder, head, sector, size 2), one for
+ * each physical slot after the index hole. Sectors are laid out "interleave" slots apart, and the whole
+ * track is rotated by a skew, so sector 1 of a track does not sit right after the index hole.
+ *
+ * Track (cyl, head) is rotated by cyl * (headSkew + cylinderSkew) + head * headSkew slots: every head
+ * switch adds headSkew and every step to the next cylinder adds cylinderSkew. With the skew matching the
+ * time it takes to switch heads or to step and settle, sector 1 of the next track comes under the head
+ * just as the drive is ready to read it, instead of having just gone by (which costs a whole revolution).
+ */
+#define FORMAT_FILLER 0xF6    // what the data of every new sector is filled with
+
+void floppy_format_ids(uint8 *ids, int sectors, int cyl, int head, int interleave, int skew){
+    uint8 slots[MAX_SECTORS_PER_TRACK];
+    for(int i = 0; i < sectors; i++){
+        slots[i] = 0;
+    }
+
+    int slot = skew % sectors;
+    for(int sector = 1; sector <= sectors; sector++){
+        while(slots[slot]){
+            slot = (slot + 1) % sectors;
+        }
+        slots[slot] = sector;
+        slot = (slot + interleave) % sectors;
+    }
+
+    for(int i = 0; i < sectors; i++){
+        ids[(i * 4) + 0] = cyl;
+        ids[(i * 4) + 1] = head;
+        ids[(i * 4) + 2] = slots[i];
+        ids[(i * 4) + 3] = 2;
+    }
+}
+
+/*
+ * https://wiki.osdev.org/Floppy_Disk_Controller#Format_Track
+ * returns 0 if the track was formatted
+ */
+int floppy_format_track(int drive, int cyl, int head, int interleave, int skew){
+    uint8 *ids = dma_buffer_alloc();
+    if(!ids){
+        printf("Error: No DMA buffer free for formatting!");
+        return -3;
+    }
+
+    floppy_geometry_t *geometry = floppyGeometry[drive];
+    floppy_format_ids(ids, geometry->sectorsPerTrack, cyl, head, interleave, skew);
+
+    drive_select(drive);
+    if(floppy_seek(drive, cyl, head) != 0){
+        dma_buffer_free(ids);
+        return -1;
+    }
+
+    initFloppyDMA((uint32) ids, (geometry->sectorsPerTrack * 4) - 1);
+    prepare_for_floppyDMA_write();
+
+    int MFM = 0x40;
+    floppy_write_cmd(MFM | FLOPPY_FORMAT_TRACK);
+    floppy_write_cmd((head << 2) | drive);
+    floppy_write_cmd(2);                // 512 bytes per sector
+    floppy_write_cmd(geometry->sectorsPerTrack);
+    floppy_write_cmd(geometry->formatGap);
+    floppy_write_cmd(FORMAT_FILLER);
+
+    if(floppy_wait_rqm(FLOPPY_COMMAND_TIMEOUT) != 0){
+        printf("Error: The floppy controller timed out!");
+        dma_buffer_free(ids);
+        floppy_reset(0);
+        return -1;
+    }
+
+    uint8 st0 = floppy_read_data();
+    uint8 st1 = floppy_read_data();
+    uint8 st2 = floppy_read_data();
+    floppy_read_data(); // the rest of the result is undefined for FORMAT TRACK
     floppy_read_data();
+    floppy_read_data();
+    floppy_read_data();
+
+    dma_buffer_free(ids);
+
+    int failed = (st0 >> 6) != 0;
+    floppy_account(drive, cyl, 1, failed, st0, st2);
+
+    if(failed){
+        printf("Error formatting floppy!");
+        return (st1 & 0x02) ? -2 : -1;
+    }
+    return 0;
+}
+
+/*
+ * Formats "cylinders" cylinders (both heads) starting at "firstCyl"
+ * returns 0 if every track was formatted
+ */
+int floppy_format(int drive, int firstCyl, int cylinders, int interleave, int headSkew, int cylinderSkew){
+    for(int cyl = firstCyl; cyl < firstCyl + cylinders; cyl++){
+        for(int head = 0; head < 2; head++){
+            int skew = (cyl * (headSkew + cylinderSkew)) + (head * headSkew);
+
+            int error = floppy_format_track(drive, cyl, head, interleave, skew);
+            if(error){
+                return error;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Reads "cylinders" cylinders one after another, one multi-track READ DATA each (one per head on a 2.88 MB disk)
+ * returns how long it took in milliseconds, or 0 if a read failed
+ */
+uint32 floppy_time_read(int drive, int firstCyl, int cylinders){
+    uint8 *buffer = dma_buffer_alloc();
+    if(!buffer){
+        printf("Error: No DMA buffer free for the benchmark!");
+        return 0;
+    }
+
+    uint32 cylinderSectors = floppyGeometry[drive]->sectorsPerTrack * 2;
+
+    // start with the heads on the first cylinder so the first seek is not counted
+    floppy_read_dma(drive, firstCyl * cylinderSectors, buffer, 512);
+
+    uint32 start = timer_ms();
+    for(int cyl = firstCyl; cyl < firstCyl + cylinders; cyl++){
+        for(uint32 done = 0; done < cylinderSectors; done += DMA_BUFFER_SIZE / 512){
+            if(floppy_read_dma(drive, (cyl * cylinderSectors) + done, buffer, DMA_BUFFER_SIZE) != 0){
+                dma_buffer_free(buffer);
+                return 0;
+            }
+        }
+    }
+    uint32 time = timer_ms() - start;
+
+    dma_buffer_free(buffer);
+    return time ? time : 1;
+}
+
+/*
+ * Formats "cylinders" cylinders without any skew and reads them back, then formats them again with
+ * the given skews and reads them back, and prints how long both reads took (lower is faster)
+ * EVERYTHING on those cylinders is lost, only use this on a scratch disk
+ * returns 0 if both runs finished
+ */
+int floppy_benchmark_skew(int drive, int firstCyl, int cylinders, int headSkew, int cylinderSkew){
+    if(floppy_format(drive, firstCyl, cylinders, 1, 0, 0) != 0){
+        return -1;
+    }
+    uint32 plain = floppy_time_read(drive, firstCyl, cylinders);
+
+    if(floppy_format(drive, firstCyl, cylinders, 1, headSkew, cylinderSkew) != 0){
+        return -1;
+    }
+    uint32 skewed = floppy_time_read(drive, firstCyl, cylinders);
+
+    if(plain == 0 || skewed == 0){
+        return -1;
+    }
+
+    printf("Sequential read without skew: ");
+    printint(plain);
+    printf(" ms\nSequential read with skew:    ");
+    printint(skewed);
+    printf(" ms\n");
+    return 0;
+}
+
+/*
+ * Returns 1 if the CMOS reports a drive 0 or 1
+ */
+int floppy_drive_present(int drive){
+    return floppy_drive_type(drive) != 0;
+}
+
+
+/*
+ * Block device glue
+ *
+ * Drive 0 is registered as "fd0" and drive 1 (if there is one) as "fd1", each sized for the disk in it.
+ * Transfers never cross a cylinder (a multi-track READ DATA only covers both heads of one cylinder)
+ * and floppy_transfer() bounces them when it has to.
+ *
+ * Queued requests are handled in sorted order. Writes are done one at a time, but each group
+ * of reads that covers two or more tracks next to each other is streamed (see above) and copied out
+ * of the stream a track at a time. A group inside a single track is read straight into place,
+ * streaming it would read the whole track and add a copy.
+ */
+int floppy_blk_read(block_device_t *device, uint32 lba, uint8 *buffer, uint32 count){
+    return floppy_read((int)(uint32) device->private, lba, buffer, count * 512);
+}
+
+int floppy_blk_write(block_device_t *device, uint32 lba, uint8 *buffer, uint32 count){
+    return floppy_write((int)(uint32) device->private, lba, buffer, count * 512);
+}
+
+/*
+ * Streams the tracks from "firstTrack" to "lastTrack" and copies them into every request from "first" up to "end"
+ * each request is completed as soon as its last track went by
+ * returns 0 if the whole stream was read, requests that were not completed are left alone
+ */
+int floppy_stream_requests(int drive, block_request_t *first, block_request_t *end, uint32 firstTrack, uint32 lastTrack){
+    if(floppy_stream_start(drive, firstTrack, lastTrack - firstTrack + 1) != 0){
+        return -1;
+    }
+
+    for(uint32 track = firstTrack; track <= lastTrack; track++){
+        uint8 *data = floppy_stream_next();
+        if(!data){
+            floppy_stream_stop();
+            return -1;
+        }
+
+        uint32 trackStart = track * STREAM_SECTORS;
+        uint32 trackEnd = trackStart + STREAM_SECTORS;
+
+        for(block_request_t *request = first; request != end; ){
+            block_request_t *next = request->next;
+            uint32 requestEnd = request->lba + request->count;
+
+            if(!request->done && request->lba < trackEnd && requestEnd > trackStart){
+                uint32 from = request->lba > trackStart ? request->lba : trackStart;
+                uint32 to = requestEnd < trackEnd ? requestEnd : trackEnd;
+
+                uint8 *source = data + ((from - trackStart) * 512);
+                uint8 *destination = request->buffer + ((from - request->lba) * 512);
+                for(uint32 i = 0; i < (to - from) * 512; i++){
+                    destination[i] = source[i];
+                }
+
+                if(requestEnd <= trackEnd){
+                    blk_complete(request, 0);
+                }
+            }
+
+            request = next;
+        }
+
+        floppy_stream_release();
+    }
+
+    floppy_stream_stop();
+    return 0;
+}
+
+/*
+ * Starts seeking to "lba" while the controller works for the other drive (see volume.c)
+ */
+void floppy_blk_prepare(block_device_t *device, uint32 lba){
+    int drive = (int)(uint32) device->private;
+
+    uint16 cyl;
+    uint16 head;
+    uint16 sector;
+    lba_2_chs(drive, lba, &cyl, &head, &sector);
+
+    if(floppyTuning[drive].cylinder != cyl){
+        floppy_seek_start(drive, cyl, head);
+    }
+}
+
+void floppy_blk_submit(block_device_t *device, block_request_t *requests){
+    int drive = (int)(uint32) device->private;
+
+    while(requests){
+        block_request_t *end = requests->next;
+
+        if(!requests->write){
+            // gather the reads that follow on from this one (at most one track apart)
+            uint32 firstTrack = requests->lba / STREAM_SECTORS;
+            uint32 lastTrack = (requests->lba + requests->count - 1) / STREAM_SECTORS;
+
+            while(end && !end->write && end->lba / STREAM_SECTORS <= lastTrack + 1){
+                uint32 endTrack = (end->lba + end->count - 1) / STREAM_SECTORS;
+                if(endTrack > lastTrack){
+                    lastTrack = endTrack;
+                }
+                end = end->next;
+            }
+
+            if(lastTrack > firstTrack){
+                floppy_stream_requests(drive, requests, end, firstTrack, lastTrack);
+            }
+        }
+
+        // writes, and reads the stream could not finish, are done the normal way
+        while(requests != end){
+            block_request_t *next = requests->next;
+            if(!requests->done){
+                blk_complete(requests, blk_transfer(device, requests->lba, requests->buffer, requests->count, requests->write));
+            }
+            requests = next;
+        }
+    }
+}
+
+block_device_t floppyDevices[2] = {
+    {
+        .name = "fd0",
+        .sectors = 2880,
+        .limits = { .maxSectors = 36, .boundarySectors = 36, .queueDepth = 32 },
+        .read = floppy_blk_read,
+        .write = floppy_blk_write,
+        .submit = floppy_blk_submit,
+        .flush = 0,
+        .prepare = floppy_blk_prepare,
+        .private = (void *) 0
+    },
+    {
+        .name = "fd1",
+        .sectors = 2880,
+        .limits = { .maxSectors = 36, .boundarySectors = 36, .queueDepth = 32 },
+        .read = floppy_blk_read,
+        .write = floppy_blk_write,
+        .submit = floppy_blk_submit,
+        .flush = 0,
+        .prepare = floppy_blk_prepare,
+        .private = (void *) 1
+    }
+};
+
+/*
+ * Registers fd0, and fd1 if the CMOS reports a second drive
+ * returns the index of fd0
+ */
+int floppy_register(){
+    int first = -1;
+    for(int drive = 0; drive < 2; drive++){
+        if(drive > 0 && !floppy_drive_present(drive)){
+            break;
+        }
+
+        floppy_detect_media(drive);
+
+        block_device_t *device = &floppyDevices[drive];
+        uint32 cylinderSectors = floppyGeometry[drive]->sectorsPerTrack * 2;
+        device->sectors = cylinderSectors * 80;
+        device->limits.maxSectors = cylinderSectors;
+        device->limits.boundarySectors = cylinderSectors;
+
+        int index = blk_register(device);
+        if(drive == 0){
+            first = index;
+        }
+    }
+
+    return first;
 }
\ No newline at end of file
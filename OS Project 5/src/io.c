@@ -31,6 +31,32 @@ void outw(uint16 port, uint16 value)
 	return;
 }
 
+// outl (out long) - write a 32-bit value to an I/O port address (16-bit)
+void outl(uint16 port, uint32 value)
+{
+    asm volatile ("outl %1, %0" : : "dN" (port), "a" (value));
+}
+
+// inl (in long) - read a 32-bit value from an I/O port address (16-bit)
+uint32 inl(uint16 port)
+{
+    uint32 ret;
+    asm volatile ("inl %1, %0" : "=a" (ret) : "dN" (port));
+    return ret;
+}
+
+// insw (in string word) - read "count" 16-bit values from an I/O port address into memory
+void insw(uint16 port, void *buffer, uint32 count)
+{
+    asm volatile ("rep insw" : "+D" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
+// outsw (out string word) - write "count" 16-bit values from memory to an I/O port address
+void outsw(uint16 port, void *buffer, uint32 count)
+{
+    asm volatile ("rep outsw" : "+S" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
 // inb (in byte) - read an 8-bit value from an I/O port address (16-bit)
 uint8 inb(uint16 port)
 {
@@ -1,5 +1,6 @@
 #include "./idt.h"
 #include "./io.h"
+#include "./timer.h"
 
 extern  void irq0();
 extern  void irq1();
@@ -107,4 +108,40 @@ void irq_wait(int n){
     while(!currentInterrupts[n]){};
     currentInterrupts[n] = 0;
 
+}
+
+// Turns interrupts off and returns the old EFLAGS, for short sections an interrupt handler also touches
+uint32 irq_save(){
+    uint32 eflags;
+    asm volatile("pushf; pop %0; cli" : "=r"(eflags));
+    return eflags;
+}
+
+// Puts the interrupt flag back the way irq_save() found it
+void irq_restore(uint32 eflags){
+    asm volatile("push %0; popf" : : "r"(eflags));
+}
+
+void irq_enable(){
+    asm volatile("sti");
+}
+
+// Like irq_wait(), but gives up after "ms" milliseconds (returns -1), the CPU is halted while waiting
+int irq_wait_timeout(int n, uint32 ms){
+    deadline_t deadline = deadline_ms(ms);
+
+    while(!currentInterrupts[n]){
+        if(deadline_passed(deadline)){
+            return -1;
+        }
+        timer_idle();
+    }
+    currentInterrupts[n] = 0;
+
+    return 0;
+}
+
+// Forgets an interrupt nobody waited for, so the next irq_wait() of "n" waits for a new one
+void irq_clear(int n){
+    currentInterrupts[n] = 0;
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "./idt.h"
 #include "./io.h"
 #include "./multitasking.h"
+#include "./fat.h"
+#include "./paging.h"
 
 extern  void _isr0();
 extern  void _isr1();
@@ -37,6 +39,9 @@ extern  void _isr31();
 extern  void _syscall();
 void context_switch_isr(struct regs *r, proc_t **running, proc_t **next);
 
+// Defined in isr.h (included by kernel.c)
+extern const char* exception_messages[];
+
 void isrs_install()
 {
 	idt_set_gate(0, (unsigned)_isr0, 0x08, 0x8E);
@@ -76,6 +81,22 @@ void isrs_install()
 	
 }
 
+// Called by isr_common_stub for every CPU exception
+// Page faults inside a file mapping are handled and return so the instruction is retried
+// Anything else prints the exception and halts
+extern void _fault_handler(struct regs *r)
+{
+	if (r->int_no == 14 && page_fault_handler(r) == 0)
+	{
+		return;
+	}
+
+	printf("\nEXCEPTION: ");
+	printf((char *)exception_messages[r->int_no]);
+	printf("\n");
+	for(;;){}
+}
+
 extern void _syscall_isr(struct regs *r)
 {
 	uint32 syscall = r->eax;
@@ -4,22 +4,71 @@
 #include "./isr.h"
 #include "./fat.h"
 #include "./string.h"
+#include "./paging.h"
+#include "./fdc.h"
+#include "./blkdev.h"
+#include "./blktrace.h"
+#include "./ramdisk.h"
+#include "./pci.h"
+#include "./ata.h"
+#include "./virtio.h"
+#include "./volume.h"
+#include "./timer.h"
+#include "./multiboot.h"
+#include "./serial.h"
+#include "./boottime.h"
 
 void prockernel();
 void fileproc();
 
 int main() 
 {
+	// Save the bootloader's timestamps and what a Multiboot loader passed in before anything can overwrite them
+	boot_init();
+	multiboot_init();
+	serial_init();
+
 	// Clear the screen
 	clearscreen();
 
+	if(multiboot_booted())
+	{
+		printf("Started by a Multiboot loader, memory: ");
+		printint(multiboot_memory_kb());
+		printf(" KB\n");
+	}
+
 	// Initialize our keyboard
 	initkeymap();
 
 	// Initialize interrupts
 	idt_install();
+	boot_stamp(BOOT_IDT);
     isrs_install();
+	boot_stamp(BOOT_ISRS);
     irq_install();
+	boot_stamp(BOOT_IRQ);
+
+	// Calibrate the delays and start the millisecond timer (the disk drivers time out in real time)
+	timer_init();
+
+	// Record every block request from here on, the 't' command dumps them to COM1 (see blktrace.c)
+	blk_trace_start();
+
+	// Turn on paging (needed for memory mapped files)
+	paging_install();
+
+	// Register the disks, the file system finds its disk by name
+	// The whole floppy is copied into a RAM disk, so file operations do not have to wait for the floppy
+	floppy_register();
+	pci_init();
+	ata_init();
+	virtio_blk_init();
+	boot_stamp(BOOT_DISKS);
+	ramdisk_init("fd0");
+	boot_stamp(BOOT_RAMDISK);
+
+	// A volume ("md0") is only made when asked for, with the 'm' command
 
 	// Start executing the kernel process
 	startkernel(prockernel);
@@ -29,8 +78,8 @@ int main()
 
 void prockernel()
 {
-	// Create the user processes
-	createproc(fileproc, (void *) 0x10000);
+	// Create the user processes (the stack grows down from 0x70000, towards the DMA pool)
+	createproc(fileproc, (void *) 0x70000);
 
 	// Count how many processes are ready to run
 	int userprocs = ready_process_count();
@@ -56,13 +105,17 @@ void prockernel()
 
 void fileproc()
 {	
+	boot_stamp(BOOT_USER);
 	init_fs();
+	boot_stamp(BOOT_FS);
+	boot_report();
+
 	char input;
 
 	do
 	{
 		// Ask the user to make a selection
-		printf("Make a selection (c, d, r, w, q): ");
+		printf("Make a selection (c, d, r, w, p, u, s, f, v, t, m, q): ");
 		input = getchar();
 		putchar(input);
 		putchar('\n');
@@ -72,8 +125,124 @@ void fileproc()
 		{
 			break;
 		}
+		// Show how full the disk is
+		else if(input == 's')
+		{
+			statfs_t stats;
+			statfs(&stats);
+
+			printf("Free clusters: ");
+			printint(stats.freeClusters);
+			printf(" / ");
+			printint(stats.totalClusters);
+			printf("\nFiles: ");
+			printint(stats.usedEntries);
+			printf(" / ");
+			printint(stats.totalEntries);
+			printf("\nFragments: ");
+			printint(stats.fragments);
+
+			floppy_stats_t floppy;
+			floppy_get_stats(0, &floppy);
+
+			printf("\nFloppy step / load / unload (ms): ");
+			printint(floppy.stepRate);
+			printf(" / ");
+			printint(floppy.headLoad);
+			printf(" / ");
+			printint(floppy.headUnload);
+			printf("\nFloppy seek / read / write errors: ");
+			printint(floppy.seekErrors);
+			printf(" / ");
+			printint(floppy.readErrors);
+			printf(" / ");
+			printint(floppy.writeErrors);
+			printf("\nFloppy verifies / bad: ");
+			printint(floppy.verifies);
+			printf(" / ");
+			printint(floppy.verifyErrors);
+			putchar('\n');
+			continue;
+		}
+		// Format the first 10 cylinders of the second floppy and compare reading them with and without skew
+		else if(input == 'f')
+		{
+			if(!floppy_drive_present(1))
+			{
+				printf("Error: There is no second floppy drive to format!\n");
+				continue;
+			}
+
+			// Never format a disk a volume or the file system is using, and keep them off it while formatting
+			block_device_t *fd1 = blk_get("fd1");
+			if(fd1 != 0 && blk_claim(fd1, "format") < 0) continue;
+
+			printf("Everything on fd1 will be erased, type y to go on: ");
+			char answer = getchar();
+			putchar(answer);
+			putchar('\n');
+
+			if(answer == 'y')
+			{
+				printf("Formatting floppy drive 1...\n");
+				if(floppy_benchmark_skew(1, 0, 10, FLOPPY_HEAD_SKEW, FLOPPY_CYLINDER_SKEW) != 0) printf("\nError: The benchmark failed!\n");
+			}
+
+			if(fd1 != 0) blk_release(fd1);
+			continue;
+		}
+		// Turn checking every floppy write with a VERIFY on or off
+		else if(input == 'v')
+		{
+			int on = !floppy_get_verify(0);
+			floppy_set_verify(0, on);
+			floppy_set_verify(1, on);
+
+			printf(on ? "Verified writes on\n" : "Verified writes off\n");
+			continue;
+		}
+		// Send the block requests made so far to COM1, for tools/blkreplay.c
+		else if(input == 't')
+		{
+			blk_trace_dump();
+			continue;
+		}
+		// Make a volume ("md0") out of two disks nothing else uses, put a new file system on it and mount it
+		else if(input == 'm')
+		{
+			char first[9];
+			char second[9];
+
+			printf("Enter first disk: ");
+			scanf(first);
+			putchar('\n');
+
+			printf("Enter second disk: ");
+			scanf(second);
+			putchar('\n');
+
+			printf("Stripe or mirror (s, m): ");
+			char mode = getchar();
+			putchar(mode);
+			putchar('\n');
+
+			printf("Everything on both disks will be erased, type y to go on: ");
+			char answer = getchar();
+			putchar(answer);
+			putchar('\n');
+
+			if(answer != 'y') continue;
+
+			if(volume_create("md0", mode == 'm' ? VOLUME_MIRROR : VOLUME_STRIPE, first, second) < 0) continue;
+
+			printf("Formatting md0...\n");
+			if(formatFs("md0") != 0 || mountFs("md0") != 0) continue;
+
+			printf("Mounted md0, the file system is now on both disks\n");
+			continue;
+		}
 		// If the input was invalid, just restart loop
-		else if(input != 'c' && input != 'd' && input != 'r' && input != 'w')
+		else if(input != 'c' && input != 'd' && input != 'r' && input != 'w' && input != 'p' && input != 'u')
 		{
 			printf("Error: Invalid input!\n");
 			continue;
@@ -91,6 +260,35 @@ void fileproc()
 		scanf(ext);
 		putchar('\n');
 
+		// Copy the file to a new file without opening it
+		if(input == 'p')
+		{
+			char newFilename[9];
+			char newExt[4];
+
+			printf("Enter new filename: ");
+			scanf(newFilename);
+			putchar('\n');
+
+			printf("Enter new extension: ");
+			scanf(newExt);
+			putchar('\n');
+
+			printf("Copying File...\n");
+			int error = copyFile(filename, ext, newFilename, newExt);
+
+			if(error == -1) printf("Error: The directory is full!\n");
+			else if(error == -2) printf("Error: The file's FAT chain is shorter than its size!\n");
+			else if(error == -3) printf("Error: Tried copying a file that doesn't exist!\n");
+			else if(error == -4) printf("Error: Tried to copy to a file that already exists!\n");
+			else if(error == -5) printf("Error: Not enough free space on the disk!\n");
+			else if(error == -6) printf("Error: No buffer free for the copy!\n");
+			else if(error != 0) printf("Error: The disk could not be read or written!\n");
+
+			syncFs();
+			continue;
+		}
+
 		// Search the directory to see if there exists an entry that contains the file name and extension
 		char fileExists = openFile(filename, ext) == 0;
 
@@ -112,6 +310,9 @@ void fileproc()
 				clearscreen();
 				printf("Reading File...\n");
 
+				// The whole file is about to be read, so stream it into memory first
+				prefetchFile();
+
 				// Read one byte from the file
 				uint8 byte = readNextByte();
 
@@ -179,6 +380,36 @@ void fileproc()
 
 				clearscreen();
 			}
+			// Change every lowercase letter of the file to uppercase through a memory mapping
+			// The page fault handler reads each page in the first time it is touched, and msync() writes back the pages that were changed
+			else if(input == 'u')
+			{
+				printf("Uppercasing File...\n");
+
+				uint32 length;
+				uint8 *data = (uint8 *)mapFile(&length);
+				if(data != 0)
+				{
+					uint32 changed = 0;
+
+					for(uint32 i = 0; i < length; i++)
+					{
+						if(data[i] >= 'a' && data[i] <= 'z')
+						{
+							data[i] -= 'a' - 'A';
+							changed++;
+						}
+					}
+
+					msync(data);
+					munmap(data);
+
+					printint(changed);
+					printf(" letters changed\n");
+				}
+
+				closeFile();
+			}
 			// We cannot create a new file with the same name! (Do nothing)
 			else if(input == 'c') printf("Error: Tried to create a file that already exists!\n");
 		}
@@ -196,7 +427,12 @@ void fileproc()
 			else if(input == 'd') printf("Error: Tried deleting a file that doesn't exist!\n");
 			else if(input == 'r') printf("Error: Tried reading a file that doesn't exist!\n");
 			else if(input == 'w') printf("Error: Tried writing to a file that doesn't exist!\n");
-		}	
+			else if(input == 'u') printf("Error: Tried uppercasing a file that doesn't exist!\n");
+		}
+
+		// Changes only reach the floppy when the file system is synced (the RAM disk keeps them until then)
+		// so it is done after every command that may have changed a file, a reset loses nothing that was done
+		if(input != 'r') syncFs();
 	}while(input != 'q');
 
 	exit();
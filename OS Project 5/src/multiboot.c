@@ -0,0 +1,67 @@
+#include "./types.h"
+#include "./multiboot.h"
+
+// When the kernel is started by a Multiboot loader (kernel.elf, see kernel_entry.asm), the loader passes
+// a pointer to what it knows about the machine. That information lives in memory the kernel does not
+// reserve, so multiboot_init() copies what is needed before anything else runs.
+// Booted from the floppy there is no such information and every function here reports nothing.
+
+extern uint32 multibootMagic;
+extern uint32 multibootInfo;
+
+memory_region_t memoryRegions[MAX_MEMORY_REGIONS];
+int memoryRegionCount = 0;
+uint32 memoryKb = 0;
+
+// Copies the memory information, returns 0 if the kernel was started by a Multiboot loader
+int multiboot_init()
+{
+    if(multibootMagic != MULTIBOOT_BOOTLOADER_MAGIC) return -1;
+
+    multiboot_info_t *info = (multiboot_info_t *) multibootInfo;
+
+    if(info->flags & MULTIBOOT_INFO_MEMORY) memoryKb = 1024 + info->memUpper;
+
+    if(info->flags & MULTIBOOT_INFO_MEM_MAP)
+    {
+        uint32 address = info->mmapAddr;
+        uint32 end = info->mmapAddr + info->mmapLength;
+
+        memoryKb = 0;
+
+        while(address < end && memoryRegionCount < MAX_MEMORY_REGIONS)
+        {
+            multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *) address;
+            memory_region_t *region = &memoryRegions[memoryRegionCount++];
+
+            region->base = entry->base;
+            region->length = entry->length;
+            region->type = entry->type;
+
+            if(entry->type == MULTIBOOT_MEMORY_AVAILABLE) memoryKb += (uint32) (entry->length >> 10);
+
+            // The size field does not count itself
+            address += entry->size + 4;
+        }
+    }
+
+    return 0;
+}
+
+int multiboot_booted()
+{
+    return multibootMagic == MULTIBOOT_BOOTLOADER_MAGIC;
+}
+
+// Points "regions" at the memory map and returns how many regions it has (0 if the loader gave none)
+int multiboot_memory_map(memory_region_t **regions)
+{
+    *regions = memoryRegions;
+    return memoryRegionCount;
+}
+
+// The usable memory in KB, 0 if unknown
+uint32 multiboot_memory_kb()
+{
+    return memoryKb;
+}
\ No newline at end of file
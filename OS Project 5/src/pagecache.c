@@ -0,0 +1,433 @@
+#include "./types.h"
+#include "./io.h"
+#include "./fat.h"
+#include "./pagecache.h"
+
+// The page cache holds file data in 4 KB pages, keyed by the file's directory entry and the page's index in the file
+// Every user of a file (readByte()/writeByte(), memory mappings, ...) goes through the same pages
+// so a file only has to be read from the floppy once, even if it is closed and opened again
+//
+// Pages are evicted using 2Q:
+// - A page that is touched for the first time goes into A1in, a FIFO that takes at most a quarter of the cache
+// - When a page falls out of A1in, only its key is remembered in A1out (a FIFO of "ghosts")
+// - A page that is touched again while its key is in A1out goes into Am, an LRU list of hot pages
+// This keeps a single scan through a big file from pushing every hot page out of the cache
+
+// 512 frames of 4 KB (0x200000 - 0x3FFFFF), which is more than a whole floppy
+// Every frame is 4 KB aligned so it never crosses a 64 KB DMA page and can be read into directly
+#define CACHE_FRAME_ADDRESS 0x200000
+#define CACHE_PAGE_COUNT 512
+#define A1IN_LIMIT (CACHE_PAGE_COUNT / 4)
+#define A1OUT_SIZE (CACHE_PAGE_COUNT / 2)
+#define HASH_SIZE 128
+#define NONE 0xFFFF
+
+// The lists a page can be on
+enum CacheQueues
+{
+    QUEUE_FREE = 0,
+    QUEUE_A1IN = 1,
+    QUEUE_AM = 2
+};
+
+typedef struct
+{
+    directory_entry_t *directoryEntry;
+    uint32 pageIndex;
+
+    // Links for the queue the page is on and for its hash bucket
+    uint16 prev;
+    uint16 next;
+    uint16 hashNext;
+
+    // Pinned pages (mapped into memory, or the page a file is currently reading/writing) are never evicted
+    uint16 pinCount;
+
+    uint8 queue;
+    char isDirty;
+
+    // Set while the page's data is still being read in the background (see readAhead() in fat.c)
+    char isLoading;
+
+} cache_page_t;
+
+typedef struct
+{
+    directory_entry_t *directoryEntry;
+    uint32 pageIndex;
+
+} cache_key_t;
+
+// The page descriptors (20 bytes each) live at a fixed address (0x99000 - 0x9B7FF) right after the paging structures
+cache_page_t *cachePages = (cache_page_t *) 0x99000;
+
+uint16 hashHeads[HASH_SIZE];
+uint16 queueHead[3];
+uint16 queueTail[3];
+uint16 queueLength[3];
+
+cache_key_t a1out[A1OUT_SIZE];
+uint16 a1outNext;
+
+uint8 *frameOf(uint16 page)
+{
+    return (uint8 *)(CACHE_FRAME_ADDRESS + (page * 4096));
+}
+
+uint16 hashOf(directory_entry_t *directoryEntry, uint32 pageIndex)
+{
+    // Directory entries are 32 bytes apart, so drop the low bits of the pointer
+    return ((((uint32)directoryEntry) >> 5) + pageIndex) % HASH_SIZE;
+}
+
+void queuePushHead(uint8 queue, uint16 page)
+{
+    cachePages[page].queue = queue;
+    cachePages[page].prev = NONE;
+    cachePages[page].next = queueHead[queue];
+
+    if(queueHead[queue] != NONE) cachePages[queueHead[queue]].prev = page;
+    else queueTail[queue] = page;
+
+    queueHead[queue] = page;
+    queueLength[queue]++;
+}
+
+void queueUnlink(uint16 page)
+{
+    uint8 queue = cachePages[page].queue;
+
+    if(cachePages[page].prev != NONE) cachePages[cachePages[page].prev].next = cachePages[page].next;
+    else queueHead[queue] = cachePages[page].next;
+
+    if(cachePages[page].next != NONE) cachePages[cachePages[page].next].prev = cachePages[page].prev;
+    else queueTail[queue] = cachePages[page].prev;
+
+    queueLength[queue]--;
+}
+
+void hashInsert(uint16 page)
+{
+    uint16 bucket = hashOf(cachePages[page].directoryEntry, cachePages[page].pageIndex);
+    cachePages[page].hashNext = hashHeads[bucket];
+    hashHeads[bucket] = page;
+}
+
+void hashRemove(uint16 page)
+{
+    uint16 bucket = hashOf(cachePages[page].directoryEntry, cachePages[page].pageIndex);
+    uint16 *link = &hashHeads[bucket];
+
+    while(*link != NONE)
+    {
+        if(*link == page)
+        {
+            *link = cachePages[page].hashNext;
+            return;
+        }
+
+        link = &cachePages[*link].hashNext;
+    }
+}
+
+uint16 lookup(directory_entry_t *directoryEntry, uint32 pageIndex)
+{
+    uint16 page = hashHeads[hashOf(directoryEntry, pageIndex)];
+
+    while(page != NONE)
+    {
+        if(cachePages[page].directoryEntry == directoryEntry && cachePages[page].pageIndex == pageIndex)
+        {
+            return page;
+        }
+
+        page = cachePages[page].hashNext;
+    }
+
+    return NONE;
+}
+
+// Returns 1 (and forgets the ghost) if the key was recently evicted from A1in
+char ghostRemove(directory_entry_t *directoryEntry, uint32 pageIndex)
+{
+    for(int i = 0; i < A1OUT_SIZE; i++)
+    {
+        if(a1out[i].directoryEntry == directoryEntry && a1out[i].pageIndex == pageIndex)
+        {
+            a1out[i].directoryEntry = 0;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void ghostAdd(directory_entry_t *directoryEntry, uint32 pageIndex)
+{
+    a1out[a1outNext].directoryEntry = directoryEntry;
+    a1out[a1outNext].pageIndex = pageIndex;
+    a1outNext = (a1outNext + 1) % A1OUT_SIZE;
+}
+
+// Returns the least recently added unpinned page of a queue, or NONE
+uint16 victimFrom(uint8 queue)
+{
+    uint16 page = queueTail[queue];
+
+    while(page != NONE && cachePages[page].pinCount > 0)
+    {
+        page = cachePages[page].prev;
+    }
+
+    return page;
+}
+
+// Removes a page from the cache (writing it back first if needed) and returns it, ready to be reused
+// A dirty page that cannot be written back (the disk is full) is kept, it goes to the front of its queue and the next victim is tried
+uint16 evict()
+{
+    uint16 page = NONE;
+    cache_page_t *entry = 0;
+
+    for(int tries = 0; tries < CACHE_PAGE_COUNT && entry == 0; tries++)
+    {
+        page = NONE;
+        if(queueLength[QUEUE_A1IN] > A1IN_LIMIT) page = victimFrom(QUEUE_A1IN);
+        if(page == NONE) page = victimFrom(QUEUE_AM);
+        if(page == NONE) page = victimFrom(QUEUE_A1IN);
+        if(page == NONE) return NONE;
+
+        entry = &cachePages[page];
+
+        if(entry->isDirty && writeFilePage(entry->directoryEntry, entry->pageIndex, frameOf(page)) == -2)
+        {
+            uint8 queue = entry->queue;
+            queueUnlink(page);
+            queuePushHead(queue, page);
+            entry = 0;
+        }
+    }
+
+    if(entry == 0) return NONE;
+
+    entry->isDirty = 0;
+
+    // Pages leaving A1in are remembered so that a second touch promotes them into Am
+    if(entry->queue == QUEUE_A1IN) ghostAdd(entry->directoryEntry, entry->pageIndex);
+
+    queueUnlink(page);
+    hashRemove(page);
+
+    return page;
+}
+
+void pagecache_init()
+{
+    for(int i = 0; i < HASH_SIZE; i++)
+    {
+        hashHeads[i] = NONE;
+    }
+
+    for(int i = 0; i < 3; i++)
+    {
+        queueHead[i] = NONE;
+        queueTail[i] = NONE;
+        queueLength[i] = 0;
+    }
+
+    for(int i = 0; i < A1OUT_SIZE; i++)
+    {
+        a1out[i].directoryEntry = 0;
+    }
+    a1outNext = 0;
+
+    for(int i = 0; i < CACHE_PAGE_COUNT; i++)
+    {
+        cachePages[i].directoryEntry = 0;
+        cachePages[i].pinCount = 0;
+        cachePages[i].isDirty = 0;
+        cachePages[i].isLoading = 0;
+        queuePushHead(QUEUE_FREE, i);
+    }
+}
+
+// Finds a frame for a page that is not cached and adds it to the cache
+// Returns NONE if every page in the cache is pinned
+uint16 insertPage(directory_entry_t *directoryEntry, uint32 pageIndex)
+{
+    uint16 page;
+
+    if(queueHead[QUEUE_FREE] != NONE)
+    {
+        page = queueHead[QUEUE_FREE];
+        queueUnlink(page);
+    }
+    else
+    {
+        page = evict();
+        if(page == NONE)
+        {
+            printf("Error: Every page in the page cache is pinned or cannot be written back!\n");
+            return NONE;
+        }
+    }
+
+    cachePages[page].directoryEntry = directoryEntry;
+    cachePages[page].pageIndex = pageIndex;
+    cachePages[page].pinCount = 0;
+    cachePages[page].isDirty = 0;
+    cachePages[page].isLoading = 0;
+    hashInsert(page);
+
+    if(ghostRemove(directoryEntry, pageIndex)) queuePushHead(QUEUE_AM, page);
+    else queuePushHead(QUEUE_A1IN, page);
+
+    return page;
+}
+
+// Returns the frame holding a page of a file, reading it from the disk if it is not cached
+// Returns 0 if every page in the cache is pinned, or if the page could not be read (nothing is cached then)
+uint8 *pagecache_get(directory_entry_t *directoryEntry, uint32 pageIndex)
+{
+    uint16 page = lookup(directoryEntry, pageIndex);
+
+    // The page is cached but its data has not arrived yet, wait for it (a failed read drops the page)
+    if(page != NONE && cachePages[page].isLoading)
+    {
+        waitFilePage(directoryEntry, pageIndex);
+        page = lookup(directoryEntry, pageIndex);
+    }
+
+    if(page != NONE)
+    {
+        // Hits in Am move the page to the front, hits in A1in do not change anything
+        if(cachePages[page].queue == QUEUE_AM)
+        {
+            queueUnlink(page);
+            queuePushHead(QUEUE_AM, page);
+        }
+
+        return frameOf(page);
+    }
+
+    // Miss, read the page into a new frame
+    page = insertPage(directoryEntry, pageIndex);
+    if(page == NONE) return 0;
+
+    if(readFilePage(directoryEntry, pageIndex, frameOf(page)) != 0)
+    {
+        pagecache_discard(directoryEntry, pageIndex);
+        return 0;
+    }
+
+    return frameOf(page);
+}
+
+// Adds an empty (zeroed) page for a file that the caller is about to fill itself
+// Used when the data is already in memory, for example from a streaming read
+// Returns 0 if the page is already cached (the cached copy may be newer) or the cache is full of pinned pages
+uint8 *pagecache_install(directory_entry_t *directoryEntry, uint32 pageIndex)
+{
+    if(lookup(directoryEntry, pageIndex) != NONE) return 0;
+
+    uint16 page = insertPage(directoryEntry, pageIndex);
+    if(page == NONE) return 0;
+
+    uint8 *frame = frameOf(page);
+    for(int i = 0; i < 4096; i++)
+    {
+        frame[i] = 0;
+    }
+
+    return frame;
+}
+
+void pagecache_pin(directory_entry_t *directoryEntry, uint32 pageIndex)
+{
+    uint16 page = lookup(directoryEntry, pageIndex);
+    if(page != NONE) cachePages[page].pinCount++;
+}
+
+void pagecache_unpin(directory_entry_t *directoryEntry, uint32 pageIndex)
+{
+    uint16 page = lookup(directoryEntry, pageIndex);
+    if(page != NONE && cachePages[page].pinCount > 0) cachePages[page].pinCount--;
+}
+
+void pagecache_mark_dirty(directory_entry_t *directoryEntry, uint32 pageIndex)
+{
+    uint16 page = lookup(directoryEntry, pageIndex);
+    if(page != NONE) cachePages[page].isDirty = 1;
+}
+
+void pagecache_mark_loading(directory_entry_t *directoryEntry, uint32 pageIndex, char isLoading)
+{
+    uint16 page = lookup(directoryEntry, pageIndex);
+    if(page != NONE) cachePages[page].isLoading = isLoading;
+}
+
+// Writes every dirty page of a file back to the disk
+// The pages stay in the cache, a page that could not be written stays dirty
+void pagecache_flush(directory_entry_t *directoryEntry)
+{
+    for(int i = 0; i < CACHE_PAGE_COUNT; i++)
+    {
+        if(cachePages[i].queue != QUEUE_FREE && cachePages[i].isDirty && cachePages[i].directoryEntry == directoryEntry)
+        {
+            if(writeFilePage(directoryEntry, cachePages[i].pageIndex, frameOf(i)) != -2) cachePages[i].isDirty = 0;
+        }
+    }
+}
+
+// Drops every page of a file WITHOUT writing it back
+// Used when a file is deleted or its directory entry is reused for a new file
+void pagecache_invalidate(directory_entry_t *directoryEntry)
+{
+    for(int i = 0; i < CACHE_PAGE_COUNT; i++)
+    {
+        if(cachePages[i].queue != QUEUE_FREE && cachePages[i].directoryEntry == directoryEntry)
+        {
+            queueUnlink(i);
+            hashRemove(i);
+            cachePages[i].isDirty = 0;
+            cachePages[i].pinCount = 0;
+            queuePushHead(QUEUE_FREE, i);
+        }
+    }
+
+    for(int i = 0; i < A1OUT_SIZE; i++)
+    {
+        if(a1out[i].directoryEntry == directoryEntry) a1out[i].directoryEntry = 0;
+    }
+}
+
+// Drops one page WITHOUT writing it back (used when reading it in failed)
+void pagecache_discard(directory_entry_t *directoryEntry, uint32 pageIndex)
+{
+    uint16 page = lookup(directoryEntry, pageIndex);
+    if(page == NONE || cachePages[page].pinCount > 0) return;
+
+    queueUnlink(page);
+    hashRemove(page);
+    cachePages[page].isDirty = 0;
+    queuePushHead(QUEUE_FREE, page);
+}
+
+// Writes every dirty page in the cache back to the disk
+// A page that could not be written stays dirty
+// Returns 0 if every page was written
+int pagecache_sync()
+{
+    int error = 0;
+
+    for(int i = 0; i < CACHE_PAGE_COUNT; i++)
+    {
+        if(cachePages[i].queue != QUEUE_FREE && cachePages[i].isDirty)
+        {
+            if(writeFilePage(cachePages[i].directoryEntry, cachePages[i].pageIndex, frameOf(i)) != -2) cachePages[i].isDirty = 0;
+            else error = -1;
+        }
+    }
+
+    return error;
+}
@@ -0,0 +1,224 @@
+#include "./types.h"
+#include "./io.h"
+#include "./irq.h"
+#include "./fat.h"
+#include "./paging.h"
+#include "./pagecache.h"
+
+// Paging structures
+// They live below the EBDA (0x9FC00) and above the kernel stack (which grows down from 0x80000)
+// 0x90000 - 0x90FFF   page directory
+// 0x91000 - 0x94FFF   4 page tables identity mapping the first 16 MB (kernel, FATs, buffers, video memory, DMA)
+// 0x95000 - 0x98FFF   4 page tables, one per mapping slot
+uint32 *pageDirectory = (uint32 *) 0x90000;
+uint32 *identityTables = (uint32 *) 0x91000;
+uint32 *mappingTables = (uint32 *) 0x95000;
+
+// Page table entry flags
+#define PAGE_PRESENT  0x01
+#define PAGE_WRITABLE 0x02
+#define PAGE_DIRTY    0x40
+
+mapping_t mappings[MAX_MAPPINGS];
+
+// Flush a single page from the TLB after changing its page table entry
+void invalidatePage(void *address)
+{
+    asm volatile("invlpg (%0)" : : "r"(address) : "memory");
+}
+
+// Build the page tables and turn paging on
+// The first 16 MB are identity mapped so every fixed address the kernel uses keeps working
+void paging_install()
+{
+    for(int i = 0; i < 1024; i++)
+    {
+        pageDirectory[i] = 0;
+    }
+
+    for(int i = 0; i < 4 * 1024; i++)
+    {
+        identityTables[i] = (i * PAGE_SIZE) | PAGE_PRESENT | PAGE_WRITABLE;
+        mappingTables[i] = 0;
+    }
+
+    for(int i = 0; i < 4; i++)
+    {
+        pageDirectory[i] = ((uint32)identityTables + (i * PAGE_SIZE)) | PAGE_PRESENT | PAGE_WRITABLE;
+    }
+
+    // Every mapping slot gets its own page table (and therefore its own 4 MB window)
+    for(int i = 0; i < MAX_MAPPINGS; i++)
+    {
+        pageDirectory[(MAPPING_BASE / MAPPING_WINDOW) + i] = ((uint32)mappingTables + (i * PAGE_SIZE)) | PAGE_PRESENT | PAGE_WRITABLE;
+        mappings[i].isMapped = 0;
+    }
+
+    // Load the page directory and set CR0.PG
+    asm volatile("mov %0, %%cr3" : : "r"(pageDirectory));
+
+    uint32 cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 |= 0x80000000;
+    asm volatile("mov %0, %%cr0" : : "r"(cr0));
+}
+
+// Returns the index of the mapping slot containing a virtual address, or -1
+int findMapping(uint32 address)
+{
+    for(int i = 0; i < MAX_MAPPINGS; i++)
+    {
+        uint32 start = (uint32)mappings[i].address;
+        uint32 end = start + ((mappings[i].length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+
+        if(mappings[i].isMapped && address >= start && address < end)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Called from _fault_handler() for every page fault
+// If the fault is inside a mapping, map in the page cache's frame for that page of the file
+// The page stays pinned in the page cache for as long as it is mapped
+// Returns 0 if the fault was handled and the faulting instruction can be retried
+// Returns -1 if the fault was not caused by a mapping (a real crash)
+int page_fault_handler(regs *r)
+{
+    uint32 faultAddress;
+    asm volatile("mov %%cr2, %0" : "=r"(faultAddress));
+
+    // Bit 0 of the error code is set when the page was present (a protection violation)
+    if(r->err_code & 0x1) return -1;
+
+    int slot = findMapping(faultAddress);
+    if(slot < 0) return -1;
+
+    mapping_t *mapping = &mappings[slot];
+    uint32 page = (faultAddress - (uint32)mapping->address) / PAGE_SIZE;
+    uint32 pageIndex = (mapping->offset / PAGE_SIZE) + page;
+
+    // The floppy driver waits on IRQ6, so the page is read with the interrupt flag the faulting code had
+    // (the CPU turned it off to enter the handler), and it is turned off again before returning through the stub
+    uint32 eflags = irq_save();
+    irq_restore(r->eflags);
+
+    uint8 *frame = pagecache_get(mapping->directoryEntry, pageIndex);
+    if(frame != 0) pagecache_pin(mapping->directoryEntry, pageIndex);
+
+    irq_restore(eflags);
+    if(frame == 0) return -1;
+
+    mappingTables[(slot * 1024) + page] = (uint32)frame | PAGE_PRESENT | PAGE_WRITABLE;
+    invalidatePage(mapping->address + (page * PAGE_SIZE));
+
+    return 0;
+}
+
+// Maps "length" bytes of an opened file, starting at "offset", into virtual memory
+// Nothing is read from the disk here, pages are filled in by page_fault_handler() the first time they are touched
+// The offset must be a multiple of PAGE_SIZE
+// Returns the virtual address of the mapping, or 0 if the file could not be mapped
+void *mmapFile(file_t *file, uint32 offset, uint32 length)
+{
+    if(!file->isOpened)
+    {
+        printf("Error: File was not opened!\n");
+        return 0;
+    }
+
+    if(offset % PAGE_SIZE != 0 || offset >= file->directoryEntry->fileSize)
+    {
+        printf("Error: Invalid offset for mapping!\n");
+        return 0;
+    }
+
+    // Do not map past the end of the file or past the end of the window
+    if(length > file->directoryEntry->fileSize - offset) length = file->directoryEntry->fileSize - offset;
+    if(length > MAPPING_WINDOW) length = MAPPING_WINDOW;
+
+    for(int i = 0; i < MAX_MAPPINGS; i++)
+    {
+        if(!mappings[i].isMapped)
+        {
+            mappings[i].directoryEntry = file->directoryEntry;
+            mappings[i].offset = offset;
+            mappings[i].length = length;
+            mappings[i].address = (uint8 *)(MAPPING_BASE + (i * MAPPING_WINDOW));
+            mappings[i].isMapped = 1;
+            return mappings[i].address;
+        }
+    }
+
+    printf("Error: Too many files are mapped!\n");
+    return 0;
+}
+
+// Writes every dirty page of the mapping containing "address" back to the disk
+// The CPU sets the dirty bit of a page on the first write, those pages are marked dirty in the page cache and then flushed
+int msync(void *address)
+{
+    int slot = findMapping((uint32)address);
+    if(slot < 0) return -1;
+
+    mapping_t *mapping = &mappings[slot];
+    uint32 pageCount = (mapping->length + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    for(uint32 page = 0; page < pageCount; page++)
+    {
+        uint32 *entry = &mappingTables[(slot * 1024) + page];
+
+        if((*entry & PAGE_PRESENT) && (*entry & PAGE_DIRTY))
+        {
+            pagecache_mark_dirty(mapping->directoryEntry, (mapping->offset / PAGE_SIZE) + page);
+
+            *entry &= ~PAGE_DIRTY;
+            invalidatePage(mapping->address + (page * PAGE_SIZE));
+        }
+    }
+
+    pagecache_flush(mapping->directoryEntry);
+
+    return 0;
+}
+
+// Writes back and removes the mapping containing "address"
+int munmap(void *address)
+{
+    int slot = findMapping((uint32)address);
+    if(slot < 0) return -1;
+
+    msync(address);
+
+    mapping_t *mapping = &mappings[slot];
+    uint32 pageCount = (mapping->length + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    for(uint32 page = 0; page < pageCount; page++)
+    {
+        uint32 *entry = &mappingTables[(slot * 1024) + page];
+
+        if(*entry & PAGE_PRESENT)
+        {
+            pagecache_unpin(mapping->directoryEntry, (mapping->offset / PAGE_SIZE) + page);
+            *entry = 0;
+            invalidatePage(mapping->address + (page * PAGE_SIZE));
+        }
+    }
+
+    mapping->isMapped = 0;
+    return 0;
+}
+
+// Removes every mapping of a file, used when the file is closed
+void munmapFile(directory_entry_t *directoryEntry)
+{
+    for(int i = 0; i < MAX_MAPPINGS; i++)
+    {
+        if(mappings[i].isMapped && mappings[i].directoryEntry == directoryEntry)
+        {
+            munmap(mappings[i].address);
+        }
+    }
+}
@@ -0,0 +1,129 @@
+#include "./types.h"
+#include "./io.h"
+#include "./pci.h"
+
+/*
+ * PCI configuration space access (configuration mechanism #1)
+ *
+ * https://wiki.osdev.org/PCI#Configuration_Space_Access_Mechanism_.231
+ *
+ * pci_init() walks every bus, slot and function once and remembers what it found,
+ * drivers then look their device up with pci_find_class()/pci_find_device().
+ */
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+pci_device_t pciDevices[PCI_MAX_DEVICES];
+int pciDeviceCount = 0;
+
+uint32 pci_config_read(uint8 bus, uint8 slot, uint8 function, uint8 offset){
+    outl(PCI_CONFIG_ADDRESS, 0x80000000 | (bus << 16) | (slot << 11) | (function << 8) | (offset & 0xFC));
+    return inl(PCI_CONFIG_DATA);
+}
+
+void pci_config_write(uint8 bus, uint8 slot, uint8 function, uint8 offset, uint32 value){
+    outl(PCI_CONFIG_ADDRESS, 0x80000000 | (bus << 16) | (slot << 11) | (function << 8) | (offset & 0xFC));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+uint32 pci_read32(pci_device_t *device, uint8 offset){
+    return pci_config_read(device->bus, device->slot, device->function, offset);
+}
+
+uint16 pci_read16(pci_device_t *device, uint8 offset){
+    return pci_read32(device, offset) >> ((offset & 2) * 8);
+}
+
+void pci_write32(pci_device_t *device, uint8 offset, uint32 value){
+    pci_config_write(device->bus, device->slot, device->function, offset, value);
+}
+
+void pci_write16(pci_device_t *device, uint8 offset, uint16 value){
+    uint32 shift = (offset & 2) * 8;
+    uint32 old = pci_read32(device, offset);
+    pci_write32(device, offset, (old & ~(0xFFFF << shift)) | ((uint32) value << shift));
+}
+
+// Turns on command register bits (I/O decoding, bus mastering, ...)
+void pci_enable(pci_device_t *device, uint16 bits){
+    pci_write16(device, PCI_COMMAND, pci_read16(device, PCI_COMMAND) | bits);
+}
+
+void pci_add(uint8 bus, uint8 slot, uint8 function, uint32 id){
+    if(pciDeviceCount == PCI_MAX_DEVICES){
+        return;
+    }
+
+    pci_device_t *device = &pciDevices[pciDeviceCount++];
+    device->bus = bus;
+    device->slot = slot;
+    device->function = function;
+    device->vendorId = id & 0xFFFF;
+    device->deviceId = id >> 16;
+
+    uint32 class = pci_read32(device, 0x08);
+    device->classCode = class >> 24;
+    device->subclass = (class >> 16) & 0xFF;
+    device->progIf = (class >> 8) & 0xFF;
+
+    for(int i = 0; i < 6; i++){
+        device->bar[i] = pci_read32(device, PCI_BAR0 + (i * 4));
+    }
+
+    device->irq = pci_read32(device, PCI_INTERRUPT_LINE) & 0xFF;
+}
+
+/*
+ * Finds every function on the PCI bus
+ * returns how many were found
+ */
+int pci_init(){
+    pciDeviceCount = 0;
+
+    for(uint32 bus = 0; bus < 256; bus++){
+        for(uint8 slot = 0; slot < 32; slot++){
+            uint32 id = pci_config_read(bus, slot, 0, PCI_VENDOR_ID);
+            if((id & 0xFFFF) == 0xFFFF){
+                continue;
+            }
+
+            pci_add(bus, slot, 0, id);
+
+            // bit 7 of the header type: the device has more than one function
+            if(!(pci_config_read(bus, slot, 0, 0x0C) & 0x800000)){
+                continue;
+            }
+
+            for(uint8 function = 1; function < 8; function++){
+                id = pci_config_read(bus, slot, function, PCI_VENDOR_ID);
+                if((id & 0xFFFF) != 0xFFFF){
+                    pci_add(bus, slot, function, id);
+                }
+            }
+        }
+    }
+
+    return pciDeviceCount;
+}
+
+// Returns the first function of a class/subclass, or 0 if there is none
+pci_device_t *pci_find_class(uint8 classCode, uint8 subclass){
+    for(int i = 0; i < pciDeviceCount; i++){
+        if(pciDevices[i].classCode == classCode && pciDevices[i].subclass == subclass){
+            return &pciDevices[i];
+        }
+    }
+
+    return 0;
+}
+
+// Returns the first function with this vendor and device ID, or 0 if there is none
+pci_device_t *pci_find_device(uint16 vendorId, uint16 deviceId){
+    for(int i = 0; i < pciDeviceCount; i++){
+        if(pciDevices[i].vendorId == vendorId && pciDevices[i].deviceId == deviceId){
+            return &pciDevices[i];
+        }
+    }
+
+    return 0;
+}
\ No newline at end of file
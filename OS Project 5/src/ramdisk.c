@@ -0,0 +1,144 @@
+#include "./types.h"
+#include "./io.h"
+#include "./blkdev.h"
+#include "./timer.h"
+#include "./ramdisk.h"
+
+// The RAM disk ("ram0") keeps a copy of a whole disk (the "backing" disk) in memory
+// The copy is read in once, when the RAM disk is created, and every read and write after that is a memory copy
+// Written groups of sectors are remembered and only copied back to the backing disk by blk_flush() (see syncFs(),
+// which the shell runs after every command that changes files)
+// Loading the copy takes as long as reading the whole disk (about 48 s for a 1.44 MB floppy), it is shown at boot
+
+#define GROUP_COUNT (RAMDISK_MAX_SECTORS / RAMDISK_GROUP_SECTORS)
+
+uint8 *ramdiskData = (uint8 *) RAMDISK_ADDRESS;
+block_device_t *ramdiskBacking = 0;
+uint32 ramdiskDirty[(GROUP_COUNT + 31) / 32];
+
+void ramdisk_copy(uint8 *destination, uint8 *source, uint32 count)
+{
+    uint32 *to = (uint32 *) destination;
+    uint32 *from = (uint32 *) source;
+
+    for(uint32 i = 0; i < count * (BLOCK_SIZE / 4); i++)
+    {
+        to[i] = from[i];
+    }
+}
+
+int ramdisk_read(block_device_t *device, uint32 lba, uint8 *buffer, uint32 count)
+{
+    (void) device;
+
+    ramdisk_copy(buffer, ramdiskData + (lba * BLOCK_SIZE), count);
+    return 0;
+}
+
+int ramdisk_write(block_device_t *device, uint32 lba, uint8 *buffer, uint32 count)
+{
+    (void) device;
+
+    ramdisk_copy(ramdiskData + (lba * BLOCK_SIZE), buffer, count);
+
+    for(uint32 group = lba / RAMDISK_GROUP_SECTORS; group <= (lba + count - 1) / RAMDISK_GROUP_SECTORS; group++)
+    {
+        ramdiskDirty[group / 32] |= 1u << (group % 32);
+    }
+
+    return 0;
+}
+
+// Writes every written group back to the backing disk, neighbouring groups go out as one transfer
+int ramdisk_flush(block_device_t *device)
+{
+    uint32 groups = (device->sectors + RAMDISK_GROUP_SECTORS - 1) / RAMDISK_GROUP_SECTORS;
+    int error = 0;
+
+    for(uint32 group = 0; group < groups; group++)
+    {
+        if(!(ramdiskDirty[group / 32] & (1u << (group % 32)))) continue;
+
+        uint32 first = group;
+        while(group < groups && (ramdiskDirty[group / 32] & (1u << (group % 32))))
+        {
+            ramdiskDirty[group / 32] &= ~(1u << (group % 32));
+            group++;
+        }
+
+        uint32 lba = first * RAMDISK_GROUP_SECTORS;
+        uint32 count = (group * RAMDISK_GROUP_SECTORS) - lba;
+        if(lba + count > device->sectors) count = device->sectors - lba;
+
+        if(blk_write(ramdiskBacking, lba, ramdiskData + (lba * BLOCK_SIZE), count) != 0)
+        {
+            // Try again at the next flush
+            for(uint32 i = first; i < group; i++)
+            {
+                ramdiskDirty[i / 32] |= 1u << (i % 32);
+            }
+            error = -1;
+        }
+    }
+
+    if(blk_flush(ramdiskBacking) != 0) error = -1;
+
+    return error;
+}
+
+block_device_t ramdiskDevice = {
+    .name = "ram0",
+    .limits = { .maxSectors = RAMDISK_MAX_SECTORS, .boundarySectors = 0, .queueDepth = 1 },
+    .read = ramdisk_read,
+    .write = ramdisk_write,
+    .submit = 0,
+    .flush = ramdisk_flush,
+    .private = 0
+};
+
+// Creates "ram0" as a copy of the block device called "backingName" and registers it
+// Returns the RAM disk's index in the block device registry, or -1 if it could not be created
+int ramdisk_init(char *backingName)
+{
+    ramdiskBacking = blk_get(backingName);
+    if(ramdiskBacking == 0 || ramdiskBacking->sectors > RAMDISK_MAX_SECTORS)
+    {
+        printf("Error: Can not make a RAM disk of this disk!\n");
+        return -1;
+    }
+
+    // The backing disk gets everything written to the RAM disk, nobody else may take it over
+    if(blk_claim(ramdiskBacking, "ram0") != 0) return -1;
+
+    printf("Loading the disk into memory...\n");
+    uint32 start = timer_ms();
+
+    // The whole disk is one request, the backing driver moves it in the biggest bursts it can (whole tracks for the floppy)
+    block_request_t request;
+    request.lba = 0;
+    request.count = ramdiskBacking->sectors;
+    request.buffer = ramdiskData;
+    request.write = 0;
+    request.complete = 0;
+
+    if(blk_submit(ramdiskBacking, &request) != 0 || blk_wait(&request) != 0)
+    {
+        printf("Error: Could not load the disk into memory!\n");
+        blk_release(ramdiskBacking);
+        return -1;
+    }
+
+    printf("Loaded ");
+    printint((ramdiskBacking->sectors * BLOCK_SIZE) / 1024);
+    printf(" KB in ");
+    printint(timer_ms() - start);
+    printf(" ms\n");
+
+    for(uint32 i = 0; i < (GROUP_COUNT + 31) / 32; i++)
+    {
+        ramdiskDirty[i] = 0;
+    }
+
+    ramdiskDevice.sectors = ramdiskBacking->sectors;
+    return blk_register(&ramdiskDevice);
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include "./types.h"
+#include "./io.h"
+#include "./serial.h"
+
+// COM1 at 115200 baud, 8 data bits, no parity, 1 stop bit, polled (nothing reads from it)
+// Under QEMU "-serial stdio" or "-serial file:boot.log" and under Bochs "com1: enabled=1, mode=file" collect the output
+// https://wiki.osdev.org/Serial_Ports
+
+#define COM1 0x3F8
+
+#define SERIAL_DATA 0
+#define SERIAL_INTERRUPT_ENABLE 1
+#define SERIAL_FIFO_CONTROL 2
+#define SERIAL_LINE_CONTROL 3
+#define SERIAL_MODEM_CONTROL 4
+#define SERIAL_LINE_STATUS 5
+
+// Line status: the transmit holding register is empty
+#define SERIAL_THR_EMPTY 0x20
+
+void serial_init()
+{
+    outb(COM1 + SERIAL_INTERRUPT_ENABLE, 0x00);
+
+    // Divisor 1 (115200 baud), written while DLAB is set
+    outb(COM1 + SERIAL_LINE_CONTROL, 0x80);
+    outb(COM1 + SERIAL_DATA, 0x01);
+    outb(COM1 + SERIAL_INTERRUPT_ENABLE, 0x00);
+
+    // 8N1, FIFOs on and cleared, DTR and RTS set
+    outb(COM1 + SERIAL_LINE_CONTROL, 0x03);
+    outb(COM1 + SERIAL_FIFO_CONTROL, 0xC7);
+    outb(COM1 + SERIAL_MODEM_CONTROL, 0x03);
+}
+
+void serial_putchar(char character)
+{
+    // Without a port the line status reads 0xFF, so this never hangs
+    while(!(inb(COM1 + SERIAL_LINE_STATUS) & SERIAL_THR_EMPTY)){};
+
+    outb(COM1 + SERIAL_DATA, character);
+}
+
+// Writes a string, "\n" is sent as "\r\n"
+void serial_print(char *string)
+{
+    for(int i = 0; string[i] != 0; i++)
+    {
+        if(string[i] == '\n') serial_putchar('\r');
+        serial_putchar(string[i]);
+    }
+}
+
+void serial_printint(uint32 n)
+{
+    if(n >= 10) serial_printint(n / 10);
+
+    serial_putchar('0' + (n % 10));
+}
+
+// Always 8 digits, so dumps line up
+void serial_printhex(uint32 n)
+{
+    for(int shift = 28; shift >= 0; shift -= 4)
+    {
+        serial_putchar("0123456789ABCDEF"[(n >> shift) & 0xF]);
+    }
+}
\ No newline at end of file
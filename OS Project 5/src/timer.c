@@ -0,0 +1,130 @@
+#include "./types.h"
+#include "./io.h"
+#include "./irq.h"
+#include "./timer.h"
+
+// The PIT (channel 0) interrupts every millisecond and counts timer_ms()
+// Shorter delays and deadlines use the TSC, which is calibrated against PIT channel 2 once at boot
+//
+// Waits that can take a while (msleep(), and the loops that use timer_idle() between polls) halt the CPU
+// until the next interrupt instead of spinning, the timer makes sure one comes within a millisecond
+
+#define PIT_FREQUENCY 1193182
+#define TIMER_HZ 1000
+#define CALIBRATE_MS 10
+
+// Used until timer_init() has run, as fast as any CPU this runs on, so early waits are too long rather than too short
+#define DEFAULT_CYCLES_PER_MS 4000000
+
+volatile uint32 timerTicks = 0;
+uint32 cyclesPerMs = DEFAULT_CYCLES_PER_MS;
+uint32 cyclesPerUs = DEFAULT_CYCLES_PER_MS / 1000;
+
+uint64 timer_cycles()
+{
+    uint32 low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64) high << 32) | low;
+}
+
+void timer_irq(regs *r)
+{
+    (void) r;
+    timerTicks++;
+}
+
+// Counts TSC cycles over CALIBRATE_MS using PIT channel 2 (the speaker channel, its output can be read back in port 0x61)
+void timer_calibrate()
+{
+    uint16 count = (PIT_FREQUENCY * CALIBRATE_MS) / 1000;
+
+    // Gate channel 2 on, speaker off
+    outb(0x61, (inb(0x61) & ~0x02) | 0x01);
+
+    // Channel 2, low then high byte, mode 0 (output goes high when the count runs out)
+    outb(0x43, 0xB0);
+    outb(0x42, count & 0xFF);
+    outb(0x42, count >> 8);
+
+    uint64 start = timer_cycles();
+    while(!(inb(0x61) & 0x20)){};
+    uint64 end = timer_cycles();
+
+    uint32 cycles = (uint32)(end - start);
+    if(cycles < CALIBRATE_MS * 1000) return;
+
+    cyclesPerMs = cycles / CALIBRATE_MS;
+    cyclesPerUs = cyclesPerMs / 1000;
+}
+
+// Calibrates the TSC and starts the millisecond tick
+void timer_init()
+{
+    timer_calibrate();
+
+    // Channel 0, low then high byte, mode 2 (rate generator)
+    uint16 divisor = PIT_FREQUENCY / TIMER_HZ;
+    outb(0x43, 0x34);
+    outb(0x40, divisor & 0xFF);
+    outb(0x40, divisor >> 8);
+
+    irq_install_handler(0, timer_irq);
+    irq_enable();
+}
+
+// Milliseconds since timer_init()
+uint32 timer_ms()
+{
+    return timerTicks;
+}
+
+// Converts a number of TSC cycles into microseconds (without a 64 bit division, long spans lose a few low bits)
+uint32 timer_cycles_to_us(uint64 cycles)
+{
+    int shift = 0;
+    while(cycles >> 32)
+    {
+        cycles >>= 1;
+        shift++;
+    }
+
+    return ((uint32) cycles / cyclesPerUs) << shift;
+}
+
+deadline_t deadline_us(uint32 us)
+{
+    return timer_cycles() + ((uint64) us * cyclesPerUs);
+}
+
+deadline_t deadline_ms(uint32 ms)
+{
+    return timer_cycles() + ((uint64) ms * cyclesPerMs);
+}
+
+int deadline_passed(deadline_t deadline)
+{
+    return timer_cycles() >= deadline;
+}
+
+// Halts until the next interrupt, or does nothing if interrupts are off (in an interrupt handler, say)
+void timer_idle()
+{
+    uint32 eflags;
+    asm volatile("pushf; pop %0" : "=r"(eflags));
+
+    if(eflags & 0x200) asm volatile("hlt");
+}
+
+// Spins for "us" microseconds, for short delays that have to be exact
+void udelay(uint32 us)
+{
+    deadline_t deadline = deadline_us(us);
+    while(!deadline_passed(deadline)){};
+}
+
+// Waits "ms" milliseconds with the CPU halted in between timer ticks
+void msleep(uint32 ms)
+{
+    deadline_t deadline = deadline_ms(ms);
+    while(!deadline_passed(deadline)) timer_idle();
+}
\ No newline at end of file
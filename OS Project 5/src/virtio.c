@@ -0,0 +1,506 @@
+#include "./types.h"
+#include "./io.h"
+#include "./irq.h"
+#include "./blkdev.h"
+#include "./pci.h"
+#include "./timer.h"
+#include "./virtio.h"
+
+/*
+ * virtio-blk (legacy PCI interface), registered as "vda"
+ *
+ * https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.html (2.6 Split Virtqueues, 4.1.4.8 Legacy Interfaces)
+ *
+ * Every command (header, data buffers, status byte) is described by a table of descriptors
+ * in a "slot". When the device supports indirect descriptors a command takes a single entry of
+ * the queue, which points to its slot's table, otherwise the slot's descriptors are placed in
+ * the queue itself.
+ *
+ * Submitted requests that continue each other on the disk are merged into one command (one
+ * data descriptor per request). A whole batch is put in the avail ring before the device is
+ * notified once. With VIRTIO_F_EVENT_IDX the device is only notified if it asked to be, and it
+ * only interrupts when the last command in flight finishes, instead of once per command.
+ *
+ * Whoever waits for a command calls virtio_poll(), which reaps finished commands itself (in case
+ * interrupts are off or one got lost). If nothing finishes for VIRTIO_TIMEOUT ms the device is
+ * reset and every request, queued or in flight, fails; the device stays stopped after that.
+ */
+
+enum VirtioRegisters
+{
+    VIRTIO_DEVICE_FEATURES  = 0x00,
+    VIRTIO_GUEST_FEATURES   = 0x04,
+    VIRTIO_QUEUE_PFN        = 0x08,
+    VIRTIO_QUEUE_SIZE       = 0x0C,
+    VIRTIO_QUEUE_SELECT     = 0x0E,
+    VIRTIO_QUEUE_NOTIFY     = 0x10,
+    VIRTIO_DEVICE_STATUS    = 0x12,
+    VIRTIO_ISR_STATUS       = 0x13,
+    VIRTIO_BLK_CAPACITY     = 0x14  // the device config starts here when MSI-X is off
+};
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 1
+#define VIRTIO_STATUS_DRIVER 2
+#define VIRTIO_STATUS_DRIVER_OK 4
+#define VIRTIO_STATUS_FAILED 128
+
+#define VIRTIO_BLK_F_FLUSH (1u << 9)
+#define VIRTIO_F_INDIRECT_DESC (1u << 28)
+#define VIRTIO_F_EVENT_IDX (1u << 29)
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+
+#define VIRTQ_USED_F_NO_NOTIFY 1
+
+// How long (in ms) the device may go without finishing a command before it is given up on
+#define VIRTIO_TIMEOUT 5000
+
+// Descriptors per command: the header, the data buffers and the status byte
+#define SLOT_DESCRIPTORS (VIRTIO_MAX_SEGMENTS + 2)
+
+// Only the first 16 MB are identity mapped (see paging.c), so buffers above that have no known physical address
+#define VIRTIO_DMA_LIMIT 0x1000000
+
+typedef struct
+{
+    // The request header the device reads
+    uint32 type;
+    uint32 reserved;
+    uint32 sector;
+    uint32 sectorHigh;
+
+    // The status byte the device writes, 0 means success
+    volatile uint8 status;
+    uint8 padding[15];
+
+    // The command's descriptors, when indirect descriptors are used
+    virtq_desc_t table[SLOT_DESCRIPTORS];
+
+    // The block requests this command transfers
+    block_request_t *first;
+    uint32 requestCount;
+
+} virtio_slot_t;
+
+virtio_slot_t *virtioSlots = (virtio_slot_t *) VIRTIO_SLOT_ADDRESS;
+uint32 virtioSlotsFree;
+int virtioSlotCount;
+int virtioInFlight;
+
+uint16 virtioIo;
+uint32 virtioFeatures;
+uint16 virtqSize;
+virtq_desc_t *virtqDesc;
+virtq_avail_t *virtqAvail;
+virtq_used_t *virtqUsed;
+volatile uint16 *virtqUsedEvent;    // after the avail ring: the used index we want the next interrupt at
+volatile uint16 *virtqAvailEvent;   // after the used ring: the avail index the device wants a notify at
+uint16 virtqLastUsed;
+deadline_t virtioDeadline;      // when the commands in flight are given up on, moved on by every completion
+int virtioStopped = 0;          // the device was reset after a timeout
+
+block_request_t *virtioPending = 0;
+block_device_t virtioDevice;
+
+// Full memory barrier, stores to the rings must be visible before the device's index is read
+#define virtio_mb() asm volatile("lock; addl $0, (%%esp)" : : : "memory")
+
+int virtio_dma_ok(uint8 *buffer, uint32 count){
+    return (uint32) buffer + (count * 512) <= VIRTIO_DMA_LIMIT;
+}
+
+// The descriptors of a slot, and the queue index of the first one
+virtq_desc_t *virtio_slot_table(int slot){
+    if(virtioFeatures & VIRTIO_F_INDIRECT_DESC){
+        return virtioSlots[slot].table;
+    }
+    return &virtqDesc[slot * SLOT_DESCRIPTORS];
+}
+
+void virtio_set_desc(virtq_desc_t *table, int index, uint16 base, void *address, uint32 length, uint16 flags){
+    table[index].address = (uint32) address;
+    table[index].addressHigh = 0;
+    table[index].length = length;
+    table[index].flags = flags;
+    table[index].next = base + index + 1;
+}
+
+/*
+ * Turns pending requests into commands while there are free slots, then notifies the device (if it wants to be)
+ * must be called with interrupts off (or from the interrupt handler)
+ * a request with no sectors is a cache flush
+ */
+void virtio_start(){
+    uint16 oldIndex = virtqAvail->index;
+    uint16 newIndex = oldIndex;
+
+    while(virtioPending && virtioSlotsFree){
+        int slot = 0;
+        while(!(virtioSlotsFree & (1u << slot))){
+            slot++;
+        }
+        virtioSlotsFree &= ~(1u << slot);
+
+        virtio_slot_t *command = &virtioSlots[slot];
+        block_request_t *first = virtioPending;
+        virtq_desc_t *table = virtio_slot_table(slot);
+        uint16 base = (virtioFeatures & VIRTIO_F_INDIRECT_DESC) ? 0 : slot * SLOT_DESCRIPTORS;
+
+        command->type = first->count == 0 ? VIRTIO_BLK_T_FLUSH : first->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+        command->reserved = 0;
+        command->sector = first->lba;
+        command->sectorHigh = 0;
+        command->status = 0xFF;
+        command->first = first;
+        command->requestCount = 0;
+
+        virtio_set_desc(table, 0, base, command, 16, VIRTQ_DESC_F_NEXT);
+
+        // take every request that continues where the previous one ended
+        int descriptors = 1;
+        uint32 lba = first->lba;
+        block_request_t *request = first;
+        do {
+            uint16 flags = VIRTQ_DESC_F_NEXT | (request->write ? 0 : VIRTQ_DESC_F_WRITE);
+            if(request->count > 0){
+                virtio_set_desc(table, descriptors++, base, request->buffer, request->count * 512, flags);
+            }
+
+            lba += request->count;
+            command->requestCount++;
+            request = request->next;
+        } while(request && first->count > 0 && request->count > 0 && request->write == first->write
+                && request->lba == lba && descriptors <= VIRTIO_MAX_SEGMENTS);
+
+        virtioPending = request;
+
+        virtio_set_desc(table, descriptors, base, (void *) &command->status, 1, VIRTQ_DESC_F_WRITE);
+        descriptors++;
+
+        uint16 head = base;
+        if(virtioFeatures & VIRTIO_F_INDIRECT_DESC){
+            head = slot;
+            virtio_set_desc(virtqDesc, slot, 0, table, descriptors * sizeof(virtq_desc_t), VIRTQ_DESC_F_INDIRECT);
+        }
+
+        virtqAvail->ring[newIndex % virtqSize] = head;
+        newIndex++;
+        virtioInFlight++;
+    }
+
+    if(newIndex == oldIndex){
+        return;
+    }
+
+    if(virtioInFlight == newIndex - oldIndex){
+        virtioDeadline = deadline_ms(VIRTIO_TIMEOUT);
+    }
+
+    // only interrupt when everything in flight is done
+    *virtqUsedEvent = virtqLastUsed + virtioInFlight - 1;
+
+    virtio_mb();
+    virtqAvail->index = newIndex;
+    virtio_mb();
+
+    int notify;
+    if(virtioFeatures & VIRTIO_F_EVENT_IDX){
+        notify = (uint16)(newIndex - *virtqAvailEvent - 1) < (uint16)(newIndex - oldIndex);
+    } else {
+        notify = !(virtqUsed->flags & VIRTQ_USED_F_NO_NOTIFY);
+    }
+
+    if(notify){
+        outw(virtioIo + VIRTIO_QUEUE_NOTIFY, 0);
+    }
+}
+
+// Completes every command the device has returned, then starts whatever is waiting
+void virtio_reap(){
+    do {
+        while(virtqLastUsed != virtqUsed->index){
+            virtio_mb();
+            uint32 id = virtqUsed->ring[virtqLastUsed % virtqSize].id;
+            int slot = (virtioFeatures & VIRTIO_F_INDIRECT_DESC) ? id : id / SLOT_DESCRIPTORS;
+            virtqLastUsed++;
+
+            virtio_slot_t *command = &virtioSlots[slot];
+            int error = command->status == 0 ? 0 : -1;
+            if(error){
+                printf("Error: virtio-blk request failed!\n");
+            }
+
+            block_request_t *request = command->first;
+            for(uint32 i = 0; i < command->requestCount; i++){
+                block_request_t *next = request->next;
+                blk_complete(request, error);
+                request = next;
+            }
+
+            virtioSlotsFree |= 1u << slot;
+            virtioInFlight--;
+            virtioDeadline = deadline_ms(VIRTIO_TIMEOUT);
+        }
+
+        // ask for an interrupt when the rest is done, and look again in case it already is
+        if(virtioInFlight > 0){
+            *virtqUsedEvent = virtqLastUsed + virtioInFlight - 1;
+        }
+        virtio_mb();
+    } while(virtqLastUsed != virtqUsed->index);
+
+    virtio_start();
+}
+
+void virtio_irq(regs *r){
+    (void) r;
+
+    // reading the ISR status acknowledges the interrupt
+    inb(virtioIo + VIRTIO_ISR_STATUS);
+    virtio_reap();
+}
+
+// Fails every request in a list
+void virtio_fail_list(block_request_t *request){
+    while(request){
+        block_request_t *next = request->next;
+        blk_complete(request, -1);
+        request = next;
+    }
+}
+
+// Resets the device and fails everything in flight and queued
+// must be called with interrupts off
+void virtio_stop(){
+    outb(virtioIo + VIRTIO_DEVICE_STATUS, 0);
+    virtioStopped = 1;
+
+    for(int slot = 0; slot < virtioSlotCount; slot++){
+        if(!(virtioSlotsFree & (1u << slot))){
+            block_request_t *request = virtioSlots[slot].first;
+            for(uint32 i = 0; i < virtioSlots[slot].requestCount; i++){
+                block_request_t *next = request->next;
+                blk_complete(request, -1);
+                request = next;
+            }
+            virtioSlotsFree |= 1u << slot;
+        }
+    }
+    virtioInFlight = 0;
+
+    block_request_t *pending = virtioPending;
+    virtioPending = 0;
+    virtio_fail_list(pending);
+}
+
+// Reaps finished commands without waiting for the interrupt, and stops the device once it is past its deadline
+void virtio_poll(){
+    uint32 eflags = irq_save();
+
+    if(!virtioStopped){
+        virtio_reap();
+        if(virtioInFlight > 0 && deadline_passed(virtioDeadline)){
+            printf("Error: virtio-blk timed out, the device was reset!\n");
+            virtio_stop();
+        }
+    }
+
+    irq_restore(eflags);
+}
+
+// Adds a list of requests to the end of the pending list and starts as many as there are slots for
+void virtio_queue(block_request_t *requests){
+    uint32 eflags = irq_save();
+
+    if(virtioStopped){
+        virtio_fail_list(requests);
+        irq_restore(eflags);
+        return;
+    }
+
+    block_request_t **link = &virtioPending;
+    while(*link){
+        link = &(*link)->next;
+    }
+    *link = requests;
+
+    virtio_start();
+
+    irq_restore(eflags);
+}
+
+void virtio_blk_submit(block_device_t *device, block_request_t *requests){
+    block_request_t *direct = 0;
+    block_request_t **tail = &direct;
+
+    while(requests){
+        block_request_t *next = requests->next;
+
+        if(virtio_dma_ok(requests->buffer, requests->count)){
+            *tail = requests;
+            tail = &requests->next;
+        } else {
+            blk_complete(requests, blk_transfer(device, requests->lba, requests->buffer, requests->count, requests->write));
+        }
+
+        requests = next;
+    }
+
+    *tail = 0;
+    if(direct){
+        virtio_queue(direct);
+    }
+}
+
+// Runs one command and waits for it
+int virtio_run(block_device_t *device, uint32 lba, uint8 *buffer, uint32 count, int write){
+    block_request_t request;
+    request.device = device;
+    request.lba = lba;
+    request.count = count;
+    request.buffer = buffer;
+    request.write = write;
+    request.done = 0;
+    request.complete = 0;
+    request.next = 0;
+
+    virtio_queue(&request);
+    while(!request.done){
+        virtio_poll();
+    }
+
+    return request.status;
+}
+
+// Buffers the device can not reach go through a scratch buffer
+int virtio_blk_transfer(block_device_t *device, uint32 lba, uint8 *buffer, uint32 count, int write){
+    if(virtio_dma_ok(buffer, count)){
+        return virtio_run(device, lba, buffer, count, write);
+    }
+
+    uint8 *bounce = blk_buffer_alloc();
+    if(!bounce){
+        printf("Error: No buffer free for virtio-blk!\n");
+        return -1;
+    }
+
+    int error = 0;
+    while(count > 0 && !error){
+        uint32 chunk = count < BLOCK_BUFFER_SIZE / 512 ? count : BLOCK_BUFFER_SIZE / 512;
+
+        if(write){
+            for(uint32 i = 0; i < chunk * 512; i++){
+                bounce[i] = buffer[i];
+            }
+        }
+
+        error = virtio_run(device, lba, bounce, chunk, write);
+
+        if(!write){
+            for(uint32 i = 0; i < chunk * 512; i++){
+                buffer[i] = bounce[i];
+            }
+        }
+
+        lba += chunk;
+        buffer += chunk * 512;
+        count -= chunk;
+    }
+
+    blk_buffer_free(bounce);
+    return error;
+}
+
+int virtio_blk_read(block_device_t *device, uint32 lba, uint8 *buffer, uint32 count){
+    return virtio_blk_transfer(device, lba, buffer, count, 0);
+}
+
+int virtio_blk_write(block_device_t *device, uint32 lba, uint8 *buffer, uint32 count){
+    return virtio_blk_transfer(device, lba, buffer, count, 1);
+}
+
+int virtio_blk_flush(block_device_t *device){
+    if(!(virtioFeatures & VIRTIO_BLK_F_FLUSH)){
+        return 0;
+    }
+
+    return virtio_run(device, 0, 0, 0, 1);
+}
+
+/*
+ * Finds a virtio-blk device, sets up its queue and registers it as "vda"
+ * returns 0 if there was one
+ */
+int virtio_blk_init(){
+    pci_device_t *pci = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID);
+    if(pci == 0 || !(pci->bar[0] & 1)){
+        return -1;
+    }
+
+    pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+    virtioIo = pci->bar[0] & 0xFFFC;
+
+    // reset, then tell the device we found it and know how to drive it
+    outb(virtioIo + VIRTIO_DEVICE_STATUS, 0);
+    outb(virtioIo + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(virtioIo + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    virtioFeatures = inl(virtioIo + VIRTIO_DEVICE_FEATURES) & (VIRTIO_BLK_F_FLUSH | VIRTIO_F_INDIRECT_DESC | VIRTIO_F_EVENT_IDX);
+    outl(virtioIo + VIRTIO_GUEST_FEATURES, virtioFeatures);
+
+    outw(virtioIo + VIRTIO_QUEUE_SELECT, 0);
+    virtqSize = inw(virtioIo + VIRTIO_QUEUE_SIZE);
+
+    // the legacy layout: descriptors, the avail ring, then the used ring on the next 4 KB boundary
+    uint32 usedOffset = ((16 * virtqSize) + 6 + (2 * virtqSize) + 4095) & ~4095;
+    uint32 queueBytes = usedOffset + 6 + (8 * virtqSize);
+    if(virtqSize == 0 || queueBytes > VIRTIO_SLOT_ADDRESS - VIRTIO_QUEUE_ADDRESS){
+        outb(virtioIo + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+
+    uint8 *queue = (uint8 *) VIRTIO_QUEUE_ADDRESS;
+    for(uint32 i = 0; i < queueBytes; i++){
+        queue[i] = 0;
+    }
+
+    virtqDesc = (virtq_desc_t *) queue;
+    virtqAvail = (virtq_avail_t *) (queue + (16 * virtqSize));
+    virtqUsed = (virtq_used_t *) (queue + usedOffset);
+    virtqUsedEvent = &virtqAvail->ring[virtqSize];
+    virtqAvailEvent = (volatile uint16 *) &virtqUsed->ring[virtqSize];
+    virtqLastUsed = 0;
+
+    virtioSlotCount = (virtioFeatures & VIRTIO_F_INDIRECT_DESC) ? virtqSize : virtqSize / SLOT_DESCRIPTORS;
+    if(virtioSlotCount > VIRTIO_MAX_SLOTS){
+        virtioSlotCount = VIRTIO_MAX_SLOTS;
+    }
+    virtioSlotsFree = virtioSlotCount == 32 ? 0xFFFFFFFF : (1u << virtioSlotCount) - 1;
+    virtioInFlight = 0;
+    virtioPending = 0;
+
+    outl(virtioIo + VIRTIO_QUEUE_PFN, VIRTIO_QUEUE_ADDRESS >> 12);
+
+    irq_install_handler(pci->irq, virtio_irq);
+    outb(virtioIo + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    irq_enable();
+
+    virtioDevice.name[0] = 'v';
+    virtioDevice.name[1] = 'd';
+    virtioDevice.name[2] = 'a';
+    virtioDevice.name[3] = 0;
+    virtioDevice.sectors = inl(virtioIo + VIRTIO_BLK_CAPACITY);
+    virtioDevice.limits.maxSectors = 256;
+    virtioDevice.limits.boundarySectors = 0;
+    virtioDevice.limits.queueDepth = VIRTIO_MAX_SLOTS;
+    virtioDevice.limits.background = 1;
+    virtioDevice.read = virtio_blk_read;
+    virtioDevice.write = virtio_blk_write;
+    virtioDevice.submit = virtio_blk_submit;
+    virtioDevice.flush = virtio_blk_flush;
+    virtioDevice.private = pci;
+
+    return blk_register(&virtioDevice) >= 0 ? 0 : -1;
+}
\ No newline at end of file
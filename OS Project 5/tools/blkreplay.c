@@ -0,0 +1,757 @@
+// Replays a block trace (dumped over COM1 by blk_trace_dump(), see src/blktrace.c) against models of a cache,
+// an elevator and a block allocator on top of a model of the disk, and reports how long the disk would have been busy
+// Usage: blkreplay [options] <serial log> ...
+//
+//   -d name      the device to replay (default fd0), requests to other devices are left out
+//   -c cache     none, lru:<units>[:<sectors per unit>] or clock:<units>[:<sectors per unit>] (default none)
+//                a unit bigger than a sector reads the whole unit on a miss (lru:16:18 is a 16 track cache)
+//   -e elevator  the order a batch of blk_submit() requests goes to the disk in:
+//                fifo (as submitted), sort (by lba, what blk_submit() does) or scan (up from the heads, then down)
+//   -a alloc     where data sectors (from -D on) end up: asis (as traced), packed (every sector next to the one
+//                touched before it, an allocator that never fragments) or log (every write goes to the next free sector)
+//   -D sector    the first data sector, sectors below it (boot sector, FATs, root directory) are never moved (default 33)
+//   -g geometry  hd (1.44 MB), ed (2.88 MB) or flat (no seeks or rotation, for the ATA and virtio disks),
+//                by default taken from the size of the device
+//   -k skew      cylinder skew in sectors, as laid down by floppy_format() (default 0)
+//   -r ms        step rate in milliseconds (default 3)
+//
+// Think time between requests is kept from the trace: a request is made as long after the previous one finished
+// as it was when the trace was taken. Caches are write-through, the models only change timing, never data.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define MAX_DEVICES 8
+#define MAX_CALLERS 64
+
+typedef struct
+{
+    uint64_t time;      // microseconds, from the start of the first dump
+    uint32_t duration;
+    uint32_t lba;
+    uint32_t count;
+    int device;
+    char op;            // 'R', 'W' or 'F'
+    int async;
+    uint32_t caller;
+
+} trace_entry_t;
+
+typedef struct
+{
+    char name[16];
+    uint32_t sectors;
+
+} trace_device_t;
+
+trace_entry_t *entries = 0;
+int entryCount = 0;
+int entryCapacity = 0;
+trace_device_t devices[MAX_DEVICES];
+uint32_t dropped = 0;
+
+/*
+ * Reading the trace
+ */
+
+void add_entry(trace_entry_t *entry)
+{
+    if(entryCount == entryCapacity)
+    {
+        entryCapacity = entryCapacity ? entryCapacity * 2 : 1024;
+        entries = realloc(entries, entryCapacity * sizeof(trace_entry_t));
+    }
+    entries[entryCount++] = *entry;
+}
+
+// Every dump starts its clock over, so dumps after the first one are moved to after the one before
+int read_log(const char *path)
+{
+    FILE *log = fopen(path, "r");
+    if(!log)
+    {
+        perror(path);
+        return -1;
+    }
+
+    char line[256];
+    int inDump = 0;
+    uint64_t offset = entryCount ? entries[entryCount - 1].time + entries[entryCount - 1].duration : 0;
+
+    while(fgets(line, sizeof(line), log))
+    {
+        unsigned int a, b;
+        char name[16];
+
+        if(sscanf(line, "blktrace begin %u %u", &a, &b) == 2)
+        {
+            inDump = 1;
+            dropped += b;
+            continue;
+        }
+        if(!inDump) continue;
+
+        if(!strncmp(line, "blktrace end", 12))
+        {
+            inDump = 0;
+            if(entryCount) offset = entries[entryCount - 1].time + entries[entryCount - 1].duration;
+            continue;
+        }
+
+        if(sscanf(line, "blktrace device %u %15s %u", &a, name, &b) == 3)
+        {
+            if(a < MAX_DEVICES)
+            {
+                strcpy(devices[a].name, name);
+                devices[a].sectors = b;
+            }
+            continue;
+        }
+
+        unsigned int time, duration, device, lba, count, caller;
+        char op[4];
+        if(sscanf(line, "%u %u %u %3s %u %u %x", &time, &duration, &device, op, &lba, &count, &caller) == 7)
+        {
+            trace_entry_t entry = { offset + time, duration, lba, count, (int) device, op[0], op[1] == 'A', caller };
+            add_entry(&entry);
+        }
+    }
+
+    fclose(log);
+    return 0;
+}
+
+/*
+ * The disk
+ */
+
+typedef struct
+{
+    int flat;
+    uint32_t sectorsPerTrack;
+    uint64_t revolution;        // all times in nanoseconds
+    uint64_t indexGap;
+    uint64_t slotTime;
+    uint64_t sectorTime;
+    uint64_t stepTime;
+    uint64_t settleTime;
+    uint64_t commandTime;
+    int cylinderSkew;
+
+} disk_model_t;
+
+typedef struct
+{
+    uint64_t commands;
+    uint64_t seeks;
+    uint64_t steps;
+    uint64_t seekNs;
+    uint64_t rotationNs;
+    uint64_t transferNs;
+    uint64_t sectorsRead;
+    uint64_t sectorsWritten;
+
+} disk_stats_t;
+
+disk_model_t disk;
+disk_stats_t diskStats;
+int diskCylinder = 0;
+
+void disk_setup(const char *geometry, uint32_t sectors, int stepMs, int cylinderSkew)
+{
+    if(!geometry) geometry = sectors == 2880 ? "hd" : sectors == 5760 ? "ed" : "flat";
+
+    memset(&disk, 0, sizeof(disk));
+    disk.commandTime = 200000;
+
+    if(!strcmp(geometry, "flat"))
+    {
+        // about what the emulated ATA disk manages with READ MULTIPLE
+        disk.flat = 1;
+        disk.sectorTime = 2000;
+        disk.commandTime = 100000;
+        return;
+    }
+
+    // the same rotation as tools/fdcsim: 300 rpm, the sectors take 94% of a track behind a 3% gap after the index
+    disk.sectorsPerTrack = !strcmp(geometry, "ed") ? 36 : 18;
+    disk.revolution = 200000000;
+    disk.indexGap = disk.revolution * 3 / 100;
+    disk.slotTime = disk.revolution * 94 / 100 / disk.sectorsPerTrack;
+    disk.sectorTime = disk.sectorsPerTrack == 36 ? 4096000 : 8192000;
+    disk.stepTime = (uint64_t) stepMs * 1000000;
+    disk.settleTime = 15000000;
+    disk.cylinderSkew = cylinderSkew;
+}
+
+// Moves "count" sectors from "lba" on, starting at "t", returns when the last one went by
+uint64_t disk_access(uint64_t t, uint32_t lba, uint32_t count, int write)
+{
+    diskStats.commands++;
+    if(write) diskStats.sectorsWritten += count;
+    else diskStats.sectorsRead += count;
+
+    t += disk.commandTime;
+
+    if(disk.flat)
+    {
+        diskStats.transferNs += count * disk.sectorTime;
+        return t + (count * disk.sectorTime);
+    }
+
+    for(uint32_t i = 0; i < count; i++, lba++)
+    {
+        uint32_t spt = disk.sectorsPerTrack;
+        int cylinder = lba / (2 * spt);
+        uint32_t sector = lba % spt;
+
+        if(cylinder != diskCylinder)
+        {
+            int steps = abs(cylinder - diskCylinder);
+            uint64_t seek = (steps * disk.stepTime) + disk.settleTime;
+
+            diskStats.seeks++;
+            diskStats.steps += steps;
+            diskStats.seekNs += seek;
+            t += seek;
+            diskCylinder = cylinder;
+        }
+
+        // with a cylinder skew every track is rotated by that many slots per cylinder (see floppy_format_ids())
+        uint32_t slot = (sector + (cylinder * disk.cylinderSkew)) % spt;
+        uint64_t position = disk.indexGap + (slot * disk.slotTime);
+        uint64_t phase = t % disk.revolution;
+        uint64_t wait = (position + disk.revolution - phase) % disk.revolution;
+
+        diskStats.rotationNs += wait;
+        diskStats.transferNs += disk.sectorTime;
+        t += wait + disk.sectorTime;
+    }
+
+    return t;
+}
+
+/*
+ * Cache models, keyed by unit (a run of sectors)
+ */
+
+typedef struct
+{
+    const char *name;
+    void (*init)(uint32_t units, uint32_t capacity);
+    int (*lookup)(uint32_t unit);     // 1 on a hit
+    void (*insert)(uint32_t unit);
+
+} cache_model_t;
+
+uint32_t cacheCapacity;
+uint32_t cacheUsed;
+uint32_t cacheUnitSectors = 1;
+
+// No cache, every read goes to the disk
+void none_init(uint32_t units, uint32_t capacity) { (void) units; (void) capacity; }
+int none_lookup(uint32_t unit) { (void) unit; return 0; }
+void none_insert(uint32_t unit) { (void) unit; }
+
+// Least recently used, a list through every unit of the device
+int32_t *lruPrevious;
+int32_t *lruNext;
+char *lruCached;
+int32_t lruHead = -1;    // the most recently used
+int32_t lruTail = -1;
+
+void lru_init(uint32_t units, uint32_t capacity)
+{
+    lruPrevious = calloc(units, sizeof(int32_t));
+    lruNext = calloc(units, sizeof(int32_t));
+    lruCached = calloc(units, 1);
+    cacheCapacity = capacity;
+}
+
+void lru_unlink(uint32_t unit)
+{
+    if(lruPrevious[unit] >= 0) lruNext[lruPrevious[unit]] = lruNext[unit];
+    else lruHead = lruNext[unit];
+
+    if(lruNext[unit] >= 0) lruPrevious[lruNext[unit]] = lruPrevious[unit];
+    else lruTail = lruPrevious[unit];
+}
+
+void lru_push(uint32_t unit)
+{
+    lruPrevious[unit] = -1;
+    lruNext[unit] = lruHead;
+    if(lruHead >= 0) lruPrevious[lruHead] = unit;
+    lruHead = unit;
+    if(lruTail < 0) lruTail = unit;
+}
+
+int lru_lookup(uint32_t unit)
+{
+    if(!lruCached[unit]) return 0;
+
+    lru_unlink(unit);
+    lru_push(unit);
+    return 1;
+}
+
+void lru_insert(uint32_t unit)
+{
+    if(lru_lookup(unit)) return;
+
+    if(cacheUsed == cacheCapacity)
+    {
+        int32_t victim = lruTail;
+        lru_unlink(victim);
+        lruCached[victim] = 0;
+        cacheUsed--;
+    }
+
+    lruCached[unit] = 1;
+    lru_push(unit);
+    cacheUsed++;
+}
+
+// CLOCK (second chance), a ring of slots with a referenced bit each
+int32_t *clockSlots;
+char *clockReferenced;
+int32_t *clockSlotOf;
+uint32_t clockHand = 0;
+
+void clock_init(uint32_t units, uint32_t capacity)
+{
+    clockSlots = malloc(capacity * sizeof(int32_t));
+    clockReferenced = calloc(capacity, 1);
+    clockSlotOf = malloc(units * sizeof(int32_t));
+    for(uint32_t i = 0; i < units; i++) clockSlotOf[i] = -1;
+    cacheCapacity = capacity;
+}
+
+int clock_lookup(uint32_t unit)
+{
+    if(clockSlotOf[unit] < 0) return 0;
+
+    clockReferenced[clockSlotOf[unit]] = 1;
+    return 1;
+}
+
+void clock_insert(uint32_t unit)
+{
+    if(clock_lookup(unit)) return;
+
+    uint32_t slot;
+    if(cacheUsed < cacheCapacity)
+    {
+        slot = cacheUsed++;
+    }
+    else
+    {
+        while(clockReferenced[clockHand])
+        {
+            clockReferenced[clockHand] = 0;
+            clockHand = (clockHand + 1) % cacheCapacity;
+        }
+
+        slot = clockHand;
+        clockSlotOf[clockSlots[slot]] = -1;
+        clockHand = (clockHand + 1) % cacheCapacity;
+    }
+
+    clockSlots[slot] = unit;
+    clockReferenced[slot] = 0;
+    clockSlotOf[unit] = slot;
+}
+
+cache_model_t cacheModels[] = {
+    { "none", none_init, none_lookup, none_insert },
+    { "lru", lru_init, lru_lookup, lru_insert },
+    { "clock", clock_init, clock_lookup, clock_insert },
+};
+
+/*
+ * Elevator models, put a batch of queued requests in the order the disk gets them
+ */
+
+typedef struct
+{
+    const char *name;
+    void (*order)(trace_entry_t **batch, int count);
+
+} elevator_model_t;
+
+int compare_lba(const void *a, const void *b)
+{
+    uint32_t x = (*(trace_entry_t **) a)->lba;
+    uint32_t y = (*(trace_entry_t **) b)->lba;
+    return x < y ? -1 : x > y;
+}
+
+void fifo_order(trace_entry_t **batch, int count) { (void) batch; (void) count; }
+
+void sort_order(trace_entry_t **batch, int count)
+{
+    qsort(batch, count, sizeof(trace_entry_t *), compare_lba);
+}
+
+// Everything at or above the heads going up, then the rest going down
+void scan_order(trace_entry_t **batch, int count)
+{
+    sort_order(batch, count);
+
+    uint32_t headLba = disk.flat ? 0 : diskCylinder * 2 * disk.sectorsPerTrack;
+    int split = 0;
+    while(split < count && batch[split]->lba < headLba) split++;
+
+    trace_entry_t **ordered = malloc(count * sizeof(trace_entry_t *));
+    int n = 0;
+    for(int i = split; i < count; i++) ordered[n++] = batch[i];
+    for(int i = split - 1; i >= 0; i--) ordered[n++] = batch[i];
+
+    memcpy(batch, ordered, count * sizeof(trace_entry_t *));
+    free(ordered);
+}
+
+elevator_model_t elevatorModels[] = {
+    { "fifo", fifo_order },
+    { "sort", sort_order },
+    { "scan", scan_order },
+};
+
+/*
+ * Allocation models, map a traced sector to where it would be on the disk
+ */
+
+typedef struct
+{
+    const char *name;
+    uint32_t (*map)(uint32_t lba, int write);
+
+} allocation_model_t;
+
+uint32_t deviceSectors;
+uint32_t dataStart = 33;
+uint32_t *allocMap;
+uint32_t allocNext;
+
+uint32_t asis_map(uint32_t lba, int write) { (void) write; return lba; }
+
+// Data sectors are laid out one after another in the order they are first touched
+uint32_t packed_map(uint32_t lba, int write)
+{
+    (void) write;
+    if(lba < dataStart) return lba;
+
+    if(allocMap[lba] == UINT32_MAX)
+    {
+        allocMap[lba] = allocNext;
+        allocNext = allocNext + 1 < deviceSectors ? allocNext + 1 : dataStart;
+    }
+    return allocMap[lba];
+}
+
+// Every write of a data sector goes to the next sector of the log, reads find it where it was written last
+uint32_t log_map(uint32_t lba, int write)
+{
+    if(lba < dataStart) return lba;
+
+    if(write)
+    {
+        allocMap[lba] = allocNext;
+        allocNext = allocNext + 1 < deviceSectors ? allocNext + 1 : dataStart;
+    }
+    return allocMap[lba] == UINT32_MAX ? lba : allocMap[lba];
+}
+
+allocation_model_t allocationModels[] = {
+    { "asis", asis_map },
+    { "packed", packed_map },
+    { "log", log_map },
+};
+
+/*
+ * Replay
+ */
+
+cache_model_t *cache = &cacheModels[0];
+elevator_model_t *elevator = &elevatorModels[1];
+allocation_model_t *allocation = &allocationModels[0];
+
+typedef struct
+{
+    uint32_t caller;
+    uint64_t requests;
+    uint64_t sectors;
+    uint64_t diskNs;
+
+} caller_stats_t;
+
+caller_stats_t callers[MAX_CALLERS];
+uint64_t cacheHits = 0;
+uint64_t cacheMisses = 0;
+
+void account_caller(uint32_t caller, uint32_t sectors, uint64_t diskNs)
+{
+    for(int i = 0; i < MAX_CALLERS; i++)
+    {
+        if(callers[i].requests == 0 || callers[i].caller == caller)
+        {
+            callers[i].caller = caller;
+            callers[i].requests++;
+            callers[i].sectors += sectors;
+            callers[i].diskNs += diskNs;
+            return;
+        }
+    }
+}
+
+// Runs one request through the models from "t", returns when it is done
+uint64_t replay_request(trace_entry_t *entry, uint64_t t)
+{
+    uint64_t start = t;
+    int write = entry->op == 'W';
+
+    if(entry->op == 'F') return t;
+
+    // the sectors are mapped one by one and moved in runs that are next to each other on the disk
+    uint32_t runStart = 0;
+    uint32_t runLength = 0;
+
+    for(uint32_t i = 0; i <= entry->count; i++)
+    {
+        uint32_t physical = 0;
+        int needed = 0;
+
+        if(i < entry->count)
+        {
+            physical = allocation->map(entry->lba + i, write);
+            uint32_t unit = physical / cacheUnitSectors;
+
+            if(write)
+            {
+                needed = 1;
+                cache->lookup(unit);
+            }
+            else if(cache->lookup(unit))
+            {
+                cacheHits++;
+            }
+            else
+            {
+                // a miss reads the whole unit
+                cacheMisses++;
+                cache->insert(unit);
+                needed = 1;
+
+                if(cacheUnitSectors > 1)
+                {
+                    if(runLength) t = disk_access(t, runStart, runLength, 0);
+                    runLength = 0;
+
+                    uint32_t first = unit * cacheUnitSectors;
+                    uint32_t count = first + cacheUnitSectors <= deviceSectors ? cacheUnitSectors : deviceSectors - first;
+                    t = disk_access(t, first, count, 0);
+                    needed = 0;
+                }
+            }
+        }
+
+        if(needed && runLength && physical == runStart + runLength)
+        {
+            runLength++;
+            continue;
+        }
+
+        if(runLength) t = disk_access(t, runStart, runLength, write);
+        runLength = 0;
+
+        if(needed)
+        {
+            runStart = physical;
+            runLength = 1;
+        }
+    }
+
+    account_caller(entry->caller, entry->count, t - start);
+    return t;
+}
+
+int usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-d device] [-c none|lru:N[:S]|clock:N[:S]] [-e fifo|sort|scan] [-a asis|packed|log]\n", program);
+    fprintf(stderr, "       [-D dataStart] [-g hd|ed|flat] [-k cylinderSkew] [-r stepMs] <serial log> ...\n");
+    return 1;
+}
+
+double ms(uint64_t ns)
+{
+    return ns / 1e6;
+}
+
+int compare_callers(const void *a, const void *b)
+{
+    uint64_t x = ((const caller_stats_t *) a)->diskNs;
+    uint64_t y = ((const caller_stats_t *) b)->diskNs;
+    return x > y ? -1 : x < y;
+}
+
+int main(int argc, char **argv)
+{
+    const char *deviceName = "fd0";
+    const char *cacheOption = "none";
+    const char *elevatorName = "sort";
+    const char *allocationName = "asis";
+    const char *geometry = 0;
+    int cylinderSkew = 0;
+    int stepMs = 3;
+
+    int i = 1;
+    for(; i < argc && argv[i][0] == '-' && i + 1 < argc; i += 2)
+    {
+        const char *value = argv[i + 1];
+        switch(argv[i][1])
+        {
+            case 'd': deviceName = value; break;
+            case 'c': cacheOption = value; break;
+            case 'e': elevatorName = value; break;
+            case 'a': allocationName = value; break;
+            case 'D': dataStart = atoi(value); break;
+            case 'g': geometry = value; break;
+            case 'k': cylinderSkew = atoi(value); break;
+            case 'r': stepMs = atoi(value); break;
+            default: return usage(argv[0]);
+        }
+    }
+    if(i == argc) return usage(argv[0]);
+
+    for(; i < argc; i++)
+    {
+        if(read_log(argv[i]) != 0) return 1;
+    }
+
+    int device = -1;
+    for(int d = 0; d < MAX_DEVICES; d++)
+    {
+        if(!strcmp(devices[d].name, deviceName)) device = d;
+    }
+    if(device < 0)
+    {
+        fprintf(stderr, "Error: No device %s in the trace\n", deviceName);
+        return 1;
+    }
+    deviceSectors = devices[device].sectors;
+
+    // the models
+    char cacheName[16];
+    uint32_t cacheUnits = 0;
+    unsigned int unitSectors = 1;
+    if(sscanf(cacheOption, "%15[a-z]:%u:%u", cacheName, &cacheUnits, &unitSectors) < 1) return usage(argv[0]);
+    cacheUnitSectors = unitSectors ? unitSectors : 1;
+
+    cache = 0;
+    for(size_t m = 0; m < sizeof(cacheModels) / sizeof(cacheModels[0]); m++)
+    {
+        if(!strcmp(cacheModels[m].name, cacheName)) cache = &cacheModels[m];
+    }
+    elevator = 0;
+    for(size_t m = 0; m < sizeof(elevatorModels) / sizeof(elevatorModels[0]); m++)
+    {
+        if(!strcmp(elevatorModels[m].name, elevatorName)) elevator = &elevatorModels[m];
+    }
+    allocation = 0;
+    for(size_t m = 0; m < sizeof(allocationModels) / sizeof(allocationModels[0]); m++)
+    {
+        if(!strcmp(allocationModels[m].name, allocationName)) allocation = &allocationModels[m];
+    }
+    if(!cache || !elevator || !allocation || (cache != &cacheModels[0] && cacheUnits == 0)) return usage(argv[0]);
+
+    cache->init(deviceSectors / cacheUnitSectors + 1, cacheUnits);
+    allocMap = malloc(deviceSectors * sizeof(uint32_t));
+    for(uint32_t s = 0; s < deviceSectors; s++) allocMap[s] = UINT32_MAX;
+    allocNext = dataStart;
+    disk_setup(geometry, deviceSectors, stepMs, cylinderSkew);
+
+    // the replay: queued requests are gathered into a batch that goes to the disk when something waits for them
+    trace_entry_t **batch = malloc(entryCount * sizeof(trace_entry_t *));
+    int batchCount = 0;
+
+    uint64_t now = 0;               // replay time, ns
+    uint64_t tracedEnd = 0;         // when the previous request finished in the trace, us
+    uint64_t tracedBusy = 0;        // us the traced blk_read()/blk_write() calls took
+    uint64_t syncBusy = 0;          // ns the same calls take in the replay
+    uint64_t maxLatency = 0;
+    int replayed = 0;
+    int synchronous = 0;
+
+    for(int e = 0; e <= entryCount; e++)
+    {
+        trace_entry_t *entry = e < entryCount ? &entries[e] : 0;
+        if(entry && entry->device != device) continue;
+
+        // the think time before this request, as traced
+        if(entry)
+        {
+            if(entry->time > tracedEnd) now += (entry->time - tracedEnd) * 1000;
+            tracedEnd = entry->time + entry->duration;
+        }
+
+        if(entry && entry->async)
+        {
+            batch[batchCount++] = entry;
+            replayed++;
+            continue;
+        }
+
+        // anything else waits for the queued requests
+        if(batchCount)
+        {
+            elevator->order(batch, batchCount);
+            for(int b = 0; b < batchCount; b++) now = replay_request(batch[b], now);
+            batchCount = 0;
+        }
+
+        if(!entry) break;
+
+        uint64_t start = now;
+        now = replay_request(entry, now);
+        replayed++;
+
+        if(entry->op != 'F')
+        {
+            synchronous++;
+            syncBusy += now - start;
+            tracedBusy += entry->duration;
+            if(now - start > maxLatency) maxLatency = now - start;
+        }
+    }
+
+    uint64_t tracedSpan = 0;
+    for(int e = 0; e < entryCount; e++)
+    {
+        if(entries[e].device == device && entries[e].time + entries[e].duration > tracedSpan) tracedSpan = entries[e].time + entries[e].duration;
+    }
+
+    printf("%s: %d requests replayed (%u lost from the ring before the dump)\n", deviceName, replayed, dropped);
+    printf("  models: cache %s, elevator %s, allocation %s, disk %s\n", cacheOption, elevator->name, allocation->name,
+           disk.flat ? "flat" : disk.sectorsPerTrack == 36 ? "ed" : "hd");
+    printf("  traced: %.1f ms up to the last request, %.1f ms in %d blk_read()/blk_write() calls\n", tracedSpan / 1e3, tracedBusy / 1e3, synchronous);
+    printf("  replay: %.1f ms in total, %.1f ms in those calls (%.1f ms at most)\n", ms(now), ms(syncBusy), ms(maxLatency));
+    printf("  disk: %llu commands, %llu sectors read, %llu written, %llu seeks (%llu steps, %.1f ms), rotational wait %.1f ms, transfer %.1f ms\n",
+           (unsigned long long) diskStats.commands, (unsigned long long) diskStats.sectorsRead, (unsigned long long) diskStats.sectorsWritten,
+           (unsigned long long) diskStats.seeks, (unsigned long long) diskStats.steps, ms(diskStats.seekNs), ms(diskStats.rotationNs), ms(diskStats.transferNs));
+    if(cacheHits + cacheMisses) printf("  cache: %llu hits, %llu misses (%.1f%%)\n", (unsigned long long) cacheHits, (unsigned long long) cacheMisses,
+                                       100.0 * cacheHits / (cacheHits + cacheMisses));
+
+    // who the disk time went to, "addr2line -f -e build/kernel.elf <caller>" names them
+    // (after a floppy boot the kernel runs at 0x1000 instead of 0x100000, add 0xFF000 to the address first)
+    qsort(callers, MAX_CALLERS, sizeof(caller_stats_t), compare_callers);
+    printf("  callers by disk time:\n");
+    for(int c = 0; c < 8 && callers[c].requests; c++)
+    {
+        printf("    %08X: %llu requests, %llu sectors, %.1f ms\n", callers[c].caller, (unsigned long long) callers[c].requests,
+               (unsigned long long) callers[c].sectors, ms(callers[c].diskNs));
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,839 @@
+#include "./sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// A model of an 82077AA floppy controller with up to four 3.5" drives, detailed enough to time the driver:
+//
+// - the command, execution and result phases as seen through the MSR and the FIFO, with the driver's
+//   interrupts (IRQ6) raised when an execution phase, a seek or a reset ends
+// - seeks (explicit, in the background, or implied by a READ/WRITE) take a step time per cylinder from
+//   the last SPECIFY plus a settle time, and a head that was unloaded (HUT) takes HLT to load again
+// - the disks turn at 300 rpm, every track has its sectors in the order it was formatted with, and a
+//   sector can only be read or written when it comes around under the head
+// - data moves through the DMA model in machine.c, and a READ/WRITE ends at the terminal count or at EOT
+// - a drive without a running (and spun up) motor, or without a disk, never produces an index pulse,
+//   so a command to it never ends (the driver has to time out)
+//
+// Not modelled: the FIFO threshold and overruns caused by a slow CPU, non-DMA mode, and the exact
+// length of the gaps (the sectors of a track take TRACK_USE percent of a revolution).
+
+#define CYLINDERS 80
+#define MAX_SECTORS 36
+
+#define REVOLUTION MS(200)
+#define INDEX_GAP (REVOLUTION * 3 / 100)
+#define TRACK_USE 94
+#define SETTLE MS(15)
+#define SPIN_UP MS(300)
+#define SECTOR_BYTES 512
+
+enum
+{
+    PHASE_COMMAND,
+    PHASE_EXECUTION,
+    PHASE_RESULT
+};
+
+typedef struct
+{
+    sim_drive_config_t config;
+    uint8_t *data;
+    uint8_t layout[CYLINDERS][2][MAX_SECTORS];  // the sector number in each slot of a track, as formatted
+
+    int cylinder;
+    uint64_t motorOn;           // when the motor was switched on, SIM_NEVER while it is off
+    uint64_t readyAt;           // the heads have settled after the last seek
+    uint64_t lastAccess;        // the head unloads HUT after this
+    int headLoaded;
+
+    // a SEEK or RECALIBRATE running in the background
+    uint64_t seekDone;
+    int seekTarget;
+    int seekHead;
+    int seekFailed;
+
+    // the status SENSE INTERRUPT reports for the last seek
+    int sensePending;
+    uint8_t senseSt0;
+    uint8_t sensePcn;
+
+} drive_t;
+
+drive_t drives[4];
+
+struct
+{
+    uint8_t dor;
+    uint8_t dataRate;
+
+    int phase;
+    uint8_t command[16];
+    int commandLength;
+    uint8_t result[16];
+    int resultLength;
+    int resultNext;
+    uint64_t executionDone;
+
+    int impliedSeek;
+    int pollingDisabled;
+    int lock;
+    int perpendicular;      // one bit per drive
+    int srt;
+    int hut;
+    int hlt;
+
+    int resetSenses;
+    uint64_t resetInterrupt;
+
+} fdc;
+
+uint32_t randomState;
+
+uint32_t fdc_random()
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+// Parameter bytes (with the command byte) of each command, 0 for an invalid one
+const int commandLengths[32] = {
+    [0x02] = 9, [0x03] = 3, [0x04] = 2, [0x05] = 9, [0x06] = 9, [0x07] = 2, [0x08] = 1, [0x09] = 9,
+    [0x0A] = 2, [0x0C] = 9, [0x0D] = 6, [0x0E] = 1, [0x0F] = 3, [0x10] = 1, [0x11] = 9, [0x12] = 2,
+    [0x13] = 4, [0x14] = 1, [0x16] = 9, [0x19] = 9, [0x1D] = 9
+};
+
+const char *commandNames[32] = {
+    [0x02] = "READ TRACK", [0x03] = "SPECIFY", [0x04] = "SENSE DRIVE STATUS", [0x05] = "WRITE DATA",
+    [0x06] = "READ DATA", [0x07] = "RECALIBRATE", [0x08] = "SENSE INTERRUPT", [0x09] = "WRITE DELETED DATA",
+    [0x0A] = "READ ID", [0x0C] = "READ DELETED DATA", [0x0D] = "FORMAT TRACK", [0x0E] = "DUMPREG",
+    [0x0F] = "SEEK", [0x10] = "VERSION", [0x11] = "SCAN EQUAL", [0x12] = "PERPENDICULAR MODE",
+    [0x13] = "CONFIGURE", [0x14] = "LOCK", [0x16] = "VERIFY", [0x19] = "SCAN LOW OR EQUAL",
+    [0x1D] = "SCAN HIGH OR EQUAL"
+};
+
+const char *fdc_command_name(int code)
+{
+    return commandNames[code & 0x1F] ? commandNames[code & 0x1F] : "invalid";
+}
+
+void fdc_init(sim_drive_config_t *configs, int count, uint32_t seed)
+{
+    memset(drives, 0, sizeof(drives));
+    memset(&fdc, 0, sizeof(fdc));
+    randomState = seed ? seed : 1;
+
+    for(int d = 0; d < 4; d++)
+    {
+        drive_t *drive = &drives[d];
+
+        drive->motorOn = SIM_NEVER;
+        drive->seekDone = SIM_NEVER;
+        if(d >= count || !configs[d].present) continue;
+
+        drive->config = configs[d];
+        int sectors = drive->config.sectorsPerTrack;
+
+        // every sector starts out holding its own lba, so the workloads can check what they read
+        drive->data = malloc((size_t) CYLINDERS * 2 * sectors * SECTOR_BYTES);
+        for(uint32_t lba = 0; lba < (uint32_t) CYLINDERS * 2 * sectors; lba++)
+        {
+            uint8_t *sector = drive->data + (size_t) lba * SECTOR_BYTES;
+            for(int i = 0; i < SECTOR_BYTES; i += 4) memcpy(sector + i, &lba, 4);
+        }
+
+        for(int c = 0; c < CYLINDERS; c++)
+        {
+            for(int h = 0; h < 2; h++)
+            {
+                for(int s = 0; s < sectors; s++) drive->layout[c][h][s] = s + 1;
+            }
+        }
+    }
+
+    // what the BIOS leaves behind: out of reset, DMA and interrupts on, no implied seeks, slow timings
+    fdc.dor = 0x0C;
+    fdc.executionDone = SIM_NEVER;
+    fdc.resetInterrupt = SIM_NEVER;
+    fdc.srt = 0xD;
+    fdc.hut = 0xF;
+    fdc.hlt = 1;
+}
+
+/*
+ * Timing
+ */
+
+uint32_t fdc_bits_per_second()
+{
+    static const uint32_t rates[4] = { 500000, 300000, 250000, 1000000 };
+    return rates[fdc.dataRate & 3];
+}
+
+// SPECIFY units are given for 500 Kbps, at 1 Mbps every unit is half as long
+uint64_t fdc_scale(uint64_t ns500k)
+{
+    return (fdc.dataRate & 3) == 3 ? ns500k / 2 : ns500k;
+}
+
+uint64_t fdc_step_time()
+{
+    return fdc_scale(MS(16 - fdc.srt));
+}
+
+uint64_t fdc_head_load_time()
+{
+    return fdc_scale(MS(fdc.hlt ? fdc.hlt * 2 : 256));
+}
+
+uint64_t fdc_head_unload_time()
+{
+    return fdc_scale(MS(fdc.hut ? fdc.hut * 16 : 256));
+}
+
+uint64_t fdc_sector_time()
+{
+    return (uint64_t) SECTOR_BYTES * 8 * 1000000000 / fdc_bits_per_second();
+}
+
+// The drives are not synchronized, each one has its index hole somewhere else
+uint64_t fdc_index_offset(int d)
+{
+    return d * (REVOLUTION / 3);
+}
+
+// The first time at or after "t" that slot "slot" of a track with "sectors" sectors starts under the head of drive "d"
+uint64_t fdc_slot_time(int d, int slot, int sectors, uint64_t t)
+{
+    uint64_t slotTime = REVOLUTION * TRACK_USE / 100 / sectors;
+    uint64_t position = INDEX_GAP + slot * slotTime;
+    uint64_t phase = (t + REVOLUTION - fdc_index_offset(d)) % REVOLUTION;
+
+    return t + ((position + REVOLUTION - phase) % REVOLUTION);
+}
+
+// Moves the heads of a drive for a READ/WRITE (implied seek), returns the time they have settled
+uint64_t fdc_implied_seek(drive_t *drive, int cylinder, uint64_t t)
+{
+    if(drive->seekDone != SIM_NEVER && drive->seekDone > t) t = drive->seekDone;
+
+    int steps = abs(cylinder - drive->cylinder);
+    if(steps == 0) return t > drive->readyAt ? t : drive->readyAt;
+
+    simStats.seeks++;
+    simStats.steps += steps;
+    simStats.seekNs += steps * fdc_step_time() + SETTLE;
+
+    drive->cylinder = cylinder;
+    drive->readyAt = t + steps * fdc_step_time() + SETTLE;
+    return drive->readyAt;
+}
+
+// Waits for the disk to be turning at speed, returns 0 if it never will (no disk, motor off)
+int fdc_spinning(drive_t *drive, int d, uint64_t *t)
+{
+    if(!drive->config.present || drive->motorOn == SIM_NEVER || !(fdc.dor & (0x10 << d))) return 0;
+
+    if(*t < drive->motorOn + SPIN_UP)
+    {
+        simStats.spinUpNs += drive->motorOn + SPIN_UP - *t;
+        *t = drive->motorOn + SPIN_UP;
+    }
+    return 1;
+}
+
+// Loads the head if it was unloaded
+uint64_t fdc_load_head(drive_t *drive, uint64_t t)
+{
+    if(!drive->headLoaded || t - drive->lastAccess > fdc_head_unload_time())
+    {
+        t += fdc_head_load_time();
+        drive->headLoaded = 1;
+    }
+    return t;
+}
+
+// The disk can be read at the current data rate (a 2.88 MB disk also needs perpendicular mode)
+int fdc_readable(drive_t *drive, int d)
+{
+    int rate = drive->config.sectorsPerTrack == 36 ? 3 : 0;
+    int perpendicular = drive->config.sectorsPerTrack == 36;
+
+    return (fdc.dataRate & 3) == rate && (((fdc.perpendicular >> d) & 1) == perpendicular || !perpendicular);
+}
+
+int fdc_find_slot(drive_t *drive, int head, int sector)
+{
+    for(int slot = 0; slot < drive->config.sectorsPerTrack; slot++)
+    {
+        if(drive->layout[drive->cylinder][head][slot] == sector) return slot;
+    }
+    return -1;
+}
+
+/*
+ * Phases
+ */
+
+void fdc_interrupt()
+{
+    if(fdc.dor & 0x08) sim_raise_irq(6);
+}
+
+void fdc_results(const uint8_t *bytes, int length)
+{
+    memcpy(fdc.result, bytes, length);
+    fdc.resultLength = length;
+    fdc.resultNext = 0;
+    fdc.phase = length ? PHASE_RESULT : PHASE_COMMAND;
+}
+
+// Starts an execution phase that ends at "done" with these result bytes
+void fdc_execute_until(uint64_t done, const uint8_t *bytes, int length)
+{
+    memcpy(fdc.result, bytes, length);
+    fdc.resultLength = length;
+    fdc.resultNext = 0;
+    fdc.phase = PHASE_EXECUTION;
+    fdc.executionDone = done;
+
+    if(done == SIM_NEVER) simStats.timeouts++;
+}
+
+void fdc_reset()
+{
+    fdc.phase = PHASE_COMMAND;
+    fdc.commandLength = 0;
+    fdc.resultLength = 0;
+    fdc.executionDone = SIM_NEVER;
+
+    for(int d = 0; d < 4; d++)
+    {
+        drives[d].seekDone = SIM_NEVER;
+        drives[d].sensePending = 0;
+    }
+
+    if(!fdc.lock)
+    {
+        fdc.impliedSeek = 0;
+        fdc.pollingDisabled = 0;
+    }
+
+    // with polling on the controller reports a "ready changed" status for each drive after a reset
+    fdc.resetSenses = fdc.pollingDisabled ? 0 : 4;
+    fdc.resetInterrupt = simNow + US(10);
+}
+
+/*
+ * Commands
+ */
+
+void fdc_seek(int d, int head, int target, int recalibrate)
+{
+    drive_t *drive = &drives[d];
+    int steps = abs(target - drive->cylinder);
+
+    // a recalibrate without a drive steps 79 times without ever seeing track 0
+    drive->seekFailed = recalibrate && !drive->config.present;
+    if(drive->seekFailed) steps = 79;
+
+    if(steps)
+    {
+        simStats.seeks++;
+        simStats.steps += steps;
+        simStats.seekNs += steps * fdc_step_time() + SETTLE;
+    }
+
+    drive->seekTarget = target;
+    drive->seekHead = head;
+    drive->seekDone = simNow + (steps ? steps * fdc_step_time() : US(20));
+    drive->readyAt = drive->seekDone + (steps ? SETTLE : 0);
+
+    fdc.phase = PHASE_COMMAND;
+}
+
+void fdc_seek_end(int d)
+{
+    drive_t *drive = &drives[d];
+
+    drive->seekDone = SIM_NEVER;
+    drive->cylinder = drive->seekTarget;
+    drive->sensePending = 1;
+    drive->senseSt0 = 0x20 | (drive->seekHead << 2) | d;
+    drive->sensePcn = drive->seekTarget;
+
+    // abnormal termination, equipment check
+    if(drive->seekFailed) drive->senseSt0 |= 0x50;
+
+    fdc_interrupt();
+}
+
+void fdc_sense_interrupt()
+{
+    if(fdc.resetSenses > 0)
+    {
+        uint8_t bytes[2] = { 0xC0 | (4 - fdc.resetSenses), 0 };
+        fdc.resetSenses--;
+        fdc_results(bytes, 2);
+        return;
+    }
+
+    for(int d = 0; d < 4; d++)
+    {
+        if(drives[d].sensePending)
+        {
+            uint8_t bytes[2] = { drives[d].senseSt0, drives[d].sensePcn };
+            drives[d].sensePending = 0;
+            fdc_results(bytes, 2);
+            return;
+        }
+    }
+
+    // nothing to report: a single "invalid command" byte
+    uint8_t invalid = 0x80;
+    fdc_results(&invalid, 1);
+}
+
+// READ DATA, WRITE DATA and VERIFY (READ TRACK and the deleted data variants are treated as READ/WRITE DATA)
+void fdc_read_write(int code)
+{
+    uint8_t *c = fdc.command;
+    int multiTrack = c[0] & 0x80;
+    int d = c[1] & 3;
+    int head = (c[1] >> 2) & 1;
+    int cylinder = c[2];
+    int sector = c[4];
+    int eot = c[6];
+    int write = code == 0x05 || code == 0x09;
+    int verify = code == 0x16;
+    int count = verify && (c[1] & 0x80) ? c[8] : -1;  // VERIFY with EC set counts sectors
+
+    drive_t *drive = &drives[d];
+    uint64_t t = simNow;
+    uint8_t st0 = 0;
+    uint8_t st1 = 0;
+    uint8_t st2 = 0;
+
+    if(!fdc_spinning(drive, d, &t))
+    {
+        fdc_execute_until(SIM_NEVER, 0, 0);
+        return;
+    }
+
+    if(fdc.impliedSeek) t = fdc_implied_seek(drive, cylinder, t);
+    else if(drive->seekDone != SIM_NEVER && drive->seekDone > t) t = drive->seekDone;
+    if(drive->readyAt > t) t = drive->readyAt;
+    t = fdc_load_head(drive, t);
+
+    if(!fdc_readable(drive, d))
+    {
+        // no address marks at this rate, given up after two index pulses
+        t += 2 * REVOLUTION;
+        st0 = 0x40;
+        st1 = 0x01;
+    }
+    else if(drive->cylinder != cylinder)
+    {
+        t += 2 * REVOLUTION;
+        st0 = 0x40;
+        st1 = 0x04;
+        st2 = 0x10;
+    }
+    else
+    {
+        while(1)
+        {
+            int slot = fdc_find_slot(drive, head, sector);
+            if(slot < 0)
+            {
+                t += 2 * REVOLUTION;
+                st0 = 0x40;
+                st1 = 0x04;
+                break;
+            }
+
+            uint64_t start = fdc_slot_time(d, slot, drive->config.sectorsPerTrack, t);
+            simStats.rotationNs += start - t;
+            simStats.transferNs += fdc_sector_time();
+            t = start + fdc_sector_time();
+
+            uint32_t lba = ((uint32_t) drive->cylinder * 2 + head) * drive->config.sectorsPerTrack + sector - 1;
+            uint8_t *data = drive->data + (size_t) lba * SECTOR_BYTES;
+            int terminalCount = 0;
+
+            if(!write && (fdc_random() % 1000000) < (uint32_t) drive->config.errorsPerMillion)
+            {
+                simStats.injectedErrors++;
+                st0 = 0x40;
+                st1 = 0x20;
+                st2 = 0x20;
+                break;
+            }
+
+            if(verify)
+            {
+                simStats.sectorsVerified++;
+            }
+            else
+            {
+                // the terminal count ends the command normally, even partway through a sector
+                if(sim_dma_transfer(data, SECTOR_BYTES, !write, &terminalCount) < SECTOR_BYTES && !terminalCount)
+                {
+                    st0 = 0x40;
+                    st1 = 0x10;
+                    break;
+                }
+
+                if(write) simStats.sectorsWritten++;
+                else simStats.sectorsRead++;
+            }
+
+            if(terminalCount || --count == 0)
+            {
+                sector++;
+                break;
+            }
+
+            if(sector == eot)
+            {
+                if(multiTrack && head == 0)
+                {
+                    head = 1;
+                    sector = 1;
+                    continue;
+                }
+
+                // a VERIFY (without EC) is meant to stop at EOT, anything else ran off the end of the cylinder
+                if(!verify)
+                {
+                    st0 = 0x40;
+                    st1 = 0x80;
+                }
+                sector++;
+                break;
+            }
+
+            sector++;
+        }
+    }
+
+    drive->lastAccess = t;
+
+    uint8_t bytes[7] = { st0 | (head << 2) | d, st1, st2, cylinder, head, sector, c[5] };
+    fdc_execute_until(t, bytes, 7);
+}
+
+void fdc_read_id()
+{
+    int d = fdc.command[1] & 3;
+    int head = (fdc.command[1] >> 2) & 1;
+    drive_t *drive = &drives[d];
+    uint64_t t = simNow;
+
+    if(!fdc_spinning(drive, d, &t))
+    {
+        fdc_execute_until(SIM_NEVER, 0, 0);
+        return;
+    }
+
+    if(drive->readyAt > t) t = drive->readyAt;
+    t = fdc_load_head(drive, t);
+
+    uint8_t bytes[7] = { 0x40 | (head << 2) | d, 0x01, 0, drive->cylinder, head, 0, 2 };
+
+    if(!fdc_readable(drive, d))
+    {
+        t += 2 * REVOLUTION;
+    }
+    else
+    {
+        // the first ID field that comes along
+        uint64_t first = SIM_NEVER;
+        for(int slot = 0; slot < drive->config.sectorsPerTrack; slot++)
+        {
+            uint64_t start = fdc_slot_time(d, slot, drive->config.sectorsPerTrack, t);
+            if(start < first)
+            {
+                first = start;
+                bytes[5] = drive->layout[drive->cylinder][head][slot];
+            }
+        }
+
+        t = first + US(100);
+        bytes[0] = (head << 2) | d;
+        bytes[1] = 0;
+    }
+
+    drive->lastAccess = t;
+    fdc_execute_until(t, bytes, 7);
+}
+
+// FORMAT TRACK: the sector IDs (C, H, R, N for each sector) come in over DMA, the track is written in one revolution from the index
+void fdc_format()
+{
+    uint8_t *c = fdc.command;
+    int d = c[1] & 3;
+    int head = (c[1] >> 2) & 1;
+    int sectors = c[3];
+    drive_t *drive = &drives[d];
+    uint64_t t = simNow;
+
+    if(!fdc_spinning(drive, d, &t))
+    {
+        fdc_execute_until(SIM_NEVER, 0, 0);
+        return;
+    }
+
+    if(drive->readyAt > t) t = drive->readyAt;
+    t = fdc_load_head(drive, t);
+
+    uint8_t bytes[7] = { (head << 2) | d, 0, 0, drive->cylinder, head, sectors, c[2] };
+
+    if(!fdc_readable(drive, d) || sectors > drive->config.sectorsPerTrack)
+    {
+        // the sectors would not fit on the track at this rate
+        bytes[0] |= 0x40;
+        bytes[1] = 0x10;
+        fdc_execute_until(t + 2 * REVOLUTION, bytes, 7);
+        return;
+    }
+
+    uint8_t ids[4 * MAX_SECTORS];
+    int terminalCount;
+    if(sim_dma_transfer(ids, 4 * sectors, 0, &terminalCount) < 4 * sectors)
+    {
+        bytes[0] |= 0x40;
+        bytes[1] = 0x10;
+        fdc_execute_until(t + 2 * REVOLUTION, bytes, 7);
+        return;
+    }
+
+    // wait for the index hole, then one revolution
+    uint64_t index = fdc_slot_time(d, 0, 1, t) - INDEX_GAP;
+    if(index < t) index += REVOLUTION;
+    simStats.rotationNs += index - t;
+    t = index + REVOLUTION;
+
+    for(int slot = 0; slot < MAX_SECTORS; slot++)
+    {
+        drive->layout[drive->cylinder][head][slot] = slot < sectors ? ids[(4 * slot) + 2] : 0;
+    }
+
+    uint32_t first = ((uint32_t) drive->cylinder * 2 + head) * drive->config.sectorsPerTrack;
+    memset(drive->data + (size_t) first * SECTOR_BYTES, c[5], (size_t) drive->config.sectorsPerTrack * SECTOR_BYTES);
+    simStats.sectorsWritten += sectors;
+
+    drive->lastAccess = t;
+    fdc_execute_until(t, bytes, 7);
+}
+
+void fdc_execute()
+{
+    uint8_t *c = fdc.command;
+    int code = c[0] & 0x1F;
+    simStats.commands[code]++;
+
+    switch(code)
+    {
+        case 0x03:
+            fdc.srt = c[1] >> 4;
+            fdc.hut = c[1] & 0xF;
+            fdc.hlt = c[2] >> 1;
+            fdc_results(0, 0);
+            break;
+
+        case 0x04:
+        {
+            drive_t *drive = &drives[c[1] & 3];
+            uint8_t st3 = 0x28 | (drive->cylinder == 0 ? 0x10 : 0) | (c[1] & 7);
+            fdc_results(&st3, 1);
+            break;
+        }
+
+        case 0x07: fdc_seek(c[1] & 3, 0, 0, 1); break;
+        case 0x0F: fdc_seek(c[1] & 3, (c[1] >> 2) & 1, c[2], 0); break;
+        case 0x08: fdc_sense_interrupt(); break;
+        case 0x0A: fdc_read_id(); break;
+        case 0x0D: fdc_format(); break;
+
+        case 0x0E:
+        {
+            uint8_t bytes[10] = { drives[0].cylinder, drives[1].cylinder, drives[2].cylinder, drives[3].cylinder,
+                                  (fdc.srt << 4) | fdc.hut, fdc.hlt << 1, 0, fdc.lock << 7,
+                                  (fdc.impliedSeek ? 0x40 : 0) | (fdc.pollingDisabled ? 0x10 : 0), 0 };
+            fdc_results(bytes, 10);
+            break;
+        }
+
+        case 0x10:
+        {
+            uint8_t version = 0x90;
+            fdc_results(&version, 1);
+            break;
+        }
+
+        case 0x12:
+            if(c[1] & 0x80) fdc.perpendicular = (c[1] >> 2) & 0xF;
+            fdc_results(0, 0);
+            break;
+
+        case 0x13:
+            fdc.impliedSeek = (c[2] & 0x40) != 0;
+            fdc.pollingDisabled = (c[2] & 0x10) != 0;
+            fdc_results(0, 0);
+            break;
+
+        case 0x14:
+        {
+            fdc.lock = c[0] >> 7;
+            uint8_t locked = fdc.lock << 4;
+            fdc_results(&locked, 1);
+            break;
+        }
+
+        case 0x02: case 0x05: case 0x06: case 0x09: case 0x0C: case 0x16:
+            fdc_read_write(code);
+            break;
+
+        default:
+        {
+            uint8_t invalid = 0x80;
+            fdc_results(&invalid, 1);
+            break;
+        }
+    }
+}
+
+/*
+ * Events
+ */
+
+uint64_t fdc_next_event()
+{
+    uint64_t next = fdc.executionDone;
+    if(fdc.resetInterrupt < next) next = fdc.resetInterrupt;
+
+    for(int d = 0; d < 4; d++)
+    {
+        if(drives[d].seekDone < next) next = drives[d].seekDone;
+    }
+    return next;
+}
+
+void fdc_run_events()
+{
+    if(fdc.executionDone <= simNow)
+    {
+        fdc.executionDone = SIM_NEVER;
+        fdc.phase = fdc.resultLength ? PHASE_RESULT : PHASE_COMMAND;
+        fdc_interrupt();
+    }
+
+    if(fdc.resetInterrupt <= simNow)
+    {
+        fdc.resetInterrupt = SIM_NEVER;
+        fdc_interrupt();
+    }
+
+    for(int d = 0; d < 4; d++)
+    {
+        if(drives[d].seekDone <= simNow) fdc_seek_end(d);
+    }
+}
+
+/*
+ * Registers
+ */
+
+uint8_t fdc_inb(uint16_t port)
+{
+    uint8_t seeking = 0;
+    for(int d = 0; d < 4; d++)
+    {
+        if(drives[d].seekDone != SIM_NEVER) seeking |= 1 << d;
+    }
+
+    switch(port)
+    {
+        case 0x3F2:
+            return fdc.dor;
+
+        case 0x3F4:
+            if(!(fdc.dor & 0x04)) return 0;
+            if(fdc.phase == PHASE_EXECUTION) return 0x10 | seeking;
+            if(fdc.phase == PHASE_RESULT) return 0xD0 | seeking;
+            return 0x80 | (fdc.commandLength ? 0x10 : 0) | seeking;
+
+        case 0x3F5:
+        {
+            if(fdc.phase != PHASE_RESULT)
+            {
+                simStats.protocolErrors++;
+                return 0;
+            }
+
+            uint8_t value = fdc.result[fdc.resultNext++];
+            if(fdc.resultNext == fdc.resultLength)
+            {
+                fdc.phase = PHASE_COMMAND;
+                fdc.commandLength = 0;
+            }
+            return value;
+        }
+
+        case 0x3F7:
+            return 0;
+    }
+
+    return 0xFF;
+}
+
+void fdc_outb(uint16_t port, uint8_t value)
+{
+    switch(port)
+    {
+        case 0x3F2:
+        {
+            uint8_t old = fdc.dor;
+            fdc.dor = value;
+
+            for(int d = 0; d < 4; d++)
+            {
+                int on = (value >> (4 + d)) & 1;
+                if(on && drives[d].motorOn == SIM_NEVER) drives[d].motorOn = simNow;
+                if(!on) drives[d].motorOn = SIM_NEVER;
+            }
+
+            if(!(old & 0x04) && (value & 0x04)) fdc_reset();
+            break;
+        }
+
+        case 0x3F4:
+            fdc.dataRate = value & 3;
+            if(value & 0x80) fdc_reset();
+            break;
+
+        case 0x3F7:
+            fdc.dataRate = value & 3;
+            break;
+
+        case 0x3F5:
+            if(!(fdc.dor & 0x04) || fdc.phase != PHASE_COMMAND)
+            {
+                simStats.protocolErrors++;
+                break;
+            }
+
+            fdc.command[fdc.commandLength++] = value;
+
+            int length = commandLengths[fdc.command[0] & 0x1F];
+            if(length == 0 || fdc.commandLength >= length)
+            {
+                fdc.commandLength = 0;
+                fdc_execute();
+            }
+            break;
+    }
+}
\ No newline at end of file
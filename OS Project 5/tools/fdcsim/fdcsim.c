@@ -0,0 +1,442 @@
+// Runs the floppy driver (src/fdc.c, src/dma.c, src/blkdev.c) on a simulated PC (see machine.c and fdc82077.c)
+// and reports how long each workload takes on the disk, and what the driver made the controller do
+// Usage: fdcsim [-e errorsPerMillion] [-s seed] [-x] [-1] [-V] [-q] [-t traceFile] workload[:count] ...
+//
+//   -e  inject CRC errors on reads and VERIFYs      -x  2.88 MB disks in 2.88 MB drives
+//   -s  seed for the injected errors and "random"   -1  only drive 0
+//   -V  verified writes (floppy_set_verify())       -q  hide the driver's messages
+//   -t  write the block trace of the workloads to a file, for tools/blkreplay.c (see blktrace.c)
+//
+// Workloads (count defaults in brackets):
+//   seq     blk_read() a cylinder at a time [80 cylinders]      track   floppy_read() a track at a time [160 tracks]
+//   random  blk_read() single random sectors [100]              write   blk_write() a cylinder at a time [80 cylinders]
+//   stream  floppy_stream_next() whole tracks [160 tracks]      queue   blk_submit() random 4 KB reads, then wait [32]
+//   skew    floppy_benchmark_skew() on 10 cylinders of drive 1 (or 0), formatting them
+//   volume  the same reads from fd0 alone and from "md0" striped over both drives (see volume.c): the first
+//           [80] cylinders of data read in order in 4 KB blk_submit() batches, then 64 random 4 KB reads of it
+//
+// Every sector of the simulated disks holds its own lba (repeated), reads are checked against that
+
+#include "./sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    const char *name;
+    int defaultCount;
+    int (*run)(block_device_t *device, int count);
+
+} workload_t;
+
+int dataErrors = 0;
+uint32_t randomSeed = 1;
+
+uint32_t workload_random()
+{
+    randomSeed = randomSeed * 1103515245 + 12345;
+    return randomSeed >> 8;
+}
+
+void fill_sectors(uint8_t *buffer, uint32_t lba, uint32_t count)
+{
+    for(uint32_t s = 0; s < count; s++, lba++)
+    {
+        for(int i = 0; i < BLOCK_SIZE; i += 4) memcpy(buffer + (s * BLOCK_SIZE) + i, &lba, 4);
+    }
+}
+
+void check_sectors(const uint8_t *buffer, uint32_t lba, uint32_t count)
+{
+    for(uint32_t s = 0; s < count; s++, lba++)
+    {
+        for(int i = 0; i < BLOCK_SIZE; i += 4)
+        {
+            uint32_t value;
+            memcpy(&value, buffer + (s * BLOCK_SIZE) + i, 4);
+            if(value != lba)
+            {
+                dataErrors++;
+                break;
+            }
+        }
+    }
+}
+
+uint32_t cylinder_sectors(block_device_t *device)
+{
+    return device->sectors / 80;
+}
+
+/*
+ * Workloads, each returns how many bytes it moved, or -1 if the driver reported an error
+ */
+
+int run_seq(block_device_t *device, int count)
+{
+    uint32_t sectors = cylinder_sectors(device);
+    uint8_t *buffer = sim_alloc(sectors * BLOCK_SIZE);
+
+    for(int cyl = 0; cyl < count && cyl < 80; cyl++)
+    {
+        if(blk_read(device, cyl * sectors, buffer, sectors) != 0) return -1;
+        check_sectors(buffer, cyl * sectors, sectors);
+    }
+    return (count < 80 ? count : 80) * sectors * BLOCK_SIZE;
+}
+
+int run_track(block_device_t *device, int count)
+{
+    uint32_t sectors = cylinder_sectors(device) / 2;
+    uint8_t *buffer = sim_alloc(sectors * BLOCK_SIZE);
+    int drive = (int) (uintptr_t) device->private;
+
+    for(int track = 0; track < count && track < 160; track++)
+    {
+        if(floppy_read(drive, track * sectors, buffer, sectors * BLOCK_SIZE) != 0) return -1;
+        check_sectors(buffer, track * sectors, sectors);
+    }
+    return (count < 160 ? count : 160) * sectors * BLOCK_SIZE;
+}
+
+int run_random(block_device_t *device, int count)
+{
+    uint8_t *buffer = sim_alloc(BLOCK_SIZE);
+
+    for(int i = 0; i < count; i++)
+    {
+        uint32_t lba = workload_random() % device->sectors;
+        if(blk_read(device, lba, buffer, 1) != 0) return -1;
+        check_sectors(buffer, lba, 1);
+    }
+    return count * BLOCK_SIZE;
+}
+
+// Writes every sector with the lba it already holds, so later reads still check out
+int run_write(block_device_t *device, int count)
+{
+    uint32_t sectors = cylinder_sectors(device);
+    uint8_t *buffer = sim_alloc(sectors * BLOCK_SIZE);
+
+    for(int cyl = 0; cyl < count && cyl < 80; cyl++)
+    {
+        fill_sectors(buffer, cyl * sectors, sectors);
+        if(blk_write(device, cyl * sectors, buffer, sectors) != 0) return -1;
+    }
+    return (count < 80 ? count : 80) * sectors * BLOCK_SIZE;
+}
+
+int run_stream(block_device_t *device, int count)
+{
+    int drive = (int) (uintptr_t) device->private;
+    uint32_t tracks = device->sectors / (STREAM_TRACK_SIZE / BLOCK_SIZE);
+    if((uint32_t) count > tracks) count = tracks;
+
+    if(floppy_stream_start(drive, 0, count) != 0) return -1;
+
+    for(int track = 0; track < count; track++)
+    {
+        uint8_t *data = floppy_stream_next();
+        if(!data)
+        {
+            floppy_stream_stop();
+            return -1;
+        }
+
+        check_sectors(data, track * (STREAM_TRACK_SIZE / BLOCK_SIZE), STREAM_TRACK_SIZE / BLOCK_SIZE);
+        floppy_stream_release();
+    }
+
+    floppy_stream_stop();
+    return count * STREAM_TRACK_SIZE;
+}
+
+#define QUEUE_SECTORS 8
+
+int run_queue(block_device_t *device, int count)
+{
+    block_request_t *requests = calloc(count, sizeof(block_request_t));
+    int failed = 0;
+
+    for(int i = 0; i < count; i++)
+    {
+        requests[i].lba = workload_random() % (device->sectors - QUEUE_SECTORS);
+        requests[i].count = QUEUE_SECTORS;
+        requests[i].buffer = sim_alloc(QUEUE_SECTORS * BLOCK_SIZE);
+        if(blk_submit(device, &requests[i]) != 0) failed = 1;
+    }
+
+    for(int i = 0; i < count; i++)
+    {
+        if(blk_wait(&requests[i]) != 0) failed = 1;
+        else check_sectors(requests[i].buffer, requests[i].lba, QUEUE_SECTORS);
+    }
+
+    free(requests);
+    return failed ? -1 : count * QUEUE_SECTORS * BLOCK_SIZE;
+}
+
+int run_skew(block_device_t *device, int count)
+{
+    (void) count;
+    int drive = floppy_drive_present(1) ? 1 : (int) (uintptr_t) device->private;
+
+    if(floppy_benchmark_skew(drive, 10, 10, FLOPPY_HEAD_SKEW, FLOPPY_CYLINDER_SKEW) != 0) return -1;
+    return 2 * 10 * cylinder_sectors(device) * BLOCK_SIZE;
+}
+
+// Reads "count" 4 KB requests at "lbas" in blk_submit() batches of a queue's length (like prefetchFile())
+// Returns the simulated time it took, or 0 if a request failed
+#define VOLUME_BATCH 32
+
+uint64_t volume_reads(block_device_t *device, uint32_t *lbas, int count)
+{
+    block_request_t requests[VOLUME_BATCH];
+    uint64_t start = simNow;
+
+    for(int first = 0; first < count; first += VOLUME_BATCH)
+    {
+        int batch = count - first < VOLUME_BATCH ? count - first : VOLUME_BATCH;
+
+        for(int i = 0; i < batch; i++)
+        {
+            memset(&requests[i], 0, sizeof(block_request_t));
+            requests[i].lba = lbas[first + i];
+            requests[i].count = QUEUE_SECTORS;
+            requests[i].buffer = sim_alloc(QUEUE_SECTORS * BLOCK_SIZE);
+            if(blk_submit(device, &requests[i]) != 0) return 0;
+        }
+
+        for(int i = 0; i < batch; i++)
+        {
+            if(blk_wait(&requests[i]) != 0) return 0;
+
+            // a member's sectors hold the member's own lbas
+            for(uint32_t s = 0; s < QUEUE_SECTORS; s++)
+            {
+                int member = 0;
+                uint32 lba = requests[i].lba + s;
+                if(device != blk_get("fd0")) volume_map(lba, 1, &member, &lba);
+                check_sectors(requests[i].buffer + (s * BLOCK_SIZE), lba, 1);
+            }
+        }
+    }
+
+    return simNow - start;
+}
+
+int run_volume(block_device_t *device, int count)
+{
+    if(!blk_get("md0") && volume_create("md0", VOLUME_STRIPE, "fd0", "fd1") < 0) return -1;
+
+    uint32_t sectors = (count < 80 ? count : 80) * cylinder_sectors(device);
+    int sequential = sectors / QUEUE_SECTORS;
+    int random = 64;
+
+    uint32_t *lbas = malloc((sequential + random) * sizeof(uint32_t));
+    for(int i = 0; i < sequential; i++) lbas[i] = i * QUEUE_SECTORS;
+    for(int i = 0; i < random; i++) lbas[sequential + i] = (workload_random() % (sectors / QUEUE_SECTORS)) * QUEUE_SECTORS;
+
+    const char *names[2] = { "fd0", "md0" };
+    for(int d = 0; d < 2; d++)
+    {
+        block_device_t *target = blk_get((char *) names[d]);
+        uint64_t inOrder = volume_reads(target, lbas, sequential);
+        uint64_t scattered = volume_reads(target, lbas + sequential, random);
+        if(inOrder == 0 || scattered == 0) return -1;
+
+        printf("  %s: %u sectors in order %.1f ms (%.1f KB/s), %d random 4 KB reads %.1f ms\n", names[d], sectors,
+               inOrder / 1e6, sectors / 2.0 / (inOrder / 1e9), random, scattered / 1e6);
+    }
+
+    free(lbas);
+    return 2 * (sectors + (random * QUEUE_SECTORS)) * BLOCK_SIZE;
+}
+
+workload_t workloads[] = {
+    { "seq", 80, run_seq },
+    { "track", 160, run_track },
+    { "random", 100, run_random },
+    { "write", 80, run_write },
+    { "stream", 160, run_stream },
+    { "queue", 32, run_queue },
+    { "skew", 1, run_skew },
+    { "volume", 80, run_volume },
+};
+
+/*
+ * Report
+ */
+
+double ms(uint64_t ns)
+{
+    return ns / 1e6;
+}
+
+void report(const char *name, int bytes, uint64_t elapsed, const sim_stats_t *before)
+{
+    sim_stats_t d;
+    const uint64_t *a = (const uint64_t *) before;
+    const uint64_t *b = (const uint64_t *) &simStats;
+    uint64_t *out = (uint64_t *) &d;
+    for(size_t i = 0; i < sizeof(sim_stats_t) / sizeof(uint64_t); i++) out[i] = b[i] - a[i];
+
+    printf("\n== %s ==\n", name);
+    if(bytes < 0) printf("  FAILED (the driver reported an error)\n");
+    else printf("  %d bytes in %.1f ms, %.1f KB/s\n", bytes, ms(elapsed), elapsed ? bytes / 1024.0 / (elapsed / 1e9) : 0);
+
+    printf("  commands:");
+    for(int code = 0; code < 32; code++)
+    {
+        if(d.commands[code]) printf(" %s %llu,", fdc_command_name(code), (unsigned long long) d.commands[code]);
+    }
+    printf("\n");
+
+    printf("  seeks %llu (%llu steps, %.1f ms), rotational wait %.1f ms, transfer %.1f ms, spin-up wait %.1f ms\n",
+           (unsigned long long) d.seeks, (unsigned long long) d.steps, ms(d.seekNs), ms(d.rotationNs), ms(d.transferNs), ms(d.spinUpNs));
+    printf("  sectors read %llu, written %llu, verified %llu, DMA %llu bytes, IRQs %llu, port reads %llu, writes %llu\n",
+           (unsigned long long) d.sectorsRead, (unsigned long long) d.sectorsWritten, (unsigned long long) d.sectorsVerified,
+           (unsigned long long) d.dmaBytes, (unsigned long long) d.irqs, (unsigned long long) d.portReads, (unsigned long long) d.portWrites);
+
+    if(d.injectedErrors || d.timeouts || d.protocolErrors)
+    {
+        printf("  injected errors %llu, commands that never ended %llu, protocol errors %llu\n",
+               (unsigned long long) d.injectedErrors, (unsigned long long) d.timeouts, (unsigned long long) d.protocolErrors);
+    }
+}
+
+void report_driver(int drive)
+{
+    floppy_stats_t stats;
+    if(floppy_get_stats(drive, &stats) != 0) return;
+
+    printf("  driver fd%d: seeks %u (%u errors), reads %u (%u errors), writes %u (%u errors), verifies %u (%u errors)\n",
+           drive, stats.seeks, stats.seekErrors, stats.reads, stats.readErrors, stats.writes, stats.writeErrors,
+           stats.verifies, stats.verifyErrors);
+    printf("  timings level %u: step rate %u ms, head load %u ms, head unload %u ms\n",
+           stats.level, stats.stepRate, stats.headLoad, stats.headUnload);
+}
+
+int usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-e errorsPerMillion] [-s seed] [-x] [-1] [-V] [-q] [-t traceFile] workload[:count] ...\n", program);
+    fprintf(stderr, "Workloads:");
+    for(size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) fprintf(stderr, " %s", workloads[i].name);
+    fprintf(stderr, "\n");
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    int errorsPerMillion = 0;
+    int extraDensity = 0;
+    int drives = 2;
+    int verify = 0;
+    int first = 1;
+
+    for(; first < argc && argv[first][0] == '-'; first++)
+    {
+        const char *option = argv[first];
+        if(!strcmp(option, "-e") && first + 1 < argc) errorsPerMillion = atoi(argv[++first]);
+        else if(!strcmp(option, "-s") && first + 1 < argc) randomSeed = (uint32_t) strtoul(argv[++first], 0, 0);
+        else if(!strcmp(option, "-x")) extraDensity = 1;
+        else if(!strcmp(option, "-1")) drives = 1;
+        else if(!strcmp(option, "-V")) verify = 1;
+        else if(!strcmp(option, "-q")) simQuiet = 1;
+        else if(!strcmp(option, "-t") && first + 1 < argc)
+        {
+            simSerial = fopen(argv[++first], "w");
+            if(!simSerial)
+            {
+                perror(argv[first]);
+                return 1;
+            }
+        }
+        else return usage(argv[0]);
+    }
+    if(first == argc) return usage(argv[0]);
+
+    if(sim_memory_init() != 0) return 1;
+
+    sim_drive_config_t configs[2];
+    for(int d = 0; d < 2; d++)
+    {
+        configs[d].present = d < drives;
+        configs[d].cmosType = extraDensity ? 5 : 4;
+        configs[d].sectorsPerTrack = extraDensity ? 36 : 18;
+        configs[d].errorsPerMillion = errorsPerMillion;
+    }
+
+    uint8_t cmos = configs[0].cmosType << 4;
+    if(drives > 1) cmos |= configs[1].cmosType;
+    sim_set_cmos(cmos);
+    fdc_init(configs, 2, randomSeed);
+
+    // the BIOS leaves interrupts on, the kernel runs with them on
+    irq_enable();
+
+    // the kernel never calls floppy_init() (it relies on the state the BIOS leaves behind), the harness does
+    sim_stats_t before = simStats;
+    uint64_t start = simNow;
+    if(floppy_init() != 0)
+    {
+        fprintf(stderr, "Error: The driver did not find an 82077\n");
+        return 1;
+    }
+    floppy_register();
+    report("init", 0, simNow - start, &before);
+
+    block_device_t *device = blk_get("fd0");
+    if(!device)
+    {
+        fprintf(stderr, "Error: The driver did not register fd0\n");
+        return 1;
+    }
+
+    for(int d = 0; d < drives; d++) floppy_set_verify(d, verify);
+    if(simSerial) blk_trace_start();
+
+    for(int i = first; i < argc; i++)
+    {
+        char name[32];
+        int count = -1;
+
+        strncpy(name, argv[i], sizeof(name) - 1);
+        name[sizeof(name) - 1] = 0;
+        char *colon = strchr(name, ':');
+        if(colon)
+        {
+            *colon = 0;
+            count = atoi(colon + 1);
+        }
+
+        workload_t *workload = 0;
+        for(size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++)
+        {
+            if(!strcmp(workloads[w].name, name)) workload = &workloads[w];
+        }
+        if(!workload) return usage(argv[0]);
+        if(count <= 0) count = workload->defaultCount;
+
+        before = simStats;
+        start = simNow;
+        int errorsBefore = dataErrors;
+
+        int bytes = workload->run(device, count);
+
+        report(argv[i], bytes, simNow - start, &before);
+        if(dataErrors != errorsBefore) printf("  DATA ERRORS: %d sectors did not hold what was expected\n", dataErrors - errorsBefore);
+    }
+
+    printf("\n== total %.1f ms simulated ==\n", ms(simNow));
+    for(int d = 0; d < drives; d++) report_driver(d);
+
+    if(simSerial)
+    {
+        blk_trace_dump();
+        fclose(simSerial);
+    }
+
+    return dataErrors ? 2 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,420 @@
+#include "./sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Everything around the floppy controller: memory, time, interrupts, the DMA controller, the CMOS,
+// and the few kernel functions the driver calls (timer.c, irq.c, io.c), all driven by simulated time
+//
+// Time only moves when the driver does something that takes time: every port access costs
+// SIM_PORT_NS, and waiting (timer_idle(), udelay(), msleep()) jumps ahead to the next event.
+// The controller's work is scheduled at the simulated time it ends, and its interrupt is delivered
+// as soon as time reaches it and interrupts are on, just like on the real machine.
+
+uint64_t simNow = 0;
+sim_stats_t simStats;
+int simQuiet = 0;
+FILE *simSerial = 0;
+
+// Give up on a run that is obviously stuck (a driver bug that waits forever)
+#define SIM_TIME_LIMIT MS(3600 * 1000)
+
+/*
+ * Memory
+ */
+
+uint32_t simAllocNext = 0x100000;
+
+int sim_memory_init()
+{
+    void *wanted = (void *) (uintptr_t) SIM_MEMORY_START;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_FIXED_NOREPLACE
+    flags |= MAP_FIXED_NOREPLACE;
+#endif
+
+    void *memory = mmap(wanted, SIM_MEMORY_END - SIM_MEMORY_START, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if(memory != wanted)
+    {
+        fprintf(stderr, "Error: Could not map the simulated memory at 0x%X (check vm.mmap_min_addr)\n", SIM_MEMORY_START);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Buffers for the workloads, in simulated physical memory above 1 MB (never freed)
+void *sim_alloc(uint32_t size)
+{
+    uint32_t address = simAllocNext;
+    simAllocNext = (simAllocNext + size + 0xFFF) & ~0xFFFu;
+
+    if(simAllocNext > SIM_MEMORY_END)
+    {
+        fprintf(stderr, "Error: Out of simulated memory\n");
+        exit(1);
+    }
+
+    return (void *) (uintptr_t) address;
+}
+
+// Returns where a physical address range is in this process, or 0 if it is not memory
+uint8_t *sim_physical(uint32_t address, uint32_t length)
+{
+    if(address < SIM_MEMORY_START || address + length > SIM_MEMORY_END || address + length < address) return 0;
+
+    return (uint8_t *) (uintptr_t) address;
+}
+
+/*
+ * Interrupts
+ */
+
+void (*irqHandlers[16])(regs *r);
+volatile char currentInterrupts[16];
+int irqPending[16];
+int interruptsOn = 0;
+int inInterrupt = 0;
+
+// Runs the handlers of pending interrupts, if the CPU would take them now
+void sim_deliver_irqs()
+{
+    if(!interruptsOn || inInterrupt) return;
+
+    for(int irq = 0; irq < 16; irq++)
+    {
+        if(!irqPending[irq]) continue;
+
+        irqPending[irq] = 0;
+        simStats.irqs++;
+
+        // the same as _irq_handler() in irq.c
+        currentInterrupts[irq] = 1;
+        if(irqHandlers[irq])
+        {
+            regs r;
+            memset(&r, 0, sizeof(r));
+            r.int_no = 32 + irq;
+
+            inInterrupt = 1;
+            irqHandlers[irq](&r);
+            inInterrupt = 0;
+        }
+
+        // a handler can make the controller interrupt again
+        irq = -1;
+    }
+}
+
+void sim_raise_irq(int irq)
+{
+    irqPending[irq] = 1;
+    sim_deliver_irqs();
+}
+
+void irq_install_handler(int irq, void (*handler)(regs *r))
+{
+    irqHandlers[irq] = handler;
+}
+
+void irq_uninstall_handler(int irq)
+{
+    irqHandlers[irq] = 0;
+}
+
+uint32 irq_save()
+{
+    uint32 eflags = interruptsOn ? 0x200 : 0;
+    interruptsOn = 0;
+    return eflags;
+}
+
+void irq_restore(uint32 eflags)
+{
+    interruptsOn = (eflags & 0x200) != 0;
+    sim_deliver_irqs();
+}
+
+void irq_enable()
+{
+    interruptsOn = 1;
+    sim_deliver_irqs();
+}
+
+/*
+ * Time
+ */
+
+// Moves time forward, handing out every controller event (and its interrupt) on the way, in order
+void sim_advance(uint64_t ns)
+{
+    uint64_t target = simNow + ns;
+
+    while(fdc_next_event() <= target)
+    {
+        uint64_t next = fdc_next_event();
+        if(next > simNow) simNow = next;
+        fdc_run_events();
+    }
+
+    // an interrupt handler run on the way may have moved time on by itself
+    if(simNow < target) simNow = target;
+
+    if(simNow > SIM_TIME_LIMIT)
+    {
+        fprintf(stderr, "Error: Simulated time ran past an hour, the driver is stuck\n");
+        exit(1);
+    }
+}
+
+// The TSC of the simulated CPU runs at 1 GHz, so cycles are nanoseconds
+uint64 timer_cycles()
+{
+    return simNow;
+}
+
+uint32 timer_cycles_to_us(uint64 cycles)
+{
+    return (uint32) (cycles / 1000);
+}
+
+uint32 timer_ms()
+{
+    return (uint32) (simNow / MS(1));
+}
+
+deadline_t deadline_us(uint32 us)
+{
+    return simNow + US(us);
+}
+
+deadline_t deadline_ms(uint32 ms)
+{
+    return simNow + MS(ms);
+}
+
+// Checking costs a little time, so a loop that only checks still gets somewhere
+int deadline_passed(deadline_t deadline)
+{
+    sim_advance(50);
+    return simNow >= deadline;
+}
+
+// hlt: sleeps until the next interrupt, the 1 ms timer tick at the latest
+void timer_idle()
+{
+    if(!interruptsOn)
+    {
+        sim_advance(50);
+        return;
+    }
+
+    uint64_t tick = (simNow / MS(1) + 1) * MS(1);
+    uint64_t next = fdc_next_event();
+
+    sim_advance((next < tick ? next : tick) - simNow);
+}
+
+void udelay(uint32 us)
+{
+    sim_advance(US(us));
+}
+
+void msleep(uint32 ms)
+{
+    sim_advance(MS(ms));
+}
+
+int irq_wait_timeout(int n, uint32 ms)
+{
+    deadline_t deadline = deadline_ms(ms);
+
+    while(!currentInterrupts[n])
+    {
+        if(deadline_passed(deadline)) return -1;
+        timer_idle();
+    }
+    currentInterrupts[n] = 0;
+
+    return 0;
+}
+
+void irq_clear(int n)
+{
+    currentInterrupts[n] = 0;
+}
+
+void irq_wait(int n)
+{
+    while(!currentInterrupts[n]) timer_idle();
+    currentInterrupts[n] = 0;
+}
+
+/*
+ * Console, the driver's messages are passed through, and COM1 (the block trace) goes to simSerial
+ */
+
+int kernel_printf(char string[])
+{
+    if(!simQuiet) fputs(string, stdout);
+    return (int) strlen(string);
+}
+
+int kernel_printint(uint32 n)
+{
+    if(!simQuiet) printf("%u", n);
+    return 0;
+}
+
+void serial_putchar(char character)
+{
+    if(simSerial && character != '\r') fputc(character, simSerial);
+}
+
+void serial_print(char *string)
+{
+    while(*string) serial_putchar(*string++);
+}
+
+void serial_printint(uint32 n)
+{
+    if(simSerial) fprintf(simSerial, "%u", n);
+}
+
+void serial_printhex(uint32 n)
+{
+    if(simSerial) fprintf(simSerial, "%08X", n);
+}
+
+/*
+ * The 8237 DMA controller, only channel 2 (the floppy) is modelled
+ */
+
+typedef struct
+{
+    int flipFlop;
+    uint16_t baseAddress;
+    uint16_t baseCount;
+    uint16_t address;
+    uint16_t count;
+    uint8_t page;
+    uint8_t mode;
+    int masked;
+
+} sim_dma_channel_t;
+
+sim_dma_channel_t dma = { .masked = 1 };
+
+// Writes one byte of a 16 bit register, low byte first (the flip-flop says which)
+void dma_write16(uint16_t *base, uint16_t *current, uint8_t value)
+{
+    if(dma.flipFlop) *base = (*base & 0x00FF) | (value << 8);
+    else *base = (*base & 0xFF00) | value;
+
+    *current = *base;
+    dma.flipFlop ^= 1;
+}
+
+void dma_outb(uint16_t port, uint8_t value)
+{
+    switch(port)
+    {
+        case 0x04: dma_write16(&dma.baseAddress, &dma.address, value); break;
+        case 0x05: dma_write16(&dma.baseCount, &dma.count, value); break;
+        case 0x81: dma.page = value; break;
+        case 0x0A: if((value & 3) == 2) dma.masked = (value & 4) != 0; break;
+        case 0x0B: if((value & 3) == 2) dma.mode = value; break;
+        case 0x0C: dma.flipFlop = 0; break;
+        case 0x0D: dma.masked = 1; dma.flipFlop = 0; break;
+    }
+}
+
+/*
+ * The controller asks for "length" bytes to be moved to or from memory
+ * returns how many were moved, the transfer stops early at the terminal count (which is reported) or when
+ * the channel is not set up for this direction (the controller reports an overrun)
+ * Like the real chip the address wraps around inside its 64 KB page
+ */
+int sim_dma_transfer(uint8_t *device, uint32_t length, int toMemory, int *terminalCount)
+{
+    *terminalCount = 0;
+
+    // mode bits 2-3: 01 writes memory, 10 reads memory
+    int type = (dma.mode >> 2) & 3;
+    if(dma.masked || type != (toMemory ? 1 : 2)) return 0;
+
+    uint32_t moved = 0;
+    while(moved < length)
+    {
+        uint32_t physical = ((uint32_t) dma.page << 16) | dma.address;
+        uint8_t *memory = sim_physical(physical, 1);
+        if(!memory)
+        {
+            fprintf(stderr, "Error: DMA to 0x%X, which is not memory\n", physical);
+            exit(1);
+        }
+
+        if(toMemory) *memory = device[moved];
+        else device[moved] = *memory;
+        moved++;
+
+        dma.address++;
+        if(dma.count-- == 0)
+        {
+            *terminalCount = 1;
+
+            // auto-init starts over, otherwise the channel masks itself
+            if(dma.mode & 0x10)
+            {
+                dma.address = dma.baseAddress;
+                dma.count = dma.baseCount;
+            }
+            else
+            {
+                dma.masked = 1;
+            }
+            break;
+        }
+    }
+
+    simStats.dmaBytes += moved;
+    return (int) moved;
+}
+
+/*
+ * CMOS, register 0x10 holds the types of floppy drives 0 and 1
+ */
+
+uint8_t cmosIndex = 0;
+uint8_t cmosFloppyTypes = 0x40;
+
+void sim_set_cmos(uint8_t floppyTypes)
+{
+    cmosFloppyTypes = floppyTypes;
+}
+
+/*
+ * Port I/O
+ */
+
+uint8 inb(uint16 port)
+{
+    simStats.portReads++;
+    sim_advance(SIM_PORT_NS);
+
+    if(port >= 0x3F0 && port <= 0x3F7) return fdc_inb(port);
+    if(port == 0x71) return cmosIndex == 0x10 ? cmosFloppyTypes : 0;
+
+    return 0xFF;
+}
+
+void outb(uint16 port, uint8 value)
+{
+    simStats.portWrites++;
+    sim_advance(SIM_PORT_NS);
+
+    if(port >= 0x3F0 && port <= 0x3F7) fdc_outb(port, value);
+    else if(port == 0x70) cmosIndex = value & 0x7F;
+    else if(port < 0x10 || (port >= 0x80 && port < 0x90)) dma_outb(port, value);
+}
\ No newline at end of file
@@ -0,0 +1,92 @@
+// The simulated PC the floppy driver runs on in fdcsim (see machine.c, fdc82077.c and fdcsim.c)
+
+// The kernel headers come first: io.h declares the kernel's own printf()/putchar()/getchar()/scanf(),
+// which are renamed here the same way the driver sources are renamed when they are compiled (see the Makefile)
+#define printf kernel_printf
+#define printint kernel_printint
+#define putchar kernel_putchar
+#define getchar kernel_getchar
+#define scanf kernel_scanf
+#include "../../include/types.h"
+#include "../../include/io.h"
+#include "../../include/irq.h"
+#include "../../include/timer.h"
+#include "../../include/blkdev.h"
+#include "../../include/volume.h"
+#include "../../include/fdc.h"
+#include "../../include/blktrace.h"
+#undef printf
+#undef printint
+#undef putchar
+#undef getchar
+#undef scanf
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Simulated time, in nanoseconds since the machine was switched on
+extern uint64_t simNow;
+#define SIM_NEVER UINT64_MAX
+#define MS(ms) ((uint64_t) (ms) * 1000000)
+#define US(us) ((uint64_t) (us) * 1000)
+
+// Every port access takes about a microsecond on the ISA bus
+#define SIM_PORT_NS 1000
+
+// Physical memory from SIM_MEMORY_START up to 16 MB is mapped at the same addresses in this process,
+// so the fixed addresses the driver uses (the DMA pool) and the addresses it hands the DMA controller just work
+#define SIM_MEMORY_START 0x10000
+#define SIM_MEMORY_END 0x1000000
+
+// What happened, for the report
+typedef struct
+{
+    uint64_t portReads;
+    uint64_t portWrites;
+    uint64_t commands[32];          // by command code (the low 5 bits)
+    uint64_t protocolErrors;        // bytes written or read in the wrong phase
+    uint64_t irqs;
+    uint64_t dmaBytes;
+    uint64_t seeks;                 // head movements, explicit or implied
+    uint64_t steps;
+    uint64_t seekNs;
+    uint64_t rotationNs;            // waiting for a sector to come around
+    uint64_t transferNs;            // sectors passing under the head while they are read or written
+    uint64_t spinUpNs;
+    uint64_t sectorsRead;
+    uint64_t sectorsWritten;
+    uint64_t sectorsVerified;
+    uint64_t injectedErrors;
+    uint64_t timeouts;              // commands that never finish (the driver has to time out and reset)
+
+} sim_stats_t;
+
+extern sim_stats_t simStats;
+
+// machine.c
+int sim_memory_init();
+void *sim_alloc(uint32_t size);
+uint8_t *sim_physical(uint32_t address, uint32_t length);
+void sim_advance(uint64_t ns);
+void sim_raise_irq(int irq);
+void sim_set_cmos(uint8_t floppyTypes);
+int sim_dma_transfer(uint8_t *device, uint32_t length, int toMemory, int *terminalCount);
+extern int simQuiet;
+extern FILE *simSerial;     // where COM1 goes, 0 to drop it
+
+// fdc82077.c
+typedef struct
+{
+    int present;
+    int cmosType;           // 4 = 1.44 MB, 5 = 2.88 MB
+    int sectorsPerTrack;    // of the disk in it, 18 or 36
+    int errorsPerMillion;   // read/verify CRC errors injected per million sectors
+
+} sim_drive_config_t;
+
+void fdc_init(sim_drive_config_t *drives, int count, uint32_t seed);
+uint8_t fdc_inb(uint16_t port);
+void fdc_outb(uint16_t port, uint8_t value);
+uint64_t fdc_next_event();
+void fdc_run_events();
+const char *fdc_command_name(int code);
\ No newline at end of file
@@ -0,0 +1,134 @@
+// Compresses a file into a single LZ4 block (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md)
+// Used by the Makefile to pack kernel.bin, the bootloader unpacks it again with asm/unlz4.asm
+// Usage: lz4pack <input> <output>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+#define HASH_BITS 16
+
+// The block format wants the last 5 bytes to be literals, and no match to start in the last 12
+#define LAST_LITERALS 5
+#define MATCH_LIMIT 12
+
+unsigned int hash(const unsigned char *p)
+{
+    unsigned int value = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Writes a length that did not fit into the 4 bits of the token, as a run of 255s and a final byte
+unsigned char *write_length(unsigned char *out, size_t length)
+{
+    while(length >= 255)
+    {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (unsigned char) length;
+    return out;
+}
+
+unsigned char *write_sequence(unsigned char *out, const unsigned char *literals, size_t literalLength, size_t offset, size_t matchLength)
+{
+    unsigned char *token = out++;
+
+    *token = (unsigned char) ((literalLength < 15 ? literalLength : 15) << 4);
+    if(literalLength >= 15) out = write_length(out, literalLength - 15);
+
+    memcpy(out, literals, literalLength);
+    out += literalLength;
+
+    // The last sequence has no match
+    if(matchLength == 0) return out;
+
+    *out++ = (unsigned char) offset;
+    *out++ = (unsigned char) (offset >> 8);
+
+    matchLength -= MIN_MATCH;
+    *token |= (unsigned char) (matchLength < 15 ? matchLength : 15);
+    if(matchLength >= 15) out = write_length(out, matchLength - 15);
+
+    return out;
+}
+
+// Greedy compression, every position is looked up in a hash table of where its 4 bytes were last seen
+size_t compress(const unsigned char *in, size_t size, unsigned char *out)
+{
+    static size_t table[1 << HASH_BITS];
+    unsigned char *start = out;
+    size_t anchor = 0;
+    size_t i = 0;
+
+    for(size_t j = 0; j < (1 << HASH_BITS); j++) table[j] = (size_t) -1;
+
+    while(size >= MATCH_LIMIT && i + MATCH_LIMIT <= size)
+    {
+        unsigned int h = hash(in + i);
+        size_t candidate = table[h];
+        table[h] = i;
+
+        if(candidate == (size_t) -1 || i - candidate > MAX_OFFSET || memcmp(in + candidate, in + i, MIN_MATCH) != 0)
+        {
+            i++;
+            continue;
+        }
+
+        size_t length = MIN_MATCH;
+        while(i + length < size - LAST_LITERALS && in[candidate + length] == in[i + length]) length++;
+
+        out = write_sequence(out, in + anchor, i - anchor, i - candidate, length);
+
+        i += length;
+        anchor = i;
+    }
+
+    out = write_sequence(out, in + anchor, size - anchor, 0, 0);
+
+    return (size_t) (out - start);
+}
+
+int main(int argc, char **argv)
+{
+    if(argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <input> <output>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *input = fopen(argv[1], "rb");
+    if(!input)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    fseek(input, 0, SEEK_END);
+    size_t size = (size_t) ftell(input);
+    fseek(input, 0, SEEK_SET);
+
+    // Incompressible data grows by a length byte per 255 bytes, plus a token
+    unsigned char *in = malloc(size + 1);
+    unsigned char *out = malloc(size + size / 255 + 16);
+    if(!in || !out || fread(in, 1, size, input) != size)
+    {
+        fprintf(stderr, "Error: Could not read %s\n", argv[1]);
+        return 1;
+    }
+    fclose(input);
+
+    size_t packed = compress(in, size, out);
+
+    FILE *output = fopen(argv[2], "wb");
+    if(!output || fwrite(out, 1, packed, output) != packed || fclose(output) != 0)
+    {
+        fprintf(stderr, "Error: Could not write %s\n", argv[2]);
+        return 1;
+    }
+
+    printf("%s: %zu -> %zu bytes\n", argv[1], size, packed);
+    return 0;
+}
\ No newline at end of file